@@ -0,0 +1,766 @@
+/*
+	fix-ca-cli.c	Fix Chromatic Aberration for image files, without Gimp
+	Copyright (c) 2023, 2024 Jose Da Silva (updates and improvements)
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* fix-ca-cli [OPTION]... FILE...
+   Corrects each FILE with the same settings as the plug-in.  Files are
+   shared out to a fixed number of worker threads, each with its own
+   FixCaContext, so a batch doesn't need a Gimp started per image. */
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#if __has_include("fix-ca-config.h")
+#include "fix-ca-config.h"
+#endif
+
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fix-ca-core.h"
+#include "fix-ca-io.h"
+#include "fix-ca-profile.h"
+#include "fix-ca-serve.h"
+
+#ifndef FIX_CA_MAJOR_VERSION
+#define FIX_CA_MAJOR_VERSION	"4"
+#define FIX_CA_MINOR_VERSION	"2"
+#endif
+
+/* Shared by the workers, next is taken under lock */
+typedef struct {
+	FixCaParams	*params;
+	char	**files;
+	int	count;
+	int	next;
+	int	failed;
+	const char	*out_dir;
+	FixCaFormat	out_format;
+	FixCaProfiles	*profiles;	/* or NULL */
+	int	sweep;		/* candidates a side, 0 for none */
+	double	sweep_step;
+	int	sheet;		/* contact sheet crop size, 0 for none */
+	int	quiet;
+	pthread_mutex_t	lock;
+} FixCaBatch;
+
+/* Filter mode, the last cap source rows read are kept */
+#define STREAM_BAND	8
+
+typedef struct {
+	FixCaStream	*in;
+	unsigned char	*rows;
+	size_t	row_size;
+	int	cap;
+	int	count;		/* rows read so far */
+} FixCaRing;
+
+/* Local function prototypes */
+static void	usage (FILE *fp);
+static int	parse_amount (const char *arg, double *value);
+static int	parse_curve (const char *arg, FixCaCurve *curve);
+static const char *format_ext (FixCaFormat format);
+static char	*output_name (FixCaBatch *batch, const char *name,
+			      const char *suffix, FixCaFormat format);
+static const char *sweep (FixCaBatch *batch, const char *name,
+			  FixCaImage *image, FixCaFormat format,
+			  FixCaParams *params);
+static const char *fix_file (FixCaBatch *batch, const char *name);
+static const char *save_profile (FixCaParams *params, const char *store,
+				 const char *name);
+static void	*worker (void *data);
+static void	ring_fetch (void *user_data, int x, int y, int width,
+			    unsigned char *row);
+static const char *fix_stream (FixCaParams *defaults, FILE *in, FILE *out);
+
+static void usage (FILE *fp)
+{
+	fprintf (fp, "Usage: fix-ca-cli [OPTION]... FILE...\n"
+		 "Fix chromatic aberration in PNG, PAM, PFM or TIFF image files.\n\n"
+		 "  -b, --blue=PIXELS       lateral blue shift at the edge\n"
+		 "  -r, --red=PIXELS        lateral red shift at the edge\n"
+		 "      --lens-x=X          lens center, default image center\n"
+		 "      --lens-y=Y\n"
+		 "  -i, --interpolation=N   0=None, 1=Linear (default), 2=Cubic\n"
+		 "      --x-blue=PIXELS     directional shifts\n"
+		 "      --x-red=PIXELS\n"
+		 "      --y-blue=PIXELS\n"
+		 "      --y-red=PIXELS\n"
+		 "      --blue-curve=LIST   lateral blue shift as D:S,..., S pixels at\n"
+		 "                          D {0..1} of the way to the edge along x\n"
+		 "                          and along y, up to %d points, in place\n"
+		 "                          of -b\n"
+		 "      --red-curve=LIST\n"
+		 "  -o, --output=DIR        write DIR/NAME instead of NAME-fixed\n"
+		 "  -f, --format=EXT        write png, pfm or tif, default as read\n"
+		 "  -j, --jobs=N            files done at once, default processors\n"
+		 "      --sweep=N[,STEP]    try N x N blue and red shifts STEP apart\n"
+		 "                          (default 0.5) around -b and -r, and use\n"
+		 "                          the one leaving the least color fringe\n"
+		 "      --sheet=SIZE        with --sweep, write the top left SIZE x\n"
+		 "                          SIZE of each try side by side to NAME-sweep\n"
+		 "  -P, --profiles=FILE     settings for each camera and lens, from\n"
+		 "                          FILE, when EXIF names one it has\n"
+		 "      --save-profile      store the settings in FILE for the camera\n"
+		 "                          and lens of each image, and their size\n"
+		 "      --serve=SOCKET      take jobs on a Unix domain socket, with\n"
+		 "                          --jobs workers, see README\n"
+		 "  -q, --quiet             only report errors\n"
+		 "  -h, --help\n"
+		 "  -V, --version\n\n"
+		 "Shifts are {-%d..+%d} pixels.  With FILE -, PAM or PFM images\n"
+		 "are read from stdin and written corrected to stdout.\n", \
+		 FIX_CA_CURVE_POINTS, INPUT_MAX, INPUT_MAX);
+}
+
+static int parse_amount (const char *arg, double *value)
+{
+	char	*end;
+	double	d = strtod (arg, &end);
+
+	if (end == arg || *end != '\0' || !isfinite (d) || \
+	    d < -INPUT_MAX || d > INPUT_MAX)
+		return 0;
+	*value = d;
+	return 1;
+}
+
+/* D:S,D:S,... with D rising in {0..1}, returns 0 if it isn't */
+static int parse_curve (const char *arg, FixCaCurve *curve)
+{
+	const char	*p = arg;
+	char	*end;
+	double	r, d;
+
+	curve->n = 0;
+	while (curve->n < FIX_CA_CURVE_POINTS) {
+		r = strtod (p, &end);
+		if (end == p || *end != ':' || !(r >= 0 && r <= 1) || \
+		    (curve->n > 0 && r <= curve->distance[curve->n-1]))
+			break;
+		p = end + 1;
+		d = strtod (p, &end);
+		if (end == p || !isfinite (d) || d < -INPUT_MAX || d > INPUT_MAX)
+			break;
+		curve->distance[curve->n] = r;
+		curve->shift[curve->n++] = d;
+		if (*end == '\0')
+			return 1;
+		if (*end != ',')
+			break;
+		p = end + 1;
+	}
+	curve->n = 0;
+	return 0;
+}
+
+static const char *format_ext (FixCaFormat format)
+{
+	switch (format) {
+		case FIX_CA_FORMAT_PNG:
+			return "png";
+		case FIX_CA_FORMAT_PFM:
+			return "pfm";
+		case FIX_CA_FORMAT_TIFF:
+			return "tif";
+		case FIX_CA_FORMAT_PAM:
+			return "pam";
+		default:
+			return "";
+	}
+}
+
+/* DIR/NAME.EXT with -o, else NAME-suffix.EXT beside the input.  With
+   -o and a suffix other than fixed, DIR/NAME-suffix.EXT. */
+static char *output_name (FixCaBatch *batch, const char *name,
+			  const char *suffix, FixCaFormat format)
+{
+	const char *base, *dot, *stem;
+	char	*out;
+	int	len;
+
+	base = strrchr (name, '/');
+	base = base == NULL ? name : base + 1;
+	if ((dot = strrchr (base, '.')) == NULL)
+		dot = base + strlen (base);
+	stem = batch->out_dir != NULL ? base : name;
+	len = (int) (dot - stem);
+
+	if ((out = malloc ((batch->out_dir != NULL ? strlen (batch->out_dir) : 0) + \
+			   (size_t) len + strlen (suffix) + 16)) == NULL)
+		return NULL;
+	if (batch->out_dir != NULL && strcmp (suffix, "fixed") == 0)
+		sprintf (out, "%s/%.*s.%s", batch->out_dir, len, stem, \
+			 format_ext (format));
+	else if (batch->out_dir != NULL)
+		sprintf (out, "%s/%.*s-%s.%s", batch->out_dir, len, stem, suffix, \
+			 format_ext (format));
+	else
+		sprintf (out, "%.*s-%s.%s", len, stem, suffix, format_ext (format));
+	return out;
+}
+
+/* Score blue and red shifts around those in params in one pass over
+   image, and keep the best in params */
+static const char *sweep (FixCaBatch *batch, const char *name,
+			  FixCaImage *image, FixCaFormat format,
+			  FixCaParams *params)
+{
+	FixCaParams	*candidates;
+	FixCaImage	sheet;
+	FixCaWindow	win;
+	const char	*err = NULL;
+	double	*scores;
+	char	*out;
+	int	i, best, n = batch->sweep * batch->sweep, size;
+
+	candidates = malloc (n * (sizeof (FixCaParams) + sizeof (double)));
+	if (candidates == NULL)
+		return "Not enough memory";
+	scores = (double *) (candidates + n);
+	for (i = 0; i < n; i++) {
+		candidates[i] = *params;
+		candidates[i].blue += ((i % batch->sweep) - (batch->sweep-1) / 2.0) * \
+				      batch->sweep_step;
+		candidates[i].red += ((i / batch->sweep) - (batch->sweep-1) / 2.0) * \
+				     batch->sweep_step;
+		candidates[i].blue = fmax (-INPUT_MAX, fmin (candidates[i].blue, INPUT_MAX));
+		candidates[i].red = fmax (-INPUT_MAX, fmin (candidates[i].red, INPUT_MAX));
+	}
+
+	memset (&win, 0, sizeof (win));
+	win.data = image->data;
+	win.width = image->width;
+	win.height = image->height;
+	if (fix_ca_sweep (&win, image->width, image->height, image->bytes, \
+			  image->bpc, candidates, n, 0, image->width, \
+			  0, image->height, scores, NULL, 0) != 0) {
+		free (candidates);
+		return "Not enough memory";
+	}
+	for (i = best = 0; i < n; i++) {
+		if (scores[i] < scores[best])
+			best = i;
+		if (!batch->quiet)
+			printf ("%s: blue %.2f red %.2f fringe %.6f\n", name, \
+				candidates[i].blue, candidates[i].red, scores[i]);
+	}
+	params->blue = candidates[best].blue;
+	params->red = candidates[best].red;
+
+	/* Crop of every candidate, sweep columns to a row */
+	if (batch->sheet > 0) {
+		size = batch->sheet;
+		if (size > image->width)
+			size = image->width;
+		if (size > image->height)
+			size = image->height;
+		sheet = *image;
+		sheet.width = size * batch->sweep;
+		sheet.height = size * batch->sweep;
+		sheet.data = malloc ((size_t) sheet.width * sheet.height * sheet.bytes);
+		if (sheet.data == NULL)
+			err = "Not enough memory";
+		else if (fix_ca_sweep (&win, image->width, image->height, \
+				       image->bytes, image->bpc, candidates, n, \
+				       0, size, 0, size, scores, sheet.data, \
+				       batch->sweep) != 0)
+			err = "Not enough memory";
+		else if ((out = output_name (batch, name, "sweep", format)) == NULL)
+			err = "Not enough memory";
+		else {
+			err = fix_ca_image_save (out, format, &sheet);
+			free (out);
+		}
+		fix_ca_image_free (&sheet);
+	}
+	free (candidates);
+	return err;
+}
+
+static const char *fix_file (FixCaBatch *batch, const char *name)
+{
+	FixCaFormat	format, out_format;
+	FixCaImage	image, fixed;
+	FixCaParams	params = *batch->params;
+	FixCaContext	ctx;
+	FixCaWindow	win;
+	FixCaLens	lens;
+	FixCaRemap	remap;
+	const FixCaProfile *profile = NULL;
+	FixCaStats	stats;
+	const char	*err;
+	char	*out;
+	double	start = 0.0, t = 0.0;
+	int	ret, timed = fix_ca_stats_target () != NULL;
+
+	fix_ca_stats_init (&stats);
+	if (timed)
+		start = fix_ca_stats_now ();
+	if ((format = fix_ca_image_format (name)) == FIX_CA_FORMAT_UNKNOWN)
+		return "Unknown file format";
+	if (batch->profiles != NULL && fix_ca_image_lens (name, format, &lens) && \
+	    (profile = fix_ca_profiles_find (batch->profiles, &lens)) != NULL)
+		fix_ca_profile_params (profile, &params);
+	out_format = batch->out_format != FIX_CA_FORMAT_UNKNOWN ? \
+		     batch->out_format : format;
+	if ((err = fix_ca_image_load (name, format, &image)) != NULL)
+		return err;
+	if (timed)
+		stats.seconds[FIX_CA_PHASE_FETCH] += fix_ca_stats_now () - start;
+
+	if (params.lens_x < 0 || params.lens_x >= image.width)
+		params.lens_x = round (image.width/2);
+	if (params.lens_y < 0 || params.lens_y >= image.height)
+		params.lens_y = round (image.height/2);
+
+	if (batch->sweep > 0 && \
+	    (err = sweep (batch, name, &image, out_format, &params)) != NULL) {
+		fix_ca_image_free (&image);
+		return err;
+	}
+
+	fixed = image;
+	fixed.data = malloc ((size_t) image.width * image.height * image.bytes);
+	if (fixed.data == NULL) {
+		fix_ca_image_free (&image);
+		return "Not enough memory";
+	}
+	stats.alloc_bytes += (int64_t) image.width * image.height * image.bytes;
+
+	memset (&win, 0, sizeof (win));
+	win.data = image.data;
+	win.width = image.width;
+	win.height = image.height;
+	fix_ca_context_init (&ctx, &params, image.width, image.height, \
+			     image.bytes, image.bpc);
+	ctx.stats = timed ? &stats : NULL;
+	if (profile != NULL && batch->sweep == 0 && \
+	    fix_ca_profiles_remap (batch->profiles, profile, \
+				   image.width, image.height, &remap))
+		ctx.remap = &remap;
+	ret = fix_ca_run (&ctx, &win, fixed.data, 0, image.width, 0, image.height);
+	fix_ca_context_clear (&ctx);
+	fix_ca_image_free (&image);
+
+	if (ret != 0)
+		err = "Not enough memory";
+	else if ((out = output_name (batch, name, "fixed", out_format)) == NULL)
+		err = "Not enough memory";
+	else {
+		if (timed)
+			t = fix_ca_stats_now ();
+		err = fix_ca_image_save (out, out_format, &fixed);
+		if (timed)
+			stats.seconds[FIX_CA_PHASE_WRITE] += fix_ca_stats_now () - t;
+		if (err == NULL && !batch->quiet)
+			printf ("%s -> %s%s\n", name, out, \
+				profile != NULL ? " (lens profile)" : "");
+		free (out);
+	}
+	fix_ca_image_free (&fixed);
+	if (timed && err == NULL)
+		fix_ca_stats_emit ("fix-ca-cli", &stats, fix_ca_stats_now () - start);
+	return err;
+}
+
+/* Settings as the profile of the camera and lens that took name, with
+   a remap table for its size */
+static const char *save_profile (FixCaParams *params, const char *store,
+				 const char *name)
+{
+	FixCaFormat	format;
+	FixCaImage	image;
+	FixCaLens	lens;
+	const char	*err;
+	int	size[2];
+
+	if ((format = fix_ca_image_format (name)) == FIX_CA_FORMAT_UNKNOWN)
+		return "Unknown file format";
+	if (!fix_ca_image_lens (name, format, &lens))
+		return "No camera named in EXIF";
+	if ((err = fix_ca_image_load (name, format, &image)) != NULL)
+		return err;
+	size[0] = image.width;
+	size[1] = image.height;
+	fix_ca_image_free (&image);
+
+	if ((err = fix_ca_profiles_save (store, &lens, params, size, 1)) == NULL)
+		printf ("%s: %s %s, %s, %.1fmm\n", name, lens.make, lens.model, \
+			lens.lens[0] ? lens.lens : "?", lens.focal10 / 10.0);
+	return err;
+}
+
+static void *worker (void *data)
+{
+	FixCaBatch	*batch = data;
+	const char	*err;
+	int	i;
+
+	for (;;) {
+		pthread_mutex_lock (&batch->lock);
+		i = batch->next++;
+		pthread_mutex_unlock (&batch->lock);
+		if (i >= batch->count)
+			break;
+
+		if ((err = fix_file (batch, batch->files[i])) != NULL) {
+			fprintf (stderr, "fix-ca-cli: %s: %s\n", batch->files[i], err);
+			pthread_mutex_lock (&batch->lock);
+			batch->failed++;
+			pthread_mutex_unlock (&batch->lock);
+		}
+	}
+	return NULL;
+}
+
+static void ring_fetch (void *user_data, int x, int y, int width,
+			unsigned char *row)
+{
+	FixCaRing	*ring = user_data;
+
+	memcpy (row, &ring->rows[(size_t) (y % ring->cap) * ring->row_size + \
+				 (size_t) x * ring->in->bytes], \
+		(size_t) width * ring->in->bytes);
+}
+
+/* Read PAM or PFM images from in, write them corrected to out.  A band
+   of rows is written as soon as the source rows it needs have arrived.
+   Only those are kept, so memory doesn't grow with image height. */
+static const char *fix_stream (FixCaParams *defaults, FILE *in, FILE *out)
+{
+	FixCaStream	src, dst;
+	FixCaParams	params;
+	FixCaContext	ctx;
+	FixCaWindow	win;
+	FixCaRing	ring;
+	FixCaStats	stats;
+	unsigned char	*dest;
+	const char	*err;
+	double	start = 0.0, t = 0.0;
+	int	y1, y2, y, timed = fix_ca_stats_target () != NULL;
+
+	for (;;) {
+		if ((err = fix_ca_stream_read_header (&src, in)) != NULL)
+			return err;
+		if (src.format == FIX_CA_FORMAT_UNKNOWN)
+			return NULL;
+		fix_ca_stats_init (&stats);
+		if (timed)
+			start = fix_ca_stats_now ();
+
+		params = *defaults;
+		if (params.lens_x < 0 || params.lens_x >= src.width)
+			params.lens_x = round (src.width/2);
+		if (params.lens_y < 0 || params.lens_y >= src.height)
+			params.lens_y = round (src.height/2);
+		/* PFM comes bottom row first, correct it upside down.  Every
+		   row keeps its distance from the center, but the lens radius
+		   is measured to one row past the bottom, so it can be one
+		   more or less, see README. */
+		if (src.bottom_up) {
+			params.lens_y = src.height - 1 - params.lens_y;
+			params.y_blue = -params.y_blue;
+			params.y_red = -params.y_red;
+		}
+
+		/* Rows kept, the tallest source window of any band, from
+		   the core as each band asks for it below */
+		ring.cap = 1;
+		for (y1 = 0; y1 < src.height; y1 = y2) {
+			y2 = y1 + STREAM_BAND < src.height ? y1 + STREAM_BAND : src.height;
+			fix_ca_source_rect (&params, src.width, src.height, \
+					    0, src.width, y1, y2, &win);
+			if (win.height > ring.cap)
+				ring.cap = win.height;
+		}
+		ring.in = &src;
+		ring.row_size = (size_t) src.width * src.bytes;
+		ring.count = 0;
+		ring.rows = malloc (ring.cap * ring.row_size);
+		dest = malloc (STREAM_BAND * ring.row_size);
+		if (ring.rows == NULL || dest == NULL) {
+			free (ring.rows);
+			free (dest);
+			return "Not enough memory";
+		}
+		stats.alloc_bytes += (int64_t) (ring.cap + STREAM_BAND) * ring.row_size;
+
+		err = fix_ca_stream_write_header (&dst, out, &src);
+		fix_ca_context_init (&ctx, &params, src.width, src.height, \
+				     src.bytes, src.bpc);
+		ctx.stats = timed ? &stats : NULL;
+		for (y1 = 0; y1 < src.height && err == NULL; y1 = y2) {
+			y2 = y1 + STREAM_BAND < src.height ? y1 + STREAM_BAND : src.height;
+			fix_ca_source_rect (&params, src.width, src.height, \
+					    0, src.width, y1, y2, &win);
+			win.data = NULL;
+			win.fetch_row = ring_fetch;
+			win.user_data = &ring;
+			/* Windows only move down, so rows before win.y are done */
+			if (win.height > ring.cap) {
+				err = "Source rows out of reach";
+				break;
+			}
+			if (timed)
+				t = fix_ca_stats_now ();
+			while (err == NULL && ring.count < win.y + win.height) {
+				err = fix_ca_stream_read_row (&src, &ring.rows[ \
+					(size_t) (ring.count % ring.cap) * ring.row_size]);
+				ring.count++;
+			}
+			if (timed)
+				stats.seconds[FIX_CA_PHASE_FETCH] += fix_ca_stats_now () - t;
+			if (err == NULL && fix_ca_run (&ctx, &win, dest, \
+						       0, src.width, y1, y2) != 0)
+				err = "Not enough memory";
+			if (timed)
+				t = fix_ca_stats_now ();
+			for (y = 0; y < y2 - y1 && err == NULL; y++)
+				err = fix_ca_stream_write_row (&dst, \
+							       &dest[y * ring.row_size]);
+			if (timed)
+				stats.seconds[FIX_CA_PHASE_WRITE] += fix_ca_stats_now () - t;
+		}
+		/* Skip rows nothing needed, the next image follows them */
+		while (err == NULL && ring.count < src.height) {
+			err = fix_ca_stream_read_row (&src, ring.rows);
+			ring.count++;
+		}
+		fix_ca_context_clear (&ctx);
+		free (ring.rows);
+		free (dest);
+		if (err != NULL)
+			return err;
+		if (fflush (out) != 0)
+			return "Write error";
+		if (timed)
+			fix_ca_stats_emit ("fix-ca-cli-stream", &stats, \
+					   fix_ca_stats_now () - start);
+	}
+}
+
+int main (int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "blue",		required_argument, NULL, 'b' },
+		{ "red",		required_argument, NULL, 'r' },
+		{ "lens-x",		required_argument, NULL, 'X' },
+		{ "lens-y",		required_argument, NULL, 'Y' },
+		{ "interpolation",	required_argument, NULL, 'i' },
+		{ "x-blue",		required_argument, NULL, '1' },
+		{ "x-red",		required_argument, NULL, '2' },
+		{ "y-blue",		required_argument, NULL, '3' },
+		{ "y-red",		required_argument, NULL, '4' },
+		{ "blue-curve",		required_argument, NULL, '5' },
+		{ "red-curve",		required_argument, NULL, '6' },
+		{ "output",		required_argument, NULL, 'o' },
+		{ "format",		required_argument, NULL, 'f' },
+		{ "jobs",		required_argument, NULL, 'j' },
+		{ "profiles",		required_argument, NULL, 'P' },
+		{ "save-profile",	no_argument, NULL, 'S' },
+		{ "sweep",		required_argument, NULL, 'W' },
+		{ "sheet",		required_argument, NULL, 'H' },
+		{ "serve",		required_argument, NULL, 'D' },
+		{ "quiet",		no_argument, NULL, 'q' },
+		{ "help",		no_argument, NULL, 'h' },
+		{ "version",		no_argument, NULL, 'V' },
+		{ NULL, 0, NULL, 0 }
+	};
+	FixCaParams	params;
+	FixCaBatch	batch;
+	FixCaProfiles	profiles;
+	const char	*store = NULL, *service = NULL, *err;
+	pthread_t	*threads;
+	double	*amount;
+	FixCaCurve	*curve;
+	char	name[8];
+	long	jobs;
+	int	c, i, started, learn = 0;
+
+	memset (&params, 0, sizeof (params));
+	params.lens_x = params.lens_y = -1.0;
+	params.interpolation = FIX_CA_INTERPOLATION_LINEAR;
+	memset (&batch, 0, sizeof (batch));
+	batch.params = &params;
+	jobs = sysconf (_SC_NPROCESSORS_ONLN);
+
+	while ((c = getopt_long (argc, argv, "b:r:i:o:f:j:P:qhV", \
+				 long_options, NULL)) != -1) {
+		amount = NULL;
+		curve = NULL;
+		switch (c) {
+			case 'b': amount = &params.blue; break;
+			case 'r': amount = &params.red; break;
+			case '1': amount = &params.x_blue; break;
+			case '2': amount = &params.x_red; break;
+			case '3': amount = &params.y_blue; break;
+			case '4': amount = &params.y_red; break;
+			case '5': curve = &params.blue_curve; break;
+			case '6': curve = &params.red_curve; break;
+			case 'X':
+				params.lens_x = atoi (optarg);
+				break;
+			case 'Y':
+				params.lens_y = atoi (optarg);
+				break;
+			case 'i':
+				params.interpolation = atoi (optarg);
+				if (params.interpolation < FIX_CA_INTERPOLATION_NONE || \
+				    params.interpolation > FIX_CA_INTERPOLATION_CUBIC) {
+					fprintf (stderr, "fix-ca-cli: interpolation is 0, 1 or 2\n");
+					return 2;
+				}
+				break;
+			case 'o':
+				batch.out_dir = optarg;
+				break;
+			case 'f':
+				snprintf (name, sizeof (name), "x.%s", optarg);
+				if ((batch.out_format = fix_ca_image_format (name)) == \
+				    FIX_CA_FORMAT_UNKNOWN) {
+					fprintf (stderr, "fix-ca-cli: can't write %s files\n", optarg);
+					return 2;
+				}
+				break;
+			case 'j':
+				jobs = atol (optarg);
+				break;
+			case 'P':
+				store = optarg;
+				break;
+			case 'S':
+				learn = 1;
+				break;
+			case 'W':
+				batch.sweep_step = 0.5;
+				if (sscanf (optarg, "%d,%lf", &batch.sweep, \
+					    &batch.sweep_step) < 1 || batch.sweep < 1 || \
+				    batch.sweep > 16 || !(batch.sweep_step > 0)) {
+					fprintf (stderr, "fix-ca-cli: sweep is N[,STEP], N {1..16}\n");
+					return 2;
+				}
+				break;
+			case 'H':
+				batch.sheet = atoi (optarg);
+				break;
+			case 'D':
+				service = optarg;
+				break;
+			case 'q':
+				batch.quiet = 1;
+				break;
+			case 'h':
+				usage (stdout);
+				return 0;
+			case 'V':
+				printf ("fix-ca-cli " FIX_CA_MAJOR_VERSION "." \
+					FIX_CA_MINOR_VERSION "\n");
+				return 0;
+			default:
+				usage (stderr);
+				return 2;
+		}
+		if (amount != NULL && !parse_amount (optarg, amount)) {
+			fprintf (stderr, "fix-ca-cli: %s is not in {-%d..+%d}\n", \
+				 optarg, INPUT_MAX, INPUT_MAX);
+			return 2;
+		}
+		if (curve != NULL && !parse_curve (optarg, curve)) {
+			fprintf (stderr, "fix-ca-cli: %s is not D:S,... with D rising in "
+				 "{0..1}, S in {-%d..+%d}, up to %d points\n", optarg, \
+				 INPUT_MAX, INPUT_MAX, FIX_CA_CURVE_POINTS);
+			return 2;
+		}
+	}
+	/* Sweeps and profiles are of the blue and red amounts */
+	if ((batch.sweep > 0 || learn) && \
+	    (params.blue_curve.n > 0 || params.red_curve.n > 0)) {
+		fprintf (stderr, "fix-ca-cli: curves can't be swept or saved in a profile\n");
+		return 2;
+	}
+	if (service != NULL && optind == argc) {
+		if ((err = fix_ca_serve (service, &params, (int) jobs, \
+					 batch.quiet)) != NULL) {
+			fprintf (stderr, "fix-ca-cli: %s: %s\n", service, err);
+			return 1;
+		}
+		return 0;
+	}
+	if (optind >= argc || (learn && store == NULL)) {
+		usage (stderr);
+		return 2;
+	}
+
+	/* One at a time, each rewrites the file */
+	if (learn) {
+		for (i = optind; i < argc; i++)
+			if ((err = save_profile (&params, store, argv[i])) != NULL) {
+				fprintf (stderr, "fix-ca-cli: %s: %s\n", argv[i], err);
+				batch.failed++;
+			}
+		return batch.failed ? 1 : 0;
+	}
+
+	if (argc - optind == 1 && strcmp (argv[optind], "-") == 0) {
+		const char *err = fix_stream (&params, stdin, stdout);
+		if (err != NULL) {
+			fprintf (stderr, "fix-ca-cli: -: %s\n", err);
+			return 1;
+		}
+		return 0;
+	}
+
+	/* Mapped once, shared read only by the workers */
+	if (store != NULL) {
+		if ((err = fix_ca_profiles_open (&profiles, store)) != NULL) {
+			fprintf (stderr, "fix-ca-cli: %s: %s\n", store, err);
+			return 1;
+		}
+		batch.profiles = &profiles;
+	}
+
+	batch.files = &argv[optind];
+	batch.count = argc - optind;
+	if (jobs < 1)
+		jobs = 1;
+	if (jobs > batch.count)
+		jobs = batch.count;
+
+	/* The calling thread is a worker too */
+	pthread_mutex_init (&batch.lock, NULL);
+	threads = malloc (sizeof (pthread_t) * jobs);
+	started = 0;
+	if (threads != NULL)
+		for (i = 1; i < jobs; i++, started++)
+			if (pthread_create (&threads[started], NULL, worker, &batch) != 0)
+				break;
+	worker (&batch);
+	for (i = 0; i < started; i++)
+		pthread_join (threads[i], NULL);
+	free (threads);
+	pthread_mutex_destroy (&batch.lock);
+	if (batch.profiles != NULL)
+		fix_ca_profiles_close (batch.profiles);
+
+	return batch.failed ? 1 : 0;
+}
@@ -0,0 +1,1844 @@
+/*
+	fix-ca-core.c	Fix Chromatic Aberration, pixel shifting core
+	Copyright (c) 2006, 2007 Kriang Lerdsuwanakij - (original author)
+	Copyright (c) 2023, 2024 Jose Da Silva (updates and improvements)
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* The math here has no Gimp or GEGL dependency.  It is compiled on
+   its own, or included by fix-ca.c so the plug-in stays one file for
+   "gimptool-2.0 --install fix-ca.c". */
+
+#ifndef _ISOC99_SOURCE
+#define _ISOC99_SOURCE
+#endif
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#if __has_include("fix-ca-config.h")
+#include "fix-ca-config.h"
+#endif
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#ifdef HAVE_SYS_RESOURCE_H
+# include <sys/resource.h>
+#endif
+#ifdef HAVE_LINUX_PERF_EVENT_H
+# include <linux/perf_event.h>
+# include <sys/ioctl.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+#endif
+
+#include "fix-ca-core.h"
+
+#define ROW_INVALID	-100
+#define ITER_INITIAL	-100
+
+/* Where one fix_ca_run() call charges its time and counters */
+typedef struct {
+	FixCaStats	*stats;
+	int	leader;			/* counter group, -1 if none */
+	int	fd[FIX_CA_COUNTERS];
+	int	n;			/* counters in the group, */
+	int	order[FIX_CA_COUNTERS];	/* in the order they are read */
+} FixCaMeter;
+
+typedef struct {
+	double	t;
+	int64_t	hw[FIX_CA_COUNTERS];
+} FixCaMark;
+
+/* Local function prototypes */
+static double	get_pixel (unsigned char *ptr, int bpc);
+static void	set_pixel (unsigned char *dest, double d, int bpc);
+static int	round_nearest (double d);
+static int	absolute (int i);
+static double	clip_d (double d);
+static void	bilinear (unsigned char *dest, \
+			  unsigned char *yrow0, unsigned char *yrow1, int x0, int x1, \
+			  int bpp, int bpc, double dx, double dy);
+static double	cubicY (unsigned char *yrow, int bpp, int bpc, double dx, \
+			int m1, int x0, int p1, int p2);
+static void	cubicX (unsigned char *dest, int bpp, int bpc, double dy, \
+			double ym1, double x, double xp1, double xp2);
+static double	scale_d (int i, int center, int size, double scale_val, double shift_val);
+static int	lens_radius (FixCaParams *params, int orig_width, int orig_height);
+static void	get_scales (FixCaParams *params, int orig_width, int orig_height,
+			    double *scale_blue, double *scale_red);
+static double	curve_at (const FixCaCurve *curve, double r);
+static void	axis_distances (int i1, int i2, int center, int *d1, int *d2);
+static double	curve_bound (const FixCaCurve *curve, int max_dim,
+			     int i1, int i2, int center);
+static double	curve_d (int i, int center, int size, const double *table,
+			 int d1, double shift_val);
+static void	source_span (const FixCaCurve *curve, int max_dim, int i1, int i2,
+			     int center, int size, double scale_val,
+			     double shift_val, double *d);
+static int	remap_fill (FixCaParams *params, int orig_width, int orig_height,
+			    int x1, int x2, int y1, int y2, double *x_blue,
+			    double *x_red, double *y_blue, double *y_red);
+static unsigned char *load_data (FixCaWindow *win, FixCaMeter *meter, int bpp,
+			  unsigned char **src, int *src_row, int *src_iter,
+			  int n_rows, int y, int iter);
+static void	meter_open (FixCaMeter *meter, FixCaStats *stats);
+static void	meter_close (FixCaMeter *meter);
+static void	meter_mark (FixCaMeter *meter, FixCaMark *mark);
+static void	meter_charge (FixCaMeter *meter, const FixCaMark *mark,
+			      int phase);
+static void	set_data (unsigned char *dstPTR, unsigned char *dest, int bpp, \
+			  int yrow, int width);
+static void	sweep_split (double d, int offset, int size, int *i, float *f);
+static int	edge_order (const void *a, const void *b);
+static int	double_order (const void *a, const void *b);
+static float	est_sample (const float *rgb, int w, int h, int ch,
+			    double x, double y);
+static double	est_search (const float *rgb, int w, int h, double x, double y,
+			    double nx, double ny, int ch, double t0,
+			    double range, double step, double *t);
+static int	est_fit (FixCaEstimate *est, int ch, double m[3]);
+
+static double get_pixel (unsigned char *ptr, int bpc)
+{
+	/* Returned value is in the range of [0.0..1.0]. */
+	double ret = 0.0;
+	if (bpc == 1) {
+		ret += *ptr;
+		ret /= 255;
+	} else if (bpc == 2) {
+		uint16_t *p = (uint16_t *)(ptr);
+		ret += *p;
+		ret /= 65535;
+	} else if (bpc == 4) {
+		uint32_t *p = (uint32_t *)(ptr);
+		ret += *p;
+		ret /= 4294967295;
+	} else if (bpc == 8) {
+		uint64_t *p = (uint64_t *)(ptr);
+		long double lret = 0.0;
+		lret += *p;
+		lret /= 18446744073709551615UL;
+		ret = lret;
+	} else if (bpc == -8) {
+		double *p = (double *)(ptr);
+		ret += *p;
+	} else if (bpc == -4) {
+		float *p = (float *)(ptr);
+		ret += *p;
+	//} else if (bpc == -2) {
+	//	half *p = ptr;
+	//	ret += *p;
+	}
+
+	return ret;
+}
+
+static void set_pixel (unsigned char *dest, double d, int bpc)
+{
+	/* input value is in the range of [0.0..1.0]. */
+	if (bpc == 1) {
+		*dest = round(d * 255);
+	}  else if (bpc == 2) {
+		uint16_t *p = (uint16_t *)(dest);
+		*p = round(d * 65535);
+	} else if (bpc == 4) {
+		uint32_t *p = (uint32_t *)(dest);
+		*p = round(d * 4294967295);
+	} else if (bpc == 8) {
+		uint64_t *p = (uint64_t *)(dest);
+		*p = roundl(d * 18446744073709551615UL);
+	} else if (bpc == -8) {
+		double *p = (double *)(dest);
+		*p = d;
+	} else if (bpc == -4) {
+		float *p = (float *)(dest);
+		*p = (float)(d);
+	//} else if (bpc == -2) {
+	//	half *p = (half *)(dest);
+	//	*p = d;
+	}
+
+	return;
+}
+
+static int round_nearest (double d)
+{
+	if (d >= 0) {
+		if (d > INT_MAX)
+			return INT_MAX;
+		else
+			return (int)(d + 0.5);
+	} else {
+		if (d < INT_MIN)
+			return INT_MIN;
+		else
+			return -((int)(0.5 - d));
+	}
+}
+
+static int absolute (int i)
+{
+	if (i >= 0)
+		return i;
+	else
+		return -i;
+}
+
+static double scale_d (int i, int center, int size, double scale_val, double shift_val)
+{
+	double d = (i - center) * scale_val + center - shift_val;
+	if (d <= 0.0)
+		return 0.0;
+	else if (d >= size-1)
+		return size-1;
+	else
+		return d;
+}
+
+/* Distance from the lens center to the furthest edge */
+static int lens_radius (FixCaParams *params, int orig_width, int orig_height)
+{
+	int	x_center, y_center, max_dim;
+
+	x_center = params->lens_x;
+	y_center = params->lens_y;
+	if (x_center >= y_center)
+		max_dim = x_center;
+	else
+		max_dim = y_center;
+	if (orig_width - x_center > max_dim)
+		max_dim = orig_width - x_center;
+	if (orig_height - y_center > max_dim)
+		max_dim = orig_height - y_center;
+	return max_dim;
+}
+
+static void get_scales (FixCaParams *params, int orig_width, int orig_height,
+			double *scale_blue, double *scale_red)
+{
+	int	max_dim = lens_radius (params, orig_width, orig_height);
+
+	/* Scale to get source, shifts toward the center no further than
+	   one pixel from it on small images */
+	*scale_blue = max_dim / fmax (max_dim + params->blue, 1.0);
+	*scale_red = max_dim / fmax (max_dim + params->red, 1.0);
+}
+
+/* Shift of curve at distance r along one axis, a fraction of the
+   lens radius */
+static double curve_at (const FixCaCurve *curve, double r)
+{
+	double	r0 = 0.0, s0 = 0.0;
+	int	k;
+
+	/* Segment r is on, from the center to the first point, or on
+	   from the one before the last */
+	for (k = 0; k < curve->n - 1 && curve->distance[k] < r; ++k) {
+		r0 = curve->distance[k];
+		s0 = curve->shift[k];
+	}
+	if (curve->distance[k] <= r0)
+		return curve->shift[k];
+	return s0 + (curve->shift[k] - s0) * (r - r0) / (curve->distance[k] - r0);
+}
+
+/* Widen d1..d2 to the distances from center of i1..i2-1 */
+static void axis_distances (int i1, int i2, int center, int *d1, int *d2)
+{
+	int	a, b, t;
+
+	if (i1 >= i2)
+		return;
+	a = absolute (i1 - center);
+	b = absolute (i2-1 - center);
+	if (a > b) {
+		t = a;
+		a = b;
+		b = t;
+	}
+	if (i1 <= center && center < i2)
+		a = 0;
+	if (a < *d1)
+		*d1 = a;
+	if (b > *d2)
+		*d2 = b;
+}
+
+/* Largest shift, either way, of curve at i1..i2-1.  It is straight
+   between points, so the ends and the points between are enough. */
+static double curve_bound (const FixCaCurve *curve, int max_dim,
+			   int i1, int i2, int center)
+{
+	double	m;
+	int	k, d1 = INT_MAX, d2 = -1;
+
+	axis_distances (i1, i2, center, &d1, &d2);
+	if (d2 < 0)
+		return 0.0;
+	m = fmax (fabs (curve_at (curve, (double) d1 / max_dim)), \
+		  fabs (curve_at (curve, (double) d2 / max_dim)));
+	for (k = 0; k < curve->n; ++k)
+		if (curve->distance[k] * max_dim > d1 && curve->distance[k] * max_dim < d2)
+			m = fmax (m, fabs (curve->shift[k]));
+	return m;
+}
+
+/* As scale_d(), with the shift at distance d from center in
+   table[d-d1] */
+static double curve_d (int i, int center, int size, const double *table,
+		       int d1, double shift_val)
+{
+	double d;
+
+	if (i < center)
+		d = i + table[center - i - d1] - shift_val;
+	else
+		d = i - table[i - center - d1] - shift_val;
+	if (d <= 0.0)
+		return 0.0;
+	else if (d >= size-1)
+		return size-1;
+	else
+		return d;
+}
+
+/* Lowest and highest source position of i1..i2-1 for one color, into
+   d[0] and d[1] */
+static void source_span (const FixCaCurve *curve, int max_dim, int i1, int i2,
+			 int center, int size, double scale_val,
+			 double shift_val, double *d)
+{
+	double	m;
+
+	if (curve->n == 0) {
+		/* Scaling is linear, so the ends are enough */
+		d[0] = scale_d (i1, center, size, scale_val, shift_val);
+		d[1] = scale_d (i2-1, center, size, scale_val, shift_val);
+		return;
+	}
+	m = curve_bound (curve, max_dim, i1, i2, center);
+	d[0] = scale_d (i1, center, size, 1.0, shift_val + m);
+	d[1] = scale_d (i2-1, center, size, 1.0, shift_val - m);
+}
+
+/* Source columns x1..x2-1 and rows y1..y2-1 of blue and red.  Curves
+   are looked up by a column's x or a row's y distance from the center,
+   not by the pixel's radius, so a source column and row are still
+   shared by every pixel on them.  Once per distance, in a table columns
+   and rows share.  Returns -1 if out of memory. */
+static int remap_fill (FixCaParams *params, int orig_width, int orig_height,
+		       int x1, int x2, int y1, int y2,
+		       double *x_blue, double *x_red, double *y_blue, double *y_red)
+{
+	const FixCaCurve *bc = &params->blue_curve, *rc = &params->red_curve;
+	double	scale_blue, scale_red, *bt = NULL, *rt = NULL;
+	int	i, x_center, y_center, max_dim, d1 = 0, d2 = -1;
+
+	get_scales (params, orig_width, orig_height, &scale_blue, &scale_red);
+	x_center = params->lens_x;
+	y_center = params->lens_y;
+	if (bc->n > 0 || rc->n > 0) {
+		max_dim = lens_radius (params, orig_width, orig_height);
+		d1 = INT_MAX;
+		axis_distances (x1, x2, x_center, &d1, &d2);
+		axis_distances (y1, y2, y_center, &d1, &d2);
+		if (d2 < 0)
+			return 0;
+		if ((bt = malloc (2 * (size_t) (d2 - d1 + 1) * sizeof (double))) == NULL)
+			return -1;
+		rt = bt + (d2 - d1 + 1);
+		for (i = d1; i <= d2; ++i) {
+			if (bc->n > 0)
+				bt[i-d1] = curve_at (bc, (double) i / max_dim);
+			if (rc->n > 0)
+				rt[i-d1] = curve_at (rc, (double) i / max_dim);
+		}
+	}
+	for (i = x1; i < x2; ++i) {
+		x_blue[i-x1] = bc->n > 0 ? \
+			       curve_d (i, x_center, orig_width, bt, d1, params->x_blue) : \
+			       scale_d (i, x_center, orig_width, scale_blue, params->x_blue);
+		x_red[i-x1] = rc->n > 0 ? \
+			      curve_d (i, x_center, orig_width, rt, d1, params->x_red) : \
+			      scale_d (i, x_center, orig_width, scale_red, params->x_red);
+	}
+	for (i = y1; i < y2; ++i) {
+		y_blue[i-y1] = bc->n > 0 ? \
+			       curve_d (i, y_center, orig_height, bt, d1, params->y_blue) : \
+			       scale_d (i, y_center, orig_height, scale_blue, params->y_blue);
+		y_red[i-y1] = rc->n > 0 ? \
+			      curve_d (i, y_center, orig_height, rt, d1, params->y_red) : \
+			      scale_d (i, y_center, orig_height, scale_red, params->y_red);
+	}
+	free (bt);
+	return 0;
+}
+
+int fix_ca_remap_init (FixCaRemap *remap, FixCaParams *params,
+		       int orig_width, int orig_height)
+{
+	size_t	n = 2 * (size_t) (orig_width + orig_height);
+
+	if ((remap->x_blue = malloc (n * sizeof (double))) == NULL)
+		return -1;
+	remap->x_red = remap->x_blue + orig_width;
+	remap->y_blue = remap->x_red + orig_width;
+	remap->y_red = remap->y_blue + orig_height;
+	if (remap_fill (params, orig_width, orig_height, 0, orig_width, \
+			0, orig_height, remap->x_blue, remap->x_red, \
+			remap->y_blue, remap->y_red)) {
+		fix_ca_remap_clear (remap);
+		return -1;
+	}
+	return 0;
+}
+
+void fix_ca_remap_clear (FixCaRemap *remap)
+{
+	free (remap->x_blue);
+	remap->x_blue = remap->x_red = remap->y_blue = remap->y_red = NULL;
+}
+
+void fix_ca_source_rect (FixCaParams *params, int orig_width, int orig_height,
+			 int x1, int x2, int y1, int y2, FixCaWindow *win)
+{
+	double	scale_blue, scale_red, d[4], lo, hi;
+	int	i, x_center, y_center, max_dim;
+
+	get_scales (params, orig_width, orig_height, &scale_blue, &scale_red);
+	max_dim = lens_radius (params, orig_width, orig_height);
+	x_center = params->lens_x;
+	y_center = params->lens_y;
+
+	/* Green is not moved, blue and red come from scaled positions */
+	source_span (&params->blue_curve, max_dim, x1, x2, x_center, orig_width, \
+		     scale_blue, params->x_blue, &d[0]);
+	source_span (&params->red_curve, max_dim, x1, x2, x_center, orig_width, \
+		     scale_red, params->x_red, &d[2]);
+	lo = x1;
+	hi = x2-1;
+	for (i = 0; i < 4; ++i) {
+		if (d[i] < lo) lo = d[i];
+		if (d[i] > hi) hi = d[i];
+	}
+	/* Extra pixels needed for rounding and interpolation */
+	win->x = (int) floor (lo) - 1;
+	if (win->x < 0)
+		win->x = 0;
+	i = (int) ceil (hi) + 2;
+	if (i > orig_width-1)
+		i = orig_width-1;
+	win->width = i - win->x + 1;
+
+	source_span (&params->blue_curve, max_dim, y1, y2, y_center, orig_height, \
+		     scale_blue, params->y_blue, &d[0]);
+	source_span (&params->red_curve, max_dim, y1, y2, y_center, orig_height, \
+		     scale_red, params->y_red, &d[2]);
+	lo = y1;
+	hi = y2-1;
+	for (i = 0; i < 4; ++i) {
+		if (d[i] < lo) lo = d[i];
+		if (d[i] > hi) hi = d[i];
+	}
+	win->y = (int) floor (lo) - 1;
+	if (win->y < 0)
+		win->y = 0;
+	i = (int) ceil (hi) + 2;
+	if (i > orig_height-1)
+		i = orig_height-1;
+	win->height = i - win->y + 1;
+}
+
+int fix_ca_source_rows (FixCaParams *params, int orig_width, int orig_height,
+			int y1, int y2)
+{
+	double	scale_blue, scale_red, d[4], m, lo = 0.0, hi = 0.0;
+	int	i, y_center, max_dim, rows;
+
+	get_scales (params, orig_width, orig_height, &scale_blue, &scale_red);
+	max_dim = lens_radius (params, orig_width, orig_height);
+	y_center = params->lens_y;
+
+	/* How far blue and red rows are from the output row.  That is
+	   linear in the row, so the first and last are enough, and
+	   clipping at the edges only brings them closer.  A curve is
+	   held to its largest shift either way over these rows. */
+	if (params->blue_curve.n == 0) {
+		d[0] = (y1 - y_center) * (scale_blue - 1) - params->y_blue;
+		d[1] = (y2-1 - y_center) * (scale_blue - 1) - params->y_blue;
+	} else {
+		m = curve_bound (&params->blue_curve, max_dim, y1, y2, y_center);
+		d[0] = -m - params->y_blue;
+		d[1] = m - params->y_blue;
+	}
+	if (params->red_curve.n == 0) {
+		d[2] = (y1 - y_center) * (scale_red - 1) - params->y_red;
+		d[3] = (y2-1 - y_center) * (scale_red - 1) - params->y_red;
+	} else {
+		m = curve_bound (&params->red_curve, max_dim, y1, y2, y_center);
+		d[2] = -m - params->y_red;
+		d[3] = m - params->y_red;
+	}
+	for (i = 0; i < 4; ++i) {
+		if (d[i] < lo) lo = d[i];
+		if (d[i] > hi) hi = d[i];
+	}
+	/* A row above and two below for interpolation, and some to keep
+	   while moving on to the next output row.  Every row one output
+	   row reads must fit, or it would replace one still in use. */
+	rows = (int) ceil (hi - lo) + 8;
+	if (rows > orig_height)
+		rows = orig_height;
+	return rows > 0 ? rows : 1;
+}
+
+static unsigned char *load_data (FixCaWindow *win, FixCaMeter *meter, int bpp,
+			  unsigned char **src, int *src_row, int *src_iter,
+			  int n_rows, int y, int iter)
+{
+	int	i, diff, diff_max = -1, row_best = -1;
+	int	iter_oldest;
+	FixCaMark	mark;
+
+	for (i = 0; i < n_rows; ++i) {
+		if (src_row[i] == y) {
+			src_iter[i] = iter;	/* Make sure to keep this row
+						   during this iteration */
+			if (meter != NULL)
+				meter->stats->row_hits++;
+			return src[i];
+		}
+	}
+
+	/* Find a row to replace */
+	iter_oldest = INT_MAX;		/* Largest possible */
+	for (i = 0; i < n_rows; ++i) {
+		if (src_iter[i] < iter_oldest) {
+			iter_oldest = src_iter[i];
+			diff_max = absolute (y - src_row[i]);
+			row_best = i;
+		}
+		else if (src_iter[i] == iter_oldest) {
+			diff = absolute (y - src_row[i]);
+			if (diff > diff_max) {
+				diff_max = diff;
+				row_best = i;
+			}
+		}
+	}
+
+	if (meter != NULL) {
+		meter->stats->row_misses++;
+		if (src_row[row_best] != ROW_INVALID)
+			meter->stats->row_evictions++;
+		meter_mark (meter, &mark);
+	}
+	if (win->data)
+		memcpy (src[row_best], &win->data[(size_t) (y - win->y) * \
+			win->width * bpp], (size_t) win->width * bpp);
+	else
+		win->fetch_row (win->user_data, win->x, y, win->width, \
+				src[row_best]);
+	if (meter != NULL)
+		meter_charge (meter, &mark, FIX_CA_PHASE_FETCH);
+	src_row[row_best] = y;
+	src_iter[row_best] = iter;
+	return src[row_best];
+}
+
+static void set_data (unsigned char *dstPTR, unsigned char *dest, int bpp, \
+		      int yrow, int width)
+{
+	size_t l, x;
+	x = (size_t) yrow * width * bpp;
+	l = (size_t) width * bpp;
+	memcpy (&dstPTR[x], dest, l);
+}
+
+static double clip_d (double d)
+{
+	if (d <= 0.0)
+		return 0.0;
+	if (d >= 1.0)
+		return 1.0;
+	return d;
+}
+
+static void bilinear (unsigned char *dest, \
+		      unsigned char *yrow0, unsigned char *yrow1, int x0, int x1, \
+		      int bpp, int bpc, double dx, double dy)
+{
+	double d, x0y0, x1y0, x0y1, x1y1;
+	x0y0 = get_pixel (&yrow0[x0*bpp], bpc);
+	x1y0 = get_pixel (&yrow0[x1*bpp], bpc);
+	x0y1 = get_pixel (&yrow1[x0*bpp], bpc);
+	x1y1 = get_pixel (&yrow1[x1*bpp], bpc);
+	d = (1-dy) * (x0y0 + dx * (x1y0-x0y0))
+	     + dy  * (x0y1 + dx * (x1y1-x0y1));
+	set_pixel (dest, clip_d(d), bpc);
+}
+
+static double cubicY (unsigned char *yrow, int bpp, int bpc, double dx, \
+			   int m1, int x0, int p1, int p2)
+{
+	/* Catmull-Rom from Gimp gimpdrawable-transform.c */
+	double d, xm1, x, xp1, xp2;
+	xm1 = get_pixel (&yrow[m1*bpp], bpc);
+	x   = get_pixel (&yrow[x0*bpp], bpc);
+	xp1 = get_pixel (&yrow[p1*bpp], bpc);
+	xp2 = get_pixel (&yrow[p2*bpp], bpc);
+	d = ((( ( - xm1 + 3 * x - 3 * xp1 + xp2 ) * dx +
+	      ( 2 * xm1 - 5 * x + 4 * xp1 - xp2 ) ) * dx +
+			     ( - xm1 + xp1 ) ) * dx + (x + x) ) / 2.0;
+	return d;
+}
+
+static void cubicX (unsigned char *dest, int bpp, int bpc, double dy, \
+		    double ym1, double y, double yp1, double yp2)
+{
+	/* Catmull-Rom from Gimp gimpdrawable-transform.c */
+	double d;
+	d = ((( ( - ym1 + 3 * y - 3 * yp1 + yp2 ) * dy +
+	      ( 2 * ym1 - 5 * y + 4 * yp1 - yp2 ) ) * dy +
+			     ( - ym1 + yp1 ) ) * dy + (y + y) ) / 2.0;
+	set_pixel (dest, clip_d(d), bpc);
+}
+
+void fix_ca_context_init (FixCaContext *ctx, FixCaParams *params,
+			  int orig_width, int orig_height, int bytes, int bpc)
+{
+	memset (ctx, 0, sizeof (*ctx));
+	ctx->params = params;
+	ctx->orig_width = orig_width;
+	ctx->orig_height = orig_height;
+	ctx->bytes = bytes;
+	ctx->bpc = bpc;
+	ctx->channels = FIX_CA_CHANNEL_ALL;
+}
+
+void fix_ca_context_clear (FixCaContext *ctx)
+{
+	free (ctx->rows);
+	ctx->rows = NULL;
+	ctx->rows_size = 0;
+}
+
+int fix_ca_region (FixCaWindow *win, unsigned char *dstPTR,
+			   int orig_width, int orig_height, int bytes, int bpc,
+			   FixCaParams *params, int x1, int x2, int y1, int y2,
+			   FixCaProgress *progress)
+{
+	return fix_ca_region_channels (win, dstPTR, orig_width, orig_height, \
+				       bytes, bpc, params, x1, x2, y1, y2, \
+				       progress, FIX_CA_CHANNEL_ALL);
+}
+
+int fix_ca_region_channels (FixCaWindow *win, unsigned char *dstPTR,
+			    int orig_width, int orig_height, int bytes, int bpc,
+			    FixCaParams *params, int x1, int x2, int y1, int y2,
+			    FixCaProgress *progress, int channels)
+{
+	FixCaContext ctx;
+	int	ret;
+
+	fix_ca_context_init (&ctx, params, orig_width, orig_height, bytes, bpc);
+	ctx.channels = channels;
+	ctx.progress = progress;
+	ret = fix_ca_run (&ctx, win, dstPTR, x1, x2, y1, y2);
+	fix_ca_context_clear (&ctx);
+	return ret;
+}
+
+int fix_ca_run (FixCaContext *ctx, FixCaWindow *win, unsigned char *dstPTR,
+		int x1, int x2, int y1, int y2)
+{
+	FixCaParams	*params = ctx->params;
+	FixCaProgress	*progress = ctx->progress;
+	int	orig_width = ctx->orig_width;
+	int	orig_height = ctx->orig_height;
+	int	bytes = ctx->bytes;
+	int	bpc = ctx->bpc;
+
+	unsigned char	**src;
+	int	*src_row;
+	int	*src_iter;
+	int	b, i, n_rows, ret = 0;
+	size_t	row_size, size, index;
+
+	unsigned char	*dest;
+	int	x, y;
+	const double	*xb, *xr, *yb, *yr;
+	size_t	tables;
+
+	int	band_1;
+	int	do_blue = ctx->channels & FIX_CA_CHANNEL_BLUE;
+	int	do_red = ctx->channels & FIX_CA_CHANNEL_RED;
+
+	FixCaStats	*stats = ctx->stats, before;
+	FixCaMeter	meter, *m = NULL;
+	FixCaMark	mark0, mark;
+
+	if (stats != NULL) {
+		m = &meter;
+		meter_open (m, stats);
+		before = *stats;
+		meter_mark (m, &mark0);
+	}
+
+	/* Buffers for reading, writing, kept in the context for the next
+	   call.  Rows only need to cover the horizontal band of the source
+	   window, and as many as these shifts reach.  Without a shared
+	   remap, the source columns and rows of this region go first, then
+	   the row index, an even count of rows so the rows stay aligned. */
+	row_size = (size_t) win->width * bytes;
+	n_rows = fix_ca_source_rows (params, orig_width, orig_height, y1, y2);
+	n_rows += n_rows & 1;
+	tables = 0;
+	if (ctx->remap == NULL)
+		tables = 2 * (size_t) ((x2-x1) + (y2-y1)) * sizeof (double);
+	index = (size_t) n_rows * (sizeof (unsigned char *) + 2 * sizeof (int));
+	size = tables + index + n_rows * row_size + (size_t) (x2-x1) * bytes;
+	if (size > ctx->rows_size) {
+		free (ctx->rows);
+		ctx->rows = malloc (size);
+		ctx->rows_size = ctx->rows ? size : 0;
+		if (ctx->rows == NULL) {
+			if (m != NULL)
+				meter_close (m);
+			return -1;
+		}
+		if (stats != NULL)
+			stats->alloc_bytes += (int64_t) size;
+	}
+	src = (unsigned char **) (ctx->rows + tables);
+	src_row = (int *) (src + n_rows);
+	src_iter = src_row + n_rows;
+	for (i = 0; i < n_rows; ++i) {
+		src[i] = ctx->rows + tables + index + i * row_size;
+		src_row[i] = ROW_INVALID;	/* Invalid row */
+		src_iter[i] = ITER_INITIAL;	/* Oldest iteration */
+	}
+	dest = ctx->rows + tables + index + n_rows * row_size;
+
+	/* Source column of x is xb[x-x1], xr[x-x1], row of y yb[y-y1]... */
+	if (ctx->remap != NULL) {
+		xb = ctx->remap->x_blue + x1;
+		xr = ctx->remap->x_red + x1;
+		yb = ctx->remap->y_blue + y1;
+		yr = ctx->remap->y_red + y1;
+	} else {
+		double	*t = (double *) ctx->rows;
+
+		if (remap_fill (params, orig_width, orig_height, x1, x2, y1, y2, \
+				t, t + (x2-x1), t + 2*(x2-x1), \
+				t + 2*(x2-x1) + (y2-y1))) {
+			if (m != NULL)
+				meter_close (m);
+			return -1;
+		}
+		xb = t;
+		xr = t + (x2-x1);
+		yb = t + 2*(x2-x1);
+		yr = yb + (y2-y1);
+	}
+
+	/* Row buffers start at this column */
+	band_1 = win->x;
+	b = absolute (bpc);
+#ifdef DEBUG_TIME
+	printf("fix_ca_region(), xc=%d of %d yc=%d of %d b=%d, %d, %d\n", \
+		(int) params->lens_x, orig_width, (int) params->lens_y, \
+		orig_height, bpc, b, bytes);
+#endif
+
+	for (y = y1; y < y2; ++y) {
+		/* Get current row, for green channel */
+		unsigned char *ptr;
+		ptr = load_data (win, m, bytes, src, src_row, src_iter, n_rows, y, y);
+
+		/* Collect Green and Alpha channels all at once */
+		memcpy (dest, &ptr[(x1-band_1)*bytes], (x2-x1)*bytes);
+
+		if (params->interpolation == FIX_CA_INTERPOLATION_NONE) {
+			unsigned char	*ptr_blue = NULL, *ptr_red = NULL;
+			int	y_blue, y_red, x_blue, x_red;
+
+			/* Get blue and red row */
+			if (do_blue) {
+				y_blue = round_nearest (yb[y-y1]);
+				ptr_blue = load_data (win, m, bytes, src, src_row, src_iter, n_rows, y_blue, y);
+			}
+			if (do_red) {
+				y_red = round_nearest (yr[y-y1]);
+				ptr_red = load_data (win, m, bytes, src, src_row, src_iter, n_rows, y_red, y);
+			}
+
+			for (x = x1; x < x2; ++x) {
+				/* Blue and red channel */
+				if (do_blue) {
+					x_blue = round_nearest (xb[x-x1]);
+					memcpy (&dest[(x-x1)*bytes + 2*b], \
+						&ptr_blue[(x_blue-band_1)*bytes + 2*b], b);
+				}
+				if (do_red) {
+					x_red = round_nearest (xr[x-x1]);
+					memcpy (&dest[(x-x1)*bytes], \
+						&ptr_red[(x_red-band_1)*bytes], b);
+				}
+			}
+		} else if (params->interpolation == FIX_CA_INTERPOLATION_LINEAR) {
+			/* Pointer to pixel data rows y, y+1 */
+			unsigned char	*ptr_blue_1 = NULL, *ptr_blue_2 = NULL;
+			unsigned char	*ptr_red_1 = NULL, *ptr_red_2 = NULL;
+			/* Floating point row, fractional row */
+			double	y_blue_d, y_red_d, d_y_blue = 0.0, d_y_red = 0.0;
+			/* Integer row y */
+			int	y_blue_1, y_red_1;
+			/* Floating point column, fractional column */
+			double	x_blue_d, x_red_d, d_x_blue, d_x_red;
+			/* Integer column x, x+1 */
+			int	x_blue_1, x_red_1, x_blue_2, x_red_2;
+
+			/* Get blue row, integer and fractional row, load pixel data */
+			if (do_blue) {
+				y_blue_d = yb[y-y1];
+				y_blue_1 = floor (y_blue_d);
+				d_y_blue = y_blue_d - y_blue_1;
+				ptr_blue_1 = load_data (win, m, bytes, src, src_row, src_iter, n_rows, y_blue_1, y);
+				if (y_blue_1 == orig_height-1)
+					ptr_blue_2 = ptr_blue_1;
+				else
+					ptr_blue_2 = load_data (win, m, bytes, src, src_row, src_iter, n_rows, y_blue_1+1, y);
+			}
+
+			/* Same for red */
+			if (do_red) {
+				y_red_d = yr[y-y1];
+				y_red_1 = floor (y_red_d);
+				d_y_red = y_red_d - y_red_1;
+				ptr_red_1 = load_data (win, m, bytes, src, src_row, src_iter, n_rows, y_red_1, y);
+				if (y_red_1 == orig_height-1)
+					ptr_red_2 = ptr_red_1;
+				else
+					ptr_red_2 = load_data (win, m, bytes, src, src_row, src_iter, n_rows, y_red_1+1, y);
+			}
+
+			for (x = x1; x < x2; ++x) {
+				/* Blue channel, integer and fractional column */
+				if (do_blue) {
+					x_blue_d = xb[x-x1];
+					x_blue_1 = floor (x_blue_d);
+					d_x_blue = x_blue_d - x_blue_1;
+					if (x_blue_1 == orig_width-1)
+						x_blue_2 = x_blue_1;
+					else
+						x_blue_2 = x_blue_1 + 1;
+
+					/* Interpolation */
+					bilinear ((dest+((x-x1)*bytes+2*b)), \
+						  (ptr_blue_1+2*b), (ptr_blue_2+2*b), x_blue_1-band_1, x_blue_2-band_1, \
+						  bytes, bpc, d_x_blue, d_y_blue);
+				}
+
+				/* Red channel */
+				if (do_red) {
+					x_red_d = xr[x-x1];
+					x_red_1 = floor (x_red_d);
+					d_x_red = x_red_d - x_red_1;
+					if (x_red_1 == orig_width-1)
+						x_red_2 = x_red_1;
+					else
+						x_red_2 = x_red_1 + 1;
+
+					bilinear ((dest+((x-x1)*bytes)), \
+						  ptr_red_1, ptr_red_2, x_red_1-band_1, x_red_2-band_1, \
+						  bytes, bpc, d_x_red, d_y_red);
+				}
+			}
+		} else if (params->interpolation == FIX_CA_INTERPOLATION_CUBIC) {
+			/* Pointer to pixel data rows y-1, y */
+			unsigned char	*ptr_blue_1 = NULL, *ptr_blue_2 = NULL;
+			unsigned char	*ptr_red_1 = NULL, *ptr_red_2 = NULL;
+			/* Pointer to pixel data rows y+1, y+2 */
+			unsigned char	*ptr_blue_3 = NULL, *ptr_blue_4 = NULL;
+			unsigned char	*ptr_red_3 = NULL, *ptr_red_4 = NULL;
+			/* Floating point row, fractional row */
+			double	y_blue_d, y_red_d, d_y_blue = 0.0, d_y_red = 0.0;
+			/* Integer row y */
+			int	y_blue_2, y_red_2;
+			/* Floating point column, fractional column */
+			double	x_blue_d, x_red_d, d_x_blue, d_x_red;
+			/* Integer column x-1, x */
+			int	x_blue_1, x_red_1, x_blue_2, x_red_2;
+			/* Integer column x+1, x+2 */
+			int	x_blue_3, x_red_3, x_blue_4, x_red_4;
+
+			/* Get blue row, and rows - 1, + 1, + 2 */
+			if (do_blue) {
+				y_blue_d = yb[y-y1];
+				y_blue_2 = floor (y_blue_d);
+				d_y_blue = y_blue_d - y_blue_2;
+
+				ptr_blue_2 = load_data (win, m, bytes, src, src_row, src_iter, n_rows, y_blue_2, y);
+				if (y_blue_2 == 0)
+					ptr_blue_1 = ptr_blue_2;
+				else
+					ptr_blue_1 = load_data (win, m, bytes, src, src_row, src_iter, n_rows, y_blue_2-1, y);
+				if (y_blue_2 == orig_height-1)
+					ptr_blue_3 = ptr_blue_2;
+				else
+					ptr_blue_3 = load_data (win, m, bytes, src, src_row, src_iter, n_rows, y_blue_2+1, y);
+				if (y_blue_2 == orig_height-1)
+					ptr_blue_4 = ptr_blue_2;
+				else if (y_blue_2 == orig_height-2)
+					ptr_blue_4 = ptr_blue_3;
+				else
+					ptr_blue_4 = load_data (win, m, bytes, src, src_row, src_iter, n_rows, y_blue_2+2, y);
+			}
+
+			/* Same for red */
+			if (do_red) {
+				y_red_d = yr[y-y1];
+				y_red_2 = floor (y_red_d);
+				d_y_red = y_red_d - y_red_2;
+
+				ptr_red_2 = load_data (win, m, bytes, src, src_row, src_iter, n_rows, y_red_2, y);
+				if (y_red_2 == 0)
+					ptr_red_1 = ptr_red_2;
+				else
+					ptr_red_1 = load_data (win, m, bytes, src, src_row, src_iter, n_rows, y_red_2-1, y);
+				if (y_red_2 == orig_height-1)
+					ptr_red_3 = ptr_red_2;
+				else
+					ptr_red_3 = load_data (win, m, bytes, src, src_row, src_iter, n_rows, y_red_2+1, y);
+				if (y_red_2 == orig_height-1)
+					ptr_red_4 = ptr_red_2;
+				else if (y_red_2 == orig_height-2)
+					ptr_red_4 = ptr_red_3;
+				else
+					ptr_red_4 = load_data (win, m, bytes, src, src_row, src_iter, n_rows, y_red_2+2, y);
+			}
+
+			for (x = x1; x < x2; ++x) {
+				double c1, c2, c3, c4;
+
+				/* Blue channel, columns - 1, + 1, + 2 */
+				if (do_blue) {
+					x_blue_d = xb[x-x1];
+					x_blue_2 = floor (x_blue_d);
+					d_x_blue = x_blue_d - x_blue_2;
+					if (x_blue_2 == 0)
+						x_blue_1 = x_blue_2;
+					else
+						x_blue_1 = x_blue_2 - 1;
+					if (x_blue_2 == orig_width-1)
+						x_blue_3 = x_blue_2;
+					else
+						x_blue_3 = x_blue_2 + 1;
+					if (x_blue_3 == orig_width-1)
+						x_blue_4 = x_blue_3;
+					else
+						x_blue_4 = x_blue_3 + 1;
+
+					c1 = cubicY (ptr_blue_1+2*b, bytes, bpc, d_x_blue, \
+						     x_blue_1-band_1, x_blue_2-band_1, \
+						     x_blue_3-band_1, x_blue_4-band_1);
+					c2 = cubicY (ptr_blue_2+2*b, bytes, bpc, d_x_blue, \
+						     x_blue_1-band_1, x_blue_2-band_1, \
+						     x_blue_3-band_1, x_blue_4-band_1);
+					c3 = cubicY (ptr_blue_3+2*b, bytes, bpc, d_x_blue, \
+						     x_blue_1-band_1, x_blue_2-band_1, \
+						     x_blue_3-band_1, x_blue_4-band_1);
+					c4 = cubicY (ptr_blue_4+2*b, bytes, bpc, d_x_blue, \
+						     x_blue_1-band_1, x_blue_2-band_1, \
+						     x_blue_3-band_1, x_blue_4-band_1);
+					cubicX ((dest+(x-x1)*bytes+2*b), bytes, bpc, d_y_blue, c1, c2, c3, c4);
+				}
+
+				/* Red channel */
+				if (do_red) {
+					x_red_d = xr[x-x1];
+					x_red_2 = floor (x_red_d);
+					d_x_red = x_red_d - x_red_2;
+					if (x_red_2 == 0)
+						x_red_1 = x_red_2;
+					else
+						x_red_1 = x_red_2 - 1;
+					if (x_red_2 == orig_width-1)
+						x_red_3 = x_red_2;
+					else
+						x_red_3 = x_red_2 + 1;
+					if (x_red_3 == orig_width-1)
+						x_red_4 = x_red_3;
+					else
+						x_red_4 = x_red_3 + 1;
+
+					c1 = cubicY (ptr_red_1, bytes, bpc, d_x_red, \
+						     x_red_1-band_1, x_red_2-band_1, \
+						     x_red_3-band_1, x_red_4-band_1);
+					c2 = cubicY (ptr_red_2, bytes, bpc, d_x_red, \
+						     x_red_1-band_1, x_red_2-band_1, \
+						     x_red_3-band_1, x_red_4-band_1);
+					c3 = cubicY (ptr_red_3, bytes, bpc, d_x_red, \
+						     x_red_1-band_1, x_red_2-band_1, \
+						     x_red_3-band_1, x_red_4-band_1);
+					c4 = cubicY (ptr_red_4, bytes, bpc, d_x_red, \
+						     x_red_1-band_1, x_red_2-band_1, \
+						     x_red_3-band_1, x_red_4-band_1);
+					cubicX ((dest+(x-x1)*bytes), bytes, bpc, d_y_red, c1, c2, c3, c4);
+				}
+			}
+		}
+
+		if (m != NULL)
+			meter_mark (m, &mark);
+		set_data (dstPTR, dest, bytes, (y-y1), (x2-x1));
+		if (m != NULL)
+			meter_charge (m, &mark, FIX_CA_PHASE_WRITE);
+
+		if (progress != NULL && ((y-y1) % 8 == 0)) {
+			if (progress->cancelled != NULL && \
+			    progress->cancelled (progress->user_data)) {
+				ret = 1;
+				break;
+			}
+			if (progress->update != NULL)
+				progress->update ((double) (progress->done + \
+						  (int64_t) (y-y1) * (x2-x1)) / progress->total);
+		}
+	}
+
+	if (progress != NULL && ret == 0)
+		progress->done += (int64_t) (y2-y1) * (x2-x1);
+
+	/* Resampling is what is left once rows are in and out */
+	if (m != NULL) {
+		int	f = FIX_CA_PHASE_FETCH, w = FIX_CA_PHASE_WRITE;
+
+		stats->pixels += (int64_t) (y - y1) * (x2-x1);
+		meter_charge (m, &mark0, FIX_CA_PHASE_RESAMPLE);
+		stats->seconds[FIX_CA_PHASE_RESAMPLE] -= \
+			stats->seconds[f] - before.seconds[f] + \
+			stats->seconds[w] - before.seconds[w];
+		for (i = 0; i < FIX_CA_COUNTERS; i++)
+			stats->hw[FIX_CA_PHASE_RESAMPLE][i] -= \
+				stats->hw[f][i] - before.hw[f][i] + \
+				stats->hw[w][i] - before.hw[w][i];
+		meter_close (m);
+	}
+	return ret;
+}
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+static const struct {
+	uint32_t	type;
+	uint64_t	config;
+} meter_events[FIX_CA_COUNTERS] = {
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | \
+			      (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+			      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES }
+};
+#endif
+
+/* Counters of this thread, in one group so they are read at once.
+   Those the host doesn't have, or won't let us use, are left out. */
+static void meter_open (FixCaMeter *meter, FixCaStats *stats)
+{
+	int	i;
+
+	meter->stats = stats;
+	meter->leader = -1;
+	meter->n = 0;
+	for (i = 0; i < FIX_CA_COUNTERS; i++)
+		meter->fd[i] = -1;
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#ifdef SYS_gettid
+	if (stats->thread == 0)
+		stats->thread = (long) syscall (SYS_gettid);
+	else if (stats->thread != (long) syscall (SYS_gettid))
+		stats->thread = -1;
+#endif
+	if (!stats->count_hw)
+		return;
+	for (i = 0; i < FIX_CA_COUNTERS; i++) {
+		struct perf_event_attr	attr;
+
+		memset (&attr, 0, sizeof (attr));
+		attr.size = sizeof (attr);
+		attr.type = meter_events[i].type;
+		attr.config = meter_events[i].config;
+		attr.read_format = PERF_FORMAT_GROUP;
+		attr.disabled = meter->leader < 0;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		meter->fd[i] = (int) syscall (SYS_perf_event_open, &attr, 0, -1, \
+					      meter->leader, 0);
+		if (meter->fd[i] < 0)
+			continue;
+		if (meter->leader < 0)
+			meter->leader = meter->fd[i];
+		meter->order[meter->n++] = i;
+		stats->counted |= 1 << i;
+	}
+	if (meter->leader >= 0)
+		ioctl (meter->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+static void meter_close (FixCaMeter *meter)
+{
+#ifdef HAVE_LINUX_PERF_EVENT_H
+	int	i;
+
+	for (i = 0; i < FIX_CA_COUNTERS; i++)
+		if (meter->fd[i] >= 0)
+			close (meter->fd[i]);
+#endif
+	meter->leader = -1;
+}
+
+static void meter_mark (FixCaMeter *meter, FixCaMark *mark)
+{
+	int	i;
+
+	mark->t = fix_ca_stats_now ();
+	for (i = 0; i < FIX_CA_COUNTERS; i++)
+		mark->hw[i] = 0;
+#ifdef HAVE_LINUX_PERF_EVENT_H
+	if (meter->leader >= 0) {
+		uint64_t	values[1 + FIX_CA_COUNTERS];
+
+		if (read (meter->leader, values, sizeof (values)) > 0)
+			for (i = 0; i < meter->n && i < (int) values[0]; i++)
+				mark->hw[meter->order[i]] = (int64_t) values[1 + i];
+	}
+#endif
+}
+
+/* Time and counts from mark to now go to phase */
+static void meter_charge (FixCaMeter *meter, const FixCaMark *mark, int phase)
+{
+	FixCaMark	now;
+	int	i;
+
+	meter_mark (meter, &now);
+	meter->stats->seconds[phase] += now.t - mark->t;
+	for (i = 0; i < FIX_CA_COUNTERS; i++)
+		meter->stats->hw[phase][i] += now.hw[i] - mark->hw[i];
+}
+
+void fix_ca_stats_init (FixCaStats *stats)
+{
+	const char	*perf = getenv ("FIX_CA_PERF");
+
+	memset (stats, 0, sizeof (*stats));
+	stats->count_hw = perf != NULL && *perf != '\0';
+}
+
+const char *fix_ca_stats_target (void)
+{
+	const char	*target = getenv ("FIX_CA_STATS");
+
+	if (target != NULL && *target != '\0')
+		return target;
+	target = getenv ("FIX_CA_PERF");
+	if (target != NULL && *target != '\0')
+		return "1";
+#ifdef DEBUG_TIME
+	return "1";
+#else
+	return NULL;
+#endif
+}
+
+double fix_ca_stats_now (void)
+{
+	struct timespec	ts;
+
+	if (clock_gettime (CLOCK_MONOTONIC, &ts) != 0)
+		return 0.0;
+	return (double) ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void fix_ca_stats_add (FixCaStats *total, const FixCaStats *stats)
+{
+	int	i, j;
+
+	for (i = 0; i < FIX_CA_PHASES; i++) {
+		total->seconds[i] += stats->seconds[i];
+		for (j = 0; j < FIX_CA_COUNTERS; j++)
+			total->hw[i][j] += stats->hw[i][j];
+	}
+	total->counted |= stats->counted;
+	if (total->thread == 0)
+		total->thread = stats->thread;
+	else if (stats->thread != 0 && stats->thread != total->thread)
+		total->thread = -1;
+	total->pixels += stats->pixels;
+	total->row_hits += stats->row_hits;
+	total->row_misses += stats->row_misses;
+	total->row_evictions += stats->row_evictions;
+	total->alloc_bytes += stats->alloc_bytes;
+}
+
+void fix_ca_stats_emit (const char *what, const FixCaStats *stats,
+			double seconds)
+{
+	static const char	*phases[FIX_CA_PHASES] = {
+		"fetch", "resample", "saturate", "write", "merge_shadow"
+	};
+	static const char	*counters[FIX_CA_COUNTERS] = {
+		"cycles", "instructions", "llc_misses", "branch_misses"
+	};
+	const char	*target = fix_ca_stats_target ();
+#ifdef HAVE_SYS_RESOURCE_H
+	struct rusage	ru;
+#endif
+	char	line[2048];
+	size_t	len;
+	FILE	*fp;
+	int	i, j;
+
+	if (target == NULL)
+		return;
+	len = (size_t) snprintf (line, sizeof (line), "{\"run\":\"%s\",\"seconds\":%.6f," \
+		  "\"pixels\":%lld,\"mpixels_per_s\":%.3f,\"phases\":{" \
+		  "\"fetch\":%.6f,\"resample\":%.6f,\"saturate\":%.6f," \
+		  "\"write\":%.6f,\"merge_shadow\":%.6f},\"rows\":{" \
+		  "\"hits\":%lld,\"misses\":%lld,\"evictions\":%lld}," \
+		  "\"alloc_bytes\":%lld", what, seconds, \
+		  (long long) stats->pixels, \
+		  seconds > 0.0 ? stats->pixels / seconds / 1e6 : 0.0, \
+		  stats->seconds[FIX_CA_PHASE_FETCH], \
+		  stats->seconds[FIX_CA_PHASE_RESAMPLE], \
+		  stats->seconds[FIX_CA_PHASE_SATURATE], \
+		  stats->seconds[FIX_CA_PHASE_WRITE], \
+		  stats->seconds[FIX_CA_PHASE_MERGE_SHADOW], \
+		  (long long) stats->row_hits, (long long) stats->row_misses, \
+		  (long long) stats->row_evictions, (long long) stats->alloc_bytes);
+	if (stats->thread > 0 && len < sizeof (line))
+		len += (size_t) snprintf (line + len, sizeof (line) - len, \
+					  ",\"thread\":%ld", stats->thread);
+	if (stats->requests > 0 && len < sizeof (line))
+		len += (size_t) snprintf (line + len, sizeof (line) - len, \
+					  ",\"requests\":%lld,\"renders\":%lld", \
+					  (long long) stats->requests, \
+					  (long long) stats->renders);
+	if (stats->plan != NULL && len < sizeof (line))
+		len += (size_t) snprintf (line + len, sizeof (line) - len, \
+					  ",\"plan\":{\"type\":\"%s\",\"tile_width\":%d," \
+					  "\"tile_height\":%d,\"peak_bytes\":%lld}", \
+					  stats->plan, stats->tile_width, \
+					  stats->tile_height, (long long) stats->plan_peak);
+#ifdef HAVE_SYS_RESOURCE_H
+	/* ru_maxrss is in KiB, but in bytes on macOS */
+	if (getrusage (RUSAGE_SELF, &ru) == 0 && len < sizeof (line))
+#ifdef __APPLE__
+		len += (size_t) snprintf (line + len, sizeof (line) - len, \
+					  ",\"peak_rss\":%lld", (long long) ru.ru_maxrss);
+#else
+		len += (size_t) snprintf (line + len, sizeof (line) - len, \
+					  ",\"peak_rss\":%lld", (long long) ru.ru_maxrss * 1024);
+#endif
+#endif
+
+	/* Counters the host doesn't have are null, all of them if none */
+	if (stats->count_hw && stats->counted == 0 && len < sizeof (line))
+		len += (size_t) snprintf (line + len, sizeof (line) - len, \
+					  ",\"counters\":null");
+	else if (stats->count_hw && len < sizeof (line)) {
+		len += (size_t) snprintf (line + len, sizeof (line) - len, \
+					  ",\"counters\":{");
+		for (i = 0; i < FIX_CA_PHASES && len < sizeof (line); i++) {
+			len += (size_t) snprintf (line + len, sizeof (line) - len, \
+						  "%s\"%s\":{", i ? "," : "", phases[i]);
+			for (j = 0; j < FIX_CA_COUNTERS && len < sizeof (line); j++)
+				len += (size_t) (stats->counted & (1 << j) ? \
+					snprintf (line + len, sizeof (line) - len, \
+						  "%s\"%s\":%lld", j ? "," : "", counters[j], \
+						  (long long) stats->hw[i][j]) : \
+					snprintf (line + len, sizeof (line) - len, \
+						  "%s\"%s\":null", j ? "," : "", counters[j]));
+			if (len < sizeof (line))
+				len += (size_t) snprintf (line + len, sizeof (line) - len, "}");
+		}
+		if (len < sizeof (line))
+			len += (size_t) snprintf (line + len, sizeof (line) - len, "}");
+	}
+	if (len + 3 > sizeof (line))
+		return;
+	strcpy (line + len, "}\n");
+
+	/* Whole lines, so runs on other threads or processes don't mix */
+	if (strcmp (target, "1") == 0) {
+		fputs (line, stderr);
+		fflush (stderr);
+	} else if ((fp = fopen (target, "a")) != NULL) {
+		fputs (line, fp);
+		fclose (fp);
+	}
+}
+
+/* Sample position in a plane of size pixels, as the pixel before it and
+   how far on to the next */
+static void sweep_split (double d, int offset, int size, int *i, float *f)
+{
+	d -= offset;
+	if (d < 0)
+		d = 0;
+	*i = (int) d;
+	*f = (float) (d - *i);
+	if (*i >= size-1) {
+		*i = size > 1 ? size-2 : 0;
+		*f = size > 1 ? 1 : 0;
+	}
+}
+
+int fix_ca_sweep (FixCaWindow *win, int orig_width, int orig_height,
+		  int bytes, int bpc, FixCaParams *candidates, int n,
+		  int x1, int x2, int y1, int y2, double *scores,
+		  unsigned char *sheet, int columns)
+{
+	unsigned char	*row, *src, *out;
+	float	*planes, *red, *green, *blue, *fx, *d, *r0, *r1, *b0, *b1, *g;
+	float	fr, fb, r, bl;
+	double	*remap, tv;
+	int	*ix;
+	size_t	stride, sheet_stride, w = x2-x1, h = y2-y1, size;
+	int	i, x, y, yi, b = absolute (bpc), ww = win->width, wh = win->height;
+	int	ret = 0;
+
+	if (x2 <= x1 || y2 <= y1 || n <= 0)
+		return 0;
+
+	/* The window as red, green and blue planes of floats, read once and
+	   sampled by every candidate.  Per candidate, the column each x is
+	   read from for red and blue, and red and blue minus green of the
+	   row before. */
+	stride = (size_t) ww * bytes;
+	size = (size_t) ww * wh;
+	planes = malloc ((3 * size + (size_t) n * 4 * w) * sizeof (float));
+	ix = malloc ((size_t) n * 2 * w * sizeof (int));
+	remap = malloc (2 * (w + h) * sizeof (double));
+	row = win->data == NULL ? malloc (stride) : NULL;
+	if (planes == NULL || ix == NULL || remap == NULL || \
+	    (win->data == NULL && row == NULL)) {
+		free (planes);
+		free (ix);
+		free (remap);
+		free (row);
+		return -1;
+	}
+	red = planes;
+	green = red + size;
+	blue = green + size;
+	fx = blue + size;
+	d = fx + (size_t) n * 2 * w;
+	for (y = 0; y < wh; y++) {
+		src = win->data != NULL ? win->data + stride * y : row;
+		if (win->data == NULL)
+			win->fetch_row (win->user_data, win->x, win->y + y, ww, row);
+		for (x = 0; x < ww; x++) {
+			red[(size_t) y*ww + x] = get_pixel (&src[x*bytes], bpc);
+			green[(size_t) y*ww + x] = get_pixel (&src[x*bytes + b], bpc);
+			blue[(size_t) y*ww + x] = get_pixel (&src[x*bytes + 2*b], bpc);
+		}
+	}
+	for (i = 0; i < n; i++) {
+		if (remap_fill (&candidates[i], orig_width, orig_height, \
+				x1, x2, x1, x1, remap, remap + w, NULL, NULL)) {
+			ret = -1;
+			goto done;
+		}
+		for (x = 0; x < (int) w; x++) {
+			sweep_split (remap[w + x], win->x, ww, &ix[i*2*w + x], \
+				     &fx[i*2*w + x]);
+			sweep_split (remap[x], win->x, ww, &ix[i*2*w + w + x], \
+				     &fx[i*2*w + w + x]);
+		}
+		scores[i] = 0;
+	}
+	sheet_stride = (size_t) columns * w * bytes;
+
+	for (y = y1; y < y2; y++) {
+		g = green + (size_t) (y - win->y) * ww - win->x;
+		src = win->data != NULL ? win->data + stride * (y - win->y) : row;
+		if (sheet != NULL && win->data == NULL)
+			win->fetch_row (win->user_data, win->x, y, ww, row);
+
+		for (i = 0; i < n; i++) {
+			int	*ixr = &ix[i*2*w], *ixb = ixr + w;
+			float	*fxr = &fx[i*2*w], *fxb = fxr + w;
+			float	*dr = &d[i*2*w], *db = dr + w;
+
+			/* Rows red and blue come from */
+			if (remap_fill (&candidates[i], orig_width, orig_height, \
+					x1, x1, y, y+1, NULL, NULL, \
+					remap + 2*w, remap + 2*w + 1)) {
+				ret = -1;
+				goto done;
+			}
+			sweep_split (remap[2*w + 1], win->y, wh, &yi, &fr);
+			r0 = red + (size_t) yi * ww;
+			r1 = r0 + ww;
+			sweep_split (remap[2*w], win->y, wh, &yi, &fb);
+			b0 = blue + (size_t) yi * ww;
+			b1 = b0 + ww;
+
+			out = NULL;
+			if (sheet != NULL) {
+				out = sheet + ((i / columns) * h + (y-y1)) * sheet_stride + \
+				      (i % columns) * w * bytes;
+				memcpy (out, src + (x1 - win->x) * bytes, w * bytes);
+			}
+
+			/* Change of (red - green) and (blue - green) from the
+			   left and above, which is what a color fringe is */
+			tv = 0;
+			for (x = 0; x < (int) w; x++) {
+				r = (r0[ixr[x]] * (1-fxr[x]) + r0[ixr[x]+1] * fxr[x]) * (1-fr) + \
+				    (r1[ixr[x]] * (1-fxr[x]) + r1[ixr[x]+1] * fxr[x]) * fr;
+				bl = (b0[ixb[x]] * (1-fxb[x]) + b0[ixb[x]+1] * fxb[x]) * (1-fb) + \
+				     (b1[ixb[x]] * (1-fxb[x]) + b1[ixb[x]+1] * fxb[x]) * fb;
+				if (out != NULL) {
+					set_pixel (&out[x*bytes], clip_d (r), bpc);
+					set_pixel (&out[x*bytes + 2*b], clip_d (bl), bpc);
+				}
+				r -= g[x1 + x];
+				bl -= g[x1 + x];
+				if (x > 0)
+					tv += fabsf (r - dr[x-1]) + fabsf (bl - db[x-1]);
+				if (y > y1)
+					tv += fabsf (r - dr[x]) + fabsf (bl - db[x]);
+				/* Up to x, d now holds this row */
+				dr[x] = r;
+				db[x] = bl;
+			}
+			scores[i] += tv;
+		}
+	}
+	for (i = 0; i < n; i++)
+		scores[i] /= (double) w * h;
+
+done:
+	free (planes);
+	free (ix);
+	free (remap);
+	free (row);
+	return ret;
+}
+
+/* Automatic estimate, see fix-ca-core.h */
+#define EST_PI		3.14159265358979323846
+#define EST_CELL	12	/* one candidate edge per block this size */
+#define EST_SECTORS	16
+#define EST_RINGS	4
+#define EST_PER_CELL	24	/* strongest edges kept per sector and ring */
+#define EST_RADIUS	5	/* half length of the profile compared */
+#define EST_STEPS	257	/* most offsets tried per edge */
+#define EST_MIN_EDGES	12
+#define EST_SHIFT	30	/* largest shift searched for, pixels */
+
+/* Candidate edge, the sector and ring it is in */
+typedef struct {
+	FixCaEdge	edge;
+	float	strength;
+	int	cell;
+} FixCaCandidate;
+
+static int edge_order (const void *a, const void *b)
+{
+	const FixCaCandidate *ca = a, *cb = b;
+
+	if (ca->cell != cb->cell)
+		return ca->cell < cb->cell ? -1 : 1;
+	if (ca->strength != cb->strength)
+		return ca->strength > cb->strength ? -1 : 1;
+	return 0;
+}
+
+static int double_order (const void *a, const void *b)
+{
+	double da = *(const double *) a, db = *(const double *) b;
+
+	return da < db ? -1 : da > db;
+}
+
+static float est_sample (const float *rgb, int w, int h, int ch,
+			 double x, double y)
+{
+	const float *p;
+	double	fx, fy;
+	int	x0, y0;
+
+	if (x < 0) x = 0;
+	if (x > w-1) x = w-1;
+	if (y < 0) y = 0;
+	if (y > h-1) y = h-1;
+	x0 = (int) x;
+	y0 = (int) y;
+	if (x0 > w-2) x0 = w-2;
+	if (y0 > h-2) y0 = h-2;
+	fx = x - x0;
+	fy = y - y0;
+	p = rgb + ((size_t) y0 * w + x0) * 3 + ch;
+	return (float) ((p[0] * (1-fx) + p[3] * fx) * (1-fy) + \
+			(p[3*w] * (1-fx) + p[3*w + 3] * fx) * fy);
+}
+
+/* Offset t along n, from t0-range to t0+range, where channel ch best
+   matches green around x, y.  Returns the normalized correlation, 0 if
+   no clear match was found. */
+static double est_search (const float *rgb, int w, int h, double x, double y,
+			  double nx, double ny, int ch, double t0,
+			  double range, double step, double *t)
+{
+	double	g[2*EST_RADIUS+1], c[2*EST_RADIUS+1], ncc[EST_STEPS];
+	double	gm = 0, gv = 0, cm, cv, cov, tk, a, b, d;
+	int	j, k, n, best = 0;
+
+	if (step < range / (EST_STEPS/2))
+		step = range / (EST_STEPS/2);
+	n = 2 * (int) ceil (range / step) + 1;
+	if (n > EST_STEPS)
+		n = EST_STEPS;
+
+	for (j = 0; j < 2*EST_RADIUS+1; j++) {
+		g[j] = est_sample (rgb, w, h, 1, x + (j-EST_RADIUS)*nx, \
+				   y + (j-EST_RADIUS)*ny);
+		gm += g[j];
+	}
+	gm /= 2*EST_RADIUS+1;
+	for (j = 0; j < 2*EST_RADIUS+1; j++)
+		gv += (g[j]-gm) * (g[j]-gm);
+	if (gv < 1e-6)
+		return 0;
+
+	for (k = 0; k < n; k++) {
+		tk = t0 + (k - n/2) * step;
+		cm = cv = cov = 0;
+		for (j = 0; j < 2*EST_RADIUS+1; j++) {
+			c[j] = est_sample (rgb, w, h, ch, x + (j-EST_RADIUS+tk)*nx, \
+					   y + (j-EST_RADIUS+tk)*ny);
+			cm += c[j];
+		}
+		cm /= 2*EST_RADIUS+1;
+		for (j = 0; j < 2*EST_RADIUS+1; j++) {
+			cv += (c[j]-cm) * (c[j]-cm);
+			cov += (c[j]-cm) * (g[j]-gm);
+		}
+		ncc[k] = cv < 1e-6 ? 0 : cov / sqrt (gv * cv);
+		if (ncc[k] > ncc[best])
+			best = k;
+	}
+	if (best == 0 || best == n-1 || ncc[best] < 0.8)
+		return 0;
+
+	/* Between steps, from a parabola through the best three */
+	a = ncc[best-1];
+	b = ncc[best];
+	d = a - 2*b + ncc[best+1];
+	*t = t0 + (best - n/2) * step;
+	if (d < 0)
+		*t += 0.5 * (a - ncc[best+1]) / d * step;
+	return b;
+}
+
+int fix_ca_estimate_init (FixCaEstimate *est, FixCaParams *params,
+			  int find_center, const float *rgb,
+			  int width, int height,
+			  int orig_width, int orig_height)
+{
+	FixCaCandidate *cand, *c;
+	const float *p;
+	double	cx, cy, rmax, gx, gy, best, strength, angle;
+	int	x, y, bx, by, i, n = 0, cell, kept, margin, ring, sector;
+	int	w1 = width/2, h1 = height/2;
+	float	*h;
+
+	memset (est, 0, sizeof (*est));
+	est->params = params;
+	est->find_center = find_center;
+	est->orig_width = orig_width;
+	est->orig_height = orig_height;
+	est->rgb[0] = rgb;
+	est->width[0] = width;
+	est->height[0] = height;
+	est->scale = (double) width / orig_width;
+	if (params->lens_x < 0 || params->lens_x >= orig_width)
+		params->lens_x = round (orig_width/2);
+	if (params->lens_y < 0 || params->lens_y >= orig_height)
+		params->lens_y = round (orig_height/2);
+
+	margin = EST_RADIUS + (int) (2*EST_SHIFT*est->scale) + 3;
+	if (width < 2*margin + EST_CELL || height < 2*margin + EST_CELL)
+		return 0;
+
+	/* Half size, for the wide first search */
+	if ((est->half = malloc ((size_t) w1 * h1 * 3 * sizeof (float))) == NULL)
+		return -1;
+	for (y = 0, h = est->half; y < h1; y++)
+		for (x = 0; x < w1; x++)
+			for (i = 0; i < 3; i++) {
+				p = rgb + ((size_t) 2*y * width + 2*x) * 3 + i;
+				*h++ = (p[0] + p[3] + p[3*width] + p[3*width + 3]) / 4;
+			}
+	est->rgb[1] = est->half;
+	est->width[1] = w1;
+	est->height[1] = h1;
+
+	cand = malloc (((size_t) (width/EST_CELL) + 1) * (height/EST_CELL + 1) * \
+		       sizeof (FixCaCandidate));
+	est->edges = malloc (((size_t) (width/EST_CELL) + 1) * (height/EST_CELL + 1) * \
+			     sizeof (FixCaEdge));
+	if (cand == NULL || est->edges == NULL) {
+		free (cand);
+		fix_ca_estimate_clear (est);
+		return -1;
+	}
+
+	/* Strongest green edge of each block, away from clipped colors */
+	cx = (params->lens_x + 0.5) * est->scale - 0.5;
+	cy = (params->lens_y + 0.5) * est->scale - 0.5;
+	rmax = hypot (cx > width-cx ? cx : width-cx, cy > height-cy ? cy : height-cy);
+	for (by = margin; by + EST_CELL <= height - margin; by += EST_CELL)
+		for (bx = margin; bx + EST_CELL <= width - margin; bx += EST_CELL) {
+			c = &cand[n];
+			best = 0.01;
+			for (y = by; y < by + EST_CELL; y++)
+				for (x = bx; x < bx + EST_CELL; x++) {
+					p = rgb + ((size_t) y * width + x) * 3;
+					if (p[0] > 0.98 || p[1] > 0.98 || p[2] > 0.98 || p[1] < 0.02)
+						continue;
+					gx = p[4] - p[-2];
+					gy = p[3*width + 1] - p[-3*width + 1];
+					strength = gx*gx + gy*gy;
+					if (strength <= best)
+						continue;
+					best = strength;
+					c->edge.x = x;
+					c->edge.y = y;
+					c->edge.nx = gx / sqrt (strength);
+					c->edge.ny = gy / sqrt (strength);
+					c->strength = strength;
+				}
+			if (best <= 0.01)
+				continue;
+			angle = atan2 (c->edge.y - cy, c->edge.x - cx);
+			sector = (int) ((angle + EST_PI) / (2*EST_PI) * EST_SECTORS) % EST_SECTORS;
+			ring = (int) (hypot (c->edge.x - cx, c->edge.y - cy) / rmax * EST_RINGS);
+			if (ring >= EST_RINGS)
+				ring = EST_RINGS-1;
+			c->cell = sector * EST_RINGS + ring;
+			n++;
+		}
+
+	/* Keep the strongest of each sector and ring, so all directions
+	   and distances from the center count */
+	qsort (cand, n, sizeof (FixCaCandidate), edge_order);
+	for (i = 0, cell = -1, kept = 0; i < n; i++) {
+		if (cand[i].cell != cell) {
+			cell = cand[i].cell;
+			kept = 0;
+		}
+		if (kept++ < EST_PER_CELL)
+			est->edges[est->n_edges++] = cand[i].edge;
+	}
+	free (cand);
+	return 0;
+}
+
+void fix_ca_estimate_measure (FixCaEstimate *est, int pass, int first, int last)
+{
+	FixCaEdge *e;
+	double	scale, x, y, px, py, t0, range, step, t;
+	int	i, ch, level = pass == 0 ? 1 : 0;
+
+	scale = level ? est->scale / 2 : est->scale;
+	for (i = first; i < last; i++) {
+		e = &est->edges[i];
+		x = level ? (e->x - 0.5) / 2 : e->x;
+		y = level ? (e->y - 0.5) / 2 : e->y;
+		px = (e->x + 0.5) / est->scale - 0.5;
+		py = (e->y + 0.5) / est->scale - 0.5;
+		for (ch = 0; ch < 2; ch++) {
+			/* Around the last fit, or as far as EST_SHIFT */
+			if (pass > 0 && est->fitted[ch]) {
+				t0 = est->model[ch][0] * (px*e->nx + py*e->ny) + \
+				     est->model[ch][1] * e->nx + est->model[ch][2] * e->ny;
+				t0 *= scale;
+				range = 1.5;
+				step = 0.125;
+			} else {
+				t0 = 0;
+				range = 2*EST_SHIFT*scale + 1;
+				step = 0.5;
+			}
+			t = 0;
+			e->weight[ch] = (float) est_search (est->rgb[level], \
+					est->width[level], est->height[level], x, y, \
+					e->nx, e->ny, ch == 0 ? 2 : 0, t0, range, step, &t);
+			e->t[ch] = (float) (t / scale);
+		}
+	}
+}
+
+/* Weighted least squares of t = m0 (P . n) + m1 nx + m2 ny, done again
+   without the edges far off the first fit */
+static int est_fit (FixCaEstimate *est, int ch, double m[3])
+{
+	FixCaEdge *e;
+	double	a[3][4], v[3], *res, limit = HUGE_VAL, r, f;
+	int	i, j, k, n = 0, iter;
+
+	res = malloc ((size_t) (est->n_edges + 1) * sizeof (double));
+	for (iter = 0; iter < 3; iter++) {
+		memset (a, 0, sizeof (a));
+		for (i = 0, n = 0; i < est->n_edges; i++) {
+			e = &est->edges[i];
+			if (e->weight[ch] <= 0)
+				continue;
+			v[0] = ((e->x + 0.5) / est->scale - 0.5) * e->nx + \
+			       ((e->y + 0.5) / est->scale - 0.5) * e->ny;
+			v[1] = e->nx;
+			v[2] = e->ny;
+			if (iter > 0 && fabs (e->t[ch] - m[0]*v[0] - m[1]*v[1] - m[2]*v[2]) > limit)
+				continue;
+			for (j = 0; j < 3; j++) {
+				for (k = 0; k < 3; k++)
+					a[j][k] += e->weight[ch] * v[j] * v[k];
+				a[j][3] += e->weight[ch] * v[j] * e->t[ch];
+			}
+			n++;
+		}
+		if (n < EST_MIN_EDGES)
+			break;
+
+		/* Gauss-Jordan, largest pivot first */
+		for (j = 0; j < 3; j++) {
+			for (k = j+1, i = j; k < 3; k++)
+				if (fabs (a[k][j]) > fabs (a[i][j]))
+					i = k;
+			for (k = 0; k < 4; k++) {
+				r = a[j][k];
+				a[j][k] = a[i][k];
+				a[i][k] = r;
+			}
+			if (fabs (a[j][j]) < 1e-12) {
+				n = 0;
+				break;
+			}
+			for (i = 0; i < 3; i++) {
+				if (i == j)
+					continue;
+				f = a[i][j] / a[j][j];
+				for (k = j; k < 4; k++)
+					a[i][k] -= f * a[j][k];
+			}
+		}
+		if (n == 0)
+			break;
+		for (j = 0; j < 3; j++)
+			m[j] = a[j][3] / a[j][j];
+
+		/* Edges over 3 times the median error off are left out */
+		if (res == NULL)
+			break;
+		for (i = 0, k = 0; i < est->n_edges; i++) {
+			e = &est->edges[i];
+			if (e->weight[ch] <= 0)
+				continue;
+			v[0] = ((e->x + 0.5) / est->scale - 0.5) * e->nx + \
+			       ((e->y + 0.5) / est->scale - 0.5) * e->ny;
+			res[k++] = fabs (e->t[ch] - m[0]*v[0] - m[1]*e->nx - m[2]*e->ny);
+		}
+		qsort (res, k, sizeof (double), double_order);
+		limit = 3 * res[k/2];
+		if (limit < 0.3)
+			limit = 0.3;
+	}
+	free (res);
+	return n;
+}
+
+int fix_ca_estimate_fit (FixCaEstimate *est)
+{
+	FixCaParams *params = est->params;
+	double	m[2][3], q[2], shift[2][2], amount[2], den, cx, cy;
+	int	ch, n[2], radius;
+
+	for (ch = 0; ch < 2; ch++) {
+		n[ch] = est_fit (est, ch, m[ch]);
+		est->fitted[ch] = n[ch] >= EST_MIN_EDGES;
+		if (est->fitted[ch])
+			memcpy (est->model[ch], m[ch], sizeof (m[ch]));
+	}
+	if (!est->fitted[0] || !est->fitted[1])
+		return n[0] < n[1] ? n[0] : n[1];
+
+	/* t = q (P - c) . n - shift . n, with q = scale - 1 */
+	q[0] = m[0][0];
+	q[1] = m[1][0];
+	cx = params->lens_x;
+	cy = params->lens_y;
+	den = q[0]*q[0] + q[1]*q[1];
+	if (est->find_center && \
+	    sqrt (den) * (est->orig_width + est->orig_height) > 1.0) {
+		cx = -(m[0][1]*q[0] + m[1][1]*q[1]) / den;
+		cy = -(m[0][2]*q[0] + m[1][2]*q[1]) / den;
+		cx = cx < 0 ? 0 : cx > est->orig_width-1 ? est->orig_width-1 : cx;
+		cy = cy < 0 ? 0 : cy > est->orig_height-1 ? est->orig_height-1 : cy;
+		params->lens_x = round (cx);
+		params->lens_y = round (cy);
+	}
+	for (ch = 0; ch < 2; ch++) {
+		shift[ch][0] = est->find_center ? 0 : -(m[ch][1] + q[ch] * cx);
+		shift[ch][1] = est->find_center ? 0 : -(m[ch][2] + q[ch] * cy);
+	}
+
+	/* scale = radius / (radius + amount) */
+	radius = lens_radius (params, est->orig_width, est->orig_height);
+	for (ch = 0; ch < 2; ch++)
+		amount[ch] = radius / (1 + q[ch]) - radius;
+
+#define EST_CLAMP(v)	(round (((v) < -INPUT_MAX ? -INPUT_MAX : \
+				 (v) > INPUT_MAX ? INPUT_MAX : (v)) * 100) / 100)
+	params->blue = EST_CLAMP (amount[0]);
+	params->red = EST_CLAMP (amount[1]);
+	params->x_blue = EST_CLAMP (shift[0][0]);
+	params->y_blue = EST_CLAMP (shift[0][1]);
+	params->x_red = EST_CLAMP (shift[1][0]);
+	params->y_red = EST_CLAMP (shift[1][1]);
+#undef EST_CLAMP
+	return n[0] < n[1] ? n[0] : n[1];
+}
+
+void fix_ca_estimate_clear (FixCaEstimate *est)
+{
+	free (est->half);
+	free (est->edges);
+	est->half = NULL;
+	est->edges = NULL;
+	est->n_edges = 0;
+}
@@ -0,0 +1,312 @@
+/*
+	fix-ca-core.h	Fix Chromatic Aberration, pixel shifting core
+	Copyright (c) 2006, 2007 Kriang Lerdsuwanakij - (original author)
+	Copyright (c) 2023, 2024 Jose Da Silva (updates and improvements)
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef FIX_CA_CORE_H
+#define FIX_CA_CORE_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Largest shift accepted, in pixels.  The row cache is sized for the
+   shifts asked for, see fix_ca_source_rows(). */
+#define INPUT_MAX	100
+
+/* Interpolation, same values as GimpInterpolationType */
+typedef enum {
+	FIX_CA_INTERPOLATION_NONE,
+	FIX_CA_INTERPOLATION_LINEAR,
+	FIX_CA_INTERPOLATION_CUBIC
+} FixCaInterpolation;
+
+/* Where the Gimp plug-in puts the result */
+typedef enum {
+	FIX_CA_OUTPUT_REPLACE,	/* drawable itself, through the shadow buffer */
+	FIX_CA_OUTPUT_LAYER,	/* new layer above the drawable */
+	FIX_CA_OUTPUT_IMAGE	/* new image */
+} FixCaOutput;
+
+/* Which layers of the image the Gimp plug-in corrects */
+typedef enum {
+	FIX_CA_LAYERS_ONE,	/* just the drawable */
+	FIX_CA_LAYERS_ALL,	/* every layer the size of the drawable */
+	FIX_CA_LAYERS_LINKED	/* the drawable and layers linked to it */
+} FixCaLayers;
+
+/* Most control points of a shift curve */
+#define FIX_CA_CURVE_POINTS	8
+
+/* Lateral shift of one color as a curve, used in place of the blue or
+   red amount when n is not 0.  It is applied per axis, like the plain
+   amounts: a column at x distance (fraction of the lens radius, the
+   distance from the lens center to the furthest edge, increasing,
+   {0..1}) from the center moves shift pixels outward along x, and a
+   row at that y distance the same along y.  Pixels off the axes are
+   not looked up at their true radius.  It is straight between points,
+   from the center to the first, and on past the last, so one point at
+   1 is close to the blue or red amount alone. */
+typedef struct {
+	int	n;
+	double	distance[FIX_CA_CURVE_POINTS];
+	double	shift[FIX_CA_CURVE_POINTS];
+} FixCaCurve;
+
+/* Storage type */
+typedef struct {
+	double	blue;
+	double	red;
+	double	lens_x;
+	double	lens_y;
+	int	update_preview;
+	int	interpolation;	/* FixCaInterpolation */
+	double	saturation;
+	double	x_blue;
+	double	x_red;
+	double	y_blue;
+	double	y_red;
+	int	memory_budget;	/* MiB, 0 = unlimited */
+	FixCaOutput output;
+	FixCaLayers layers;
+	FixCaCurve	blue_curve;	/* n = 0 for blue alone */
+	FixCaCurve	red_curve;
+} FixCaParams;
+
+/* Part of the image the source rows are read from, either a linear
+   buffer, or if data is NULL, fetch_row() copies width pixels of row y
+   starting at x into row, straight from the caller's own storage */
+typedef struct {
+	unsigned char *data;
+	int	x, y;
+	int	width, height;
+	void	(*fetch_row) (void *user_data, int x, int y, int width,
+			      unsigned char *row);
+	void	*user_data;
+} FixCaWindow;
+
+/* Progress over all fix_ca_region() calls of one run.  Every band of
+   8 rows, cancelled() is asked if the result is still wanted. */
+typedef struct {
+	int64_t	done;
+	int64_t	total;
+	void	(*update) (double fraction);
+	int	(*cancelled) (void *user_data);
+	void	*user_data;
+} FixCaProgress;
+
+/* Where the time of a run went, counted when a FixCaStats is given.
+   With FIX_CA_STATS set in the environment, the plug-in and fix-ca-cli
+   report each run as one line of JSON, see fix_ca_stats_emit(). */
+typedef enum {
+	FIX_CA_PHASE_FETCH,		/* source rows into the row cache */
+	FIX_CA_PHASE_RESAMPLE,		/* shifting red and blue */
+	FIX_CA_PHASE_SATURATE,		/* preview colors */
+	FIX_CA_PHASE_WRITE,		/* corrected rows out */
+	FIX_CA_PHASE_MERGE_SHADOW,	/* Gimp, into the drawable */
+	FIX_CA_PHASES
+} FixCaPhase;
+
+/* Hardware counters, Linux perf events */
+typedef enum {
+	FIX_CA_COUNTER_CYCLES,
+	FIX_CA_COUNTER_INSTRUCTIONS,
+	FIX_CA_COUNTER_LLC_MISSES,	/* last level cache */
+	FIX_CA_COUNTER_BRANCH_MISSES,
+	FIX_CA_COUNTERS
+} FixCaCounter;
+
+typedef struct {
+	double	seconds[FIX_CA_PHASES];
+	int64_t	pixels;
+	int64_t	row_hits;	/* source rows found in the row cache */
+	int64_t	row_misses;
+	int64_t	row_evictions;	/* misses that replaced a row */
+	int64_t	alloc_bytes;	/* working buffers allocated */
+	int64_t	requests;	/* preview changes seen so far, not added up */
+	int64_t	renders;	/* preview renders run for them, the same */
+	const char	*plan;	/* how the image was walked, or NULL */
+	int	tile_width;	/* of the plan */
+	int	tile_height;
+	int64_t	plan_peak;	/* bytes it expects in use at once */
+
+	/* With count_hw, each run also counts hardware events per phase,
+	   on the thread it runs on.  counted has bit 1 << FixCaCounter for
+	   each the host could give, none in most virtual machines. */
+	int	count_hw;
+	int	counted;
+	long	thread;		/* that ran it, 0 if unknown, -1 if several */
+	int64_t	hw[FIX_CA_PHASES][FIX_CA_COUNTERS];
+} FixCaStats;
+
+/* Clear stats, count_hw is set if FIX_CA_PERF is in the environment */
+void	fix_ca_stats_init (FixCaStats *stats);
+/* FIX_CA_STATS, "1" if only FIX_CA_PERF is set, or NULL.  Built with
+   --enable-debugtime it is always on. */
+const char	*fix_ca_stats_target (void);
+/* Seconds from some fixed time, to measure phases */
+double	fix_ca_stats_now (void);
+void	fix_ca_stats_add (FixCaStats *total, const FixCaStats *stats);
+/* One line of JSON for run what, that took seconds in all, to stderr or
+   appended to the file FIX_CA_STATS names if it isn't 1.  Where the host
+   can tell, it also gives the process's peak resident memory so far. */
+void	fix_ca_stats_emit (const char *what, const FixCaStats *stats,
+			   double seconds);
+
+/* Source column of every x and row of every y, for blue and red.  It
+   only depends on the settings and image size, so it can be worked out
+   once and shared, read only, by runs on any number of threads. */
+typedef struct {
+	double	*x_blue, *x_red;	/* orig_width each */
+	double	*y_blue, *y_red;	/* orig_height each */
+} FixCaRemap;
+
+/* Returns -1 if out of memory */
+int	fix_ca_remap_init (FixCaRemap *remap, FixCaParams *params,
+			   int orig_width, int orig_height);
+void	fix_ca_remap_clear (FixCaRemap *remap);
+
+/* Everything one run needs.  Give each thread its own, nothing else
+   is shared, so runs on different threads don't interfere. */
+typedef struct {
+	/* Image and settings, fix_ca_context_init() fills these in */
+	FixCaParams	*params;
+	int	orig_width;	/* whole image */
+	int	orig_height;
+	int	bytes;		/* per pixel */
+	int	bpc;		/* per color, negative for float/double */
+	int	channels;	/* FIX_CA_CHANNEL_*, default all */
+	FixCaProgress	*progress;	/* or NULL */
+	const FixCaRemap	*remap;	/* or NULL, for the same settings */
+	FixCaStats	*stats;		/* or NULL, added to by each run */
+
+	/* Row cache, kept between fix_ca_run() calls */
+	unsigned char	*rows;
+	size_t	rows_size;
+} FixCaContext;
+
+void	fix_ca_context_init (FixCaContext *ctx, FixCaParams *params,
+			     int orig_width, int orig_height,
+			     int bytes, int bpc);
+/* Free the row cache, ctx can be used again after */
+void	fix_ca_context_clear (FixCaContext *ctx);
+
+/* Shift the channels of rows y1..y2-1, columns x1..x2-1 of the image
+   in ctx, win and dstPTR as for fix_ca_region() */
+int	fix_ca_run (FixCaContext *ctx, FixCaWindow *win,
+		    unsigned char *dstPTR, int x1, int x2, int y1, int y2);
+
+/* Shift red and blue of rows y1..y2-1, columns x1..x2-1 of an image
+   orig_width x orig_height.  win holds at least the source pixels given
+   by fix_ca_source_rect(), dstPTR gets (x2-x1) x (y2-y1) pixels.  bytes
+   is bytes per pixel, bpc is bytes per color, negative for float/double.
+   Returns 0, -1 if out of memory, or 1 if cancelled. */
+int	fix_ca_region (FixCaWindow *win, unsigned char *dstPTR,
+		       int orig_width, int orig_height,
+		       int bytes, int bpc, FixCaParams *params,
+		       int x1, int x2, int y1, int y2,
+		       FixCaProgress *progress);
+
+/* Channels fix_ca_region_channels() shifts, others are copied as is */
+#define FIX_CA_CHANNEL_RED	1
+#define FIX_CA_CHANNEL_BLUE	2
+#define FIX_CA_CHANNEL_ALL	(FIX_CA_CHANNEL_RED | FIX_CA_CHANNEL_BLUE)
+
+/* Same as fix_ca_region(), only redoing the given channels */
+int	fix_ca_region_channels (FixCaWindow *win, unsigned char *dstPTR,
+				int orig_width, int orig_height,
+				int bytes, int bpc, FixCaParams *params,
+				int x1, int x2, int y1, int y2,
+				FixCaProgress *progress, int channels);
+
+/* Source pixels needed to correct the region x1..x2-1, y1..y2-1 */
+void	fix_ca_source_rect (FixCaParams *params, int orig_width, int orig_height,
+			    int x1, int x2, int y1, int y2, FixCaWindow *win);
+
+/* Rows fix_ca_run() keeps in its row cache to correct rows y1..y2-1,
+   each as wide as the source window.  Enough for every row one output
+   row reads, from the highest to the lowest, so small shifts need few. */
+int	fix_ca_source_rows (FixCaParams *params, int orig_width, int orig_height,
+			    int y1, int y2);
+
+/* Score n candidate settings over the region x1..x2-1, y1..y2-1 in one
+   pass.  win must hold the source pixels every candidate needs (see
+   fix_ca_source_rect()), each row is read once for all of them, as is
+   green.  Red and blue are shifted with linear interpolation, and
+   scores[i] is how much they still differ from green across edges, per
+   pixel, lower is better.  If sheet is not NULL, it gets the corrected
+   region of each candidate side by side, columns to a row.
+   Returns 0, or -1 if out of memory. */
+int	fix_ca_sweep (FixCaWindow *win, int orig_width, int orig_height,
+		      int bytes, int bpc, FixCaParams *candidates, int n,
+		      int x1, int x2, int y1, int y2, double *scores,
+		      unsigned char *sheet, int columns);
+
+/* Automatic estimate of the shifts.  The strongest green edges are
+   picked in sectors around the lens center, in an RGB float copy of
+   the image (3 floats per pixel, usually scaled down).  How far red
+   and blue are off across each edge is searched for at half that size,
+   then around the result at full size, and a model of the shifts is
+   fitted to all of them.  The search is split by edge, so it can be
+   shared out to threads:
+
+	fix_ca_estimate_init (&est, params, find_center, rgb, w, h, ow, oh);
+	for (pass = 0; pass < FIX_CA_ESTIMATE_PASSES; pass++) {
+		fix_ca_estimate_measure (&est, pass, 0, est.n_edges);
+		fix_ca_estimate_fit (&est);
+	}
+	fix_ca_estimate_clear (&est);
+*/
+#define FIX_CA_ESTIMATE_PASSES	2
+
+typedef struct {
+	float	x, y;		/* in the RGB copy */
+	float	nx, ny;		/* unit normal, across the edge */
+	float	t[2];		/* blue, red offset along it, whole image pixels */
+	float	weight[2];	/* 0 if not found */
+} FixCaEdge;
+
+typedef struct {
+	FixCaParams	*params;	/* lens center in, shifts (and center) out */
+	int	find_center;	/* else it is kept, see fix_ca_estimate_fit() */
+	int	orig_width, orig_height;
+	const float	*rgb[2];	/* full and half size */
+	int	width[2], height[2];
+	double	scale;		/* of the RGB copy to the whole image */
+	FixCaEdge	*edges;
+	int	n_edges;
+	double	model[2][3];	/* blue, red: t = m0 * (P . n) + m1 nx + m2 ny */
+	int	fitted[2];
+	float	*half;
+} FixCaEstimate;
+
+/* Returns -1 if out of memory */
+int	fix_ca_estimate_init (FixCaEstimate *est, FixCaParams *params,
+			      int find_center, const float *rgb,
+			      int width, int height,
+			      int orig_width, int orig_height);
+/* Search edges first..last-1, different ranges can run at once */
+void	fix_ca_estimate_measure (FixCaEstimate *est, int pass,
+				 int first, int last);
+/* Fit the shifts to what was found, into params.  The lens center and
+   directional shifts can't be told apart, so either the center is kept
+   and directional shifts found, or with find_center, the center is
+   found with no directional shifts.  Returns the number of edges used
+   for the channel with fewest, too few (under 12) leave params as is. */
+int	fix_ca_estimate_fit (FixCaEstimate *est);
+void	fix_ca_estimate_clear (FixCaEstimate *est);
+
+#endif
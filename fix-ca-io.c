@@ -0,0 +1,728 @@
+/*
+	fix-ca-io.c	Fix Chromatic Aberration, image files for fix-ca-cli
+	Copyright (c) 2023, 2024 Jose Da Silva (updates and improvements)
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* PNG (libpng), PAM and PFM (always) and TIFF (libtiff) in the layouts
+   the core works with: 8 or 16 bit RGB/RGBA, or float RGB/RGBA. */
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#if __has_include("fix-ca-config.h")
+#include "fix-ca-config.h"
+#endif
+
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#ifdef HAVE_PNG
+# include <png.h>
+#endif
+#ifdef HAVE_TIFF
+# include <tiffio.h>
+#endif
+
+#include "fix-ca-io.h"
+
+#define NO_MEMORY	"Not enough memory"
+
+/* Local function prototypes */
+static int	little_endian (void);
+static float	get_sample (const unsigned char *ptr, int bpc);
+static const char *read_pam_header (FixCaStream *stream);
+static const char *read_pfm_header (FixCaStream *stream);
+static void	swap_row (FixCaStream *stream, unsigned char *row);
+static const char *load_stream (FILE *fp, FixCaFormat format,
+				FixCaImage *image);
+static const char *save_stream (FILE *fp, FixCaFormat format,
+				FixCaImage *image);
+static uint32_t	exif_get (const unsigned char *ptr, int n, int big);
+static void	exif_string (FILE *fp, long base, const unsigned char *entry,
+			     int big, char *dest, size_t size);
+static int	exif_ifd (FILE *fp, long base, uint32_t offset, int big,
+			  FixCaLens *lens, int depth);
+#ifdef HAVE_PNG
+static const char *load_png (FILE *fp, FixCaImage *image);
+static const char *save_png (FILE *fp, FixCaImage *image);
+#endif
+#ifdef HAVE_TIFF
+static const char *load_tiff (const char *name, FixCaImage *image);
+static const char *save_tiff (const char *name, FixCaImage *image);
+#endif
+
+static int little_endian (void)
+{
+	const uint16_t one = 1;
+
+	return *(const unsigned char *) &one == 1;
+}
+
+/* One color as 0.0..1.0 */
+static float get_sample (const unsigned char *ptr, int bpc)
+{
+	if (bpc == 1)
+		return *ptr / 255.0f;
+	if (bpc == 2)
+		return *(const uint16_t *) ptr / 65535.0f;
+	return *(const float *) ptr;
+}
+
+FixCaFormat fix_ca_image_format (const char *name)
+{
+	const char *ext = strrchr (name, '.');
+
+	if (ext == NULL)
+		return FIX_CA_FORMAT_UNKNOWN;
+	++ext;
+	if (strcasecmp (ext, "pfm") == 0)
+		return FIX_CA_FORMAT_PFM;
+	if (strcasecmp (ext, "pam") == 0)
+		return FIX_CA_FORMAT_PAM;
+#ifdef HAVE_PNG
+	if (strcasecmp (ext, "png") == 0)
+		return FIX_CA_FORMAT_PNG;
+#endif
+#ifdef HAVE_TIFF
+	if (strcasecmp (ext, "tif") == 0 || strcasecmp (ext, "tiff") == 0)
+		return FIX_CA_FORMAT_TIFF;
+#endif
+	return FIX_CA_FORMAT_UNKNOWN;
+}
+
+const char *fix_ca_image_load (const char *name, FixCaFormat format,
+			       FixCaImage *image)
+{
+	const char *err;
+	FILE	*fp;
+
+	memset (image, 0, sizeof (*image));
+#ifdef HAVE_TIFF
+	if (format == FIX_CA_FORMAT_TIFF)
+		return load_tiff (name, image);
+#endif
+	if ((fp = fopen (name, "rb")) == NULL)
+		return "Can't open file";
+	if (format == FIX_CA_FORMAT_PFM || format == FIX_CA_FORMAT_PAM)
+		err = load_stream (fp, format, image);
+#ifdef HAVE_PNG
+	else if (format == FIX_CA_FORMAT_PNG)
+		err = load_png (fp, image);
+#endif
+	else
+		err = "Unknown file format";
+	fclose (fp);
+	return err;
+}
+
+const char *fix_ca_image_save (const char *name, FixCaFormat format,
+			       FixCaImage *image)
+{
+	const char *err;
+	FILE	*fp;
+
+#ifdef HAVE_TIFF
+	if (format == FIX_CA_FORMAT_TIFF)
+		return save_tiff (name, image);
+#endif
+	if ((fp = fopen (name, "wb")) == NULL)
+		return "Can't create file";
+	if (format == FIX_CA_FORMAT_PFM || format == FIX_CA_FORMAT_PAM)
+		err = save_stream (fp, format, image);
+#ifdef HAVE_PNG
+	else if (format == FIX_CA_FORMAT_PNG)
+		err = save_png (fp, image);
+#endif
+	else
+		err = "Unknown file format";
+	if (fclose (fp) != 0 && err == NULL)
+		err = "Write error";
+	if (err != NULL)
+		remove (name);
+	return err;
+}
+
+void fix_ca_image_free (FixCaImage *image)
+{
+	free (image->data);
+	image->data = NULL;
+}
+
+/* EXIF is a TIFF structure: the file itself for TIFF, the eXIf chunk
+   for PNG.  Only the tags naming the camera and lens are read. */
+#define EXIF_MAKE	0x010f
+#define EXIF_MODEL	0x0110
+#define EXIF_IFD	0x8769
+#define EXIF_FOCAL	0x920a
+#define EXIF_LENS	0xa434
+
+static uint32_t exif_get (const unsigned char *ptr, int n, int big)
+{
+	uint32_t v = 0;
+	int	i;
+
+	for (i = 0; i < n; i++)
+		v |= (uint32_t) ptr[big ? i : n-1-i] << (8 * (n-1-i));
+	return v;
+}
+
+static void exif_string (FILE *fp, long base, const unsigned char *entry,
+			 int big, char *dest, size_t size)
+{
+	uint32_t count = exif_get (entry + 4, 4, big);
+	size_t	n = count < size ? count : size - 1;
+
+	/* Up to 4 bytes are in the entry itself */
+	if (count <= 4)
+		memcpy (dest, entry + 8, n);
+	else if (fseek (fp, base + (long) exif_get (entry + 8, 4, big), SEEK_SET) != 0 || \
+		 fread (dest, 1, n, fp) != n)
+		n = 0;
+	dest[n] = '\0';
+	while (n > 0 && (dest[n-1] == ' ' || dest[n-1] == '\0'))
+		dest[--n] = '\0';
+}
+
+static int exif_ifd (FILE *fp, long base, uint32_t offset, int big,
+		     FixCaLens *lens, int depth)
+{
+	unsigned char	entry[12], rational[8];
+	uint32_t	count, i, num, den, sub = 0;
+	long	pos;
+
+	if (fseek (fp, base + (long) offset, SEEK_SET) != 0 || \
+	    fread (entry, 1, 2, fp) != 2)
+		return 0;
+	count = exif_get (entry, 2, big);
+	pos = base + (long) offset + 2;
+	for (i = 0; i < count && i < 1000; i++, pos += 12) {
+		if (fseek (fp, pos, SEEK_SET) != 0 || fread (entry, 1, 12, fp) != 12)
+			return 0;
+		switch (exif_get (entry, 2, big)) {
+			case EXIF_MAKE:
+				exif_string (fp, base, entry, big, lens->make, \
+					     sizeof (lens->make));
+				break;
+			case EXIF_MODEL:
+				exif_string (fp, base, entry, big, lens->model, \
+					     sizeof (lens->model));
+				break;
+			case EXIF_LENS:
+				exif_string (fp, base, entry, big, lens->lens, \
+					     sizeof (lens->lens));
+				break;
+			case EXIF_IFD:
+				sub = exif_get (entry + 8, 4, big);
+				break;
+			case EXIF_FOCAL:
+				if (fseek (fp, base + (long) exif_get (entry + 8, 4, big), \
+					   SEEK_SET) != 0 || fread (rational, 1, 8, fp) != 8)
+					break;
+				num = exif_get (rational, 4, big);
+				den = exif_get (rational + 4, 4, big);
+				if (den != 0)
+					lens->focal10 = (int) (((uint64_t) num * 10 + den/2) / den);
+				break;
+		}
+	}
+	if (sub != 0 && depth == 0)
+		exif_ifd (fp, base, sub, big, lens, 1);
+	return lens->make[0] != '\0' || lens->model[0] != '\0';
+}
+
+int fix_ca_image_lens (const char *name, FixCaFormat format, FixCaLens *lens)
+{
+	unsigned char	buf[12];
+	long	base = -1;
+	uint32_t	size;
+	FILE	*fp;
+	int	ret = 0;
+
+	memset (lens, 0, sizeof (*lens));
+	if ((fp = fopen (name, "rb")) == NULL)
+		return 0;
+	if (format == FIX_CA_FORMAT_TIFF) {
+		base = 0;
+	} else if (format == FIX_CA_FORMAT_PNG && fread (buf, 1, 8, fp) == 8) {
+		/* Walk the chunks up to eXIf */
+		while (fread (buf, 1, 8, fp) == 8) {
+			size = exif_get (buf, 4, 1);
+			if (memcmp (buf + 4, "eXIf", 4) == 0) {
+				base = ftell (fp);
+				break;
+			}
+			if (memcmp (buf + 4, "IEND", 4) == 0 || \
+			    fseek (fp, (long) size + 4, SEEK_CUR) != 0)
+				break;
+		}
+	}
+	if (base >= 0 && fseek (fp, base, SEEK_SET) == 0 && \
+	    fread (buf, 1, 8, fp) == 8 && \
+	    (memcmp (buf, "II*\0", 4) == 0 || memcmp (buf, "MM\0*", 4) == 0))
+		ret = exif_ifd (fp, base, exif_get (buf + 4, 4, buf[0] == 'M'), \
+				buf[0] == 'M', lens, 0);
+	fclose (fp);
+	return ret;
+}
+
+/* Portable arbitrary map, 8 or 16 bit RGB or RGB_ALPHA, big endian */
+static const char *read_pam_header (FixCaStream *stream)
+{
+	char	key[64], tuple[64] = "RGB";
+	int	c, depth = 0;
+
+	stream->width = stream->height = stream->maxval = 0;
+	for (;;) {
+		if (fscanf (stream->fp, "%63s", key) != 1)
+			return "Truncated PAM header";
+		if (key[0] == '#') {
+			while ((c = fgetc (stream->fp)) != '\n' && c != EOF);
+			continue;
+		}
+		if (strcmp (key, "ENDHDR") == 0)
+			break;
+		if ((strcmp (key, "WIDTH") == 0 && \
+		     fscanf (stream->fp, "%d", &stream->width) != 1) || \
+		    (strcmp (key, "HEIGHT") == 0 && \
+		     fscanf (stream->fp, "%d", &stream->height) != 1) || \
+		    (strcmp (key, "DEPTH") == 0 && \
+		     fscanf (stream->fp, "%d", &depth) != 1) || \
+		    (strcmp (key, "MAXVAL") == 0 && \
+		     fscanf (stream->fp, "%d", &stream->maxval) != 1) || \
+		    (strcmp (key, "TUPLTYPE") == 0 && \
+		     fscanf (stream->fp, "%63s", tuple) != 1))
+			return "Invalid PAM header";
+	}
+	while ((c = fgetc (stream->fp)) != '\n' && c != EOF);
+
+	if (stream->width <= 0 || stream->height <= 0 || \
+	    stream->maxval <= 0 || stream->maxval > 65535 || \
+	    !((depth == 3 && strcmp (tuple, "RGB") == 0) || \
+	      (depth == 4 && strcmp (tuple, "RGB_ALPHA") == 0)))
+		return "Not an RGB or RGB_ALPHA PAM file";
+	stream->bpc = stream->maxval < 256 ? 1 : 2;
+	stream->bytes = depth * stream->bpc;
+	stream->bottom_up = 0;
+	stream->swap = stream->bpc == 2 && little_endian ();
+	return NULL;
+}
+
+/* Portable float map, RGB only, rows stored bottom to top, a negative
+   scale means little endian */
+static const char *read_pfm_header (FixCaStream *stream)
+{
+	double	file_scale;
+
+	if (fscanf (stream->fp, "%d %d %lf", &stream->width, &stream->height, \
+		    &file_scale) != 3 || stream->width <= 0 || \
+	    stream->height <= 0 || file_scale == 0.0 || \
+	    !isspace (fgetc (stream->fp)))
+		return "Not an RGB PFM file";
+	stream->bytes = 3 * sizeof (float);
+	stream->bpc = -4;
+	stream->maxval = 0;
+	stream->bottom_up = 1;
+	stream->swap = (file_scale < 0.0) != little_endian ();
+	return NULL;
+}
+
+const char *fix_ca_stream_read_header (FixCaStream *stream, FILE *fp)
+{
+	int	c;
+
+	stream->fp = fp;
+	stream->format = FIX_CA_FORMAT_UNKNOWN;
+	if ((c = fgetc (fp)) == EOF)
+		return NULL;
+	if (c != 'P')
+		return "Not a PAM or PFM file";
+	c = fgetc (fp);
+	if (c == '7' && isspace (fgetc (fp))) {
+		stream->format = FIX_CA_FORMAT_PAM;
+		return read_pam_header (stream);
+	}
+	if (c == 'F') {
+		stream->format = FIX_CA_FORMAT_PFM;
+		return read_pfm_header (stream);
+	}
+	return "Not a PAM or PFM file";
+}
+
+const char *fix_ca_stream_write_header (FixCaStream *stream, FILE *fp,
+					const FixCaStream *from)
+{
+	*stream = *from;
+	stream->fp = fp;
+	if (stream->format == FIX_CA_FORMAT_PAM) {
+		stream->swap = stream->bpc == 2 && little_endian ();
+		fprintf (fp, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL %d\n" \
+			 "TUPLTYPE %s\nENDHDR\n", stream->width, stream->height, \
+			 stream->bytes / stream->bpc, stream->maxval, \
+			 stream->bytes / stream->bpc == 4 ? "RGB_ALPHA" : "RGB");
+	} else {
+		stream->swap = 0;
+		fprintf (fp, "PF\n%d %d\n%s\n", stream->width, stream->height, \
+			 little_endian () ? "-1.0" : "1.0");
+	}
+	return ferror (fp) ? "Write error" : NULL;
+}
+
+static void swap_row (FixCaStream *stream, unsigned char *row)
+{
+	size_t	i, size = (size_t) stream->width * stream->bytes;
+	unsigned char	t;
+
+	if (stream->bpc == 2) {
+		for (i = 0; i < size; i += 2) {
+			t = row[i]; row[i] = row[i+1]; row[i+1] = t;
+		}
+	} else {
+		for (i = 0; i < size; i += 4) {
+			t = row[i]; row[i] = row[i+3]; row[i+3] = t;
+			t = row[i+1]; row[i+1] = row[i+2]; row[i+2] = t;
+		}
+	}
+}
+
+const char *fix_ca_stream_read_row (FixCaStream *stream, unsigned char *row)
+{
+	if (fread (row, stream->bytes, stream->width, stream->fp) != \
+	    (size_t) stream->width)
+		return "Truncated file";
+	if (stream->swap)
+		swap_row (stream, row);
+	return NULL;
+}
+
+const char *fix_ca_stream_write_row (FixCaStream *stream, unsigned char *row)
+{
+	size_t	i, n, size = (size_t) stream->width * stream->bytes;
+	uint16_t *p = (uint16_t *) row;
+
+	/* Interpolation can go past a MAXVAL below the full range */
+	if (stream->bpc == 1 && stream->maxval < 255) {
+		for (i = 0; i < size; i++)
+			if (row[i] > stream->maxval)
+				row[i] = stream->maxval;
+	} else if (stream->bpc == 2 && stream->maxval < 65535) {
+		for (i = 0; i < size / 2; i++)
+			if (p[i] > stream->maxval)
+				p[i] = stream->maxval;
+	}
+	if (stream->swap)
+		swap_row (stream, row);
+	n = fwrite (row, stream->bytes, stream->width, stream->fp);
+	if (stream->swap)
+		swap_row (stream, row);
+	return n != (size_t) stream->width ? "Write error" : NULL;
+}
+
+static const char *load_stream (FILE *fp, FixCaFormat format,
+				FixCaImage *image)
+{
+	FixCaStream	stream;
+	const char	*err;
+	size_t	stride;
+	int	i, y;
+
+	if ((err = fix_ca_stream_read_header (&stream, fp)) != NULL)
+		return err;
+	if (stream.format != format)
+		return format == FIX_CA_FORMAT_PAM ? "Not a PAM file" : \
+						    "Not a PFM file";
+
+	stride = (size_t) stream.width * stream.bytes;
+	if ((image->data = malloc (stride * stream.height)) == NULL)
+		return NO_MEMORY;
+	image->width = stream.width;
+	image->height = stream.height;
+	image->bytes = stream.bytes;
+	image->bpc = stream.bpc;
+
+	for (i = 0; i < stream.height; i++) {
+		y = stream.bottom_up ? stream.height - 1 - i : i;
+		if ((err = fix_ca_stream_read_row (&stream, \
+						   &image->data[stride * y])) != NULL) {
+			fix_ca_image_free (image);
+			return err;
+		}
+	}
+	return NULL;
+}
+
+/* PFM is float RGB, alpha is dropped.  PAM keeps 8 or 16 bit, float is
+   saved as 16 bit. */
+static const char *save_stream (FILE *fp, FixCaFormat format,
+				FixCaImage *image)
+{
+	FixCaStream	like, stream;
+	const char	*err = NULL;
+	unsigned char	*row, *p;
+	int	i, x, y, c, channels, b = abs (image->bpc);
+	float	f;
+
+	channels = image->bytes / b;
+	like.format = format;
+	like.width = image->width;
+	like.height = image->height;
+	if (format == FIX_CA_FORMAT_PFM) {
+		channels = 3;
+		like.bpc = -4;
+		like.maxval = 0;
+		like.bottom_up = 1;
+	} else {
+		like.bpc = image->bpc == 1 ? 1 : 2;
+		like.maxval = image->bpc == 1 ? 255 : 65535;
+		like.bottom_up = 0;
+	}
+	like.bytes = channels * abs (like.bpc);
+
+	if ((row = malloc ((size_t) image->width * like.bytes)) == NULL)
+		return NO_MEMORY;
+	err = fix_ca_stream_write_header (&stream, fp, &like);
+	for (i = 0; i < image->height && err == NULL; i++) {
+		y = stream.bottom_up ? image->height - 1 - i : i;
+		p = &image->data[(size_t) y * image->width * image->bytes];
+		if (like.bpc == image->bpc && like.bytes == image->bytes) {
+			memcpy (row, p, (size_t) image->width * image->bytes);
+		} else {
+			for (x = 0; x < image->width; x++, p += image->bytes) {
+				for (c = 0; c < channels; c++) {
+					f = get_sample (p + c * b, image->bpc);
+					if (like.bpc < 0) {
+						((float *) row)[x * channels + c] = f;
+						continue;
+					}
+					f = f < 0.0f ? 0.0f : (f > 1.0f ? 1.0f : f);
+					((uint16_t *) row)[x * channels + c] = \
+						(uint16_t) lrintf (f * 65535.0f);
+				}
+			}
+		}
+		err = fix_ca_stream_write_row (&stream, row);
+	}
+	free (row);
+	return err;
+}
+
+#ifdef HAVE_PNG
+static const char *load_png (FILE *fp, FixCaImage *image)
+{
+	png_structp	png;
+	png_infop	info;
+	png_bytep	*volatile rows = NULL;
+	unsigned char	*volatile data = NULL;
+	png_uint_32	width, height, y;
+	int	depth, color, channels;
+	size_t	stride;
+
+	png = png_create_read_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	if (png == NULL)
+		return NO_MEMORY;
+	if ((info = png_create_info_struct (png)) == NULL) {
+		png_destroy_read_struct (&png, NULL, NULL);
+		return NO_MEMORY;
+	}
+	if (setjmp (png_jmpbuf (png))) {
+		png_destroy_read_struct (&png, &info, NULL);
+		free (rows);
+		free (data);
+		return "Invalid PNG file";
+	}
+
+	png_init_io (png, fp);
+	png_read_info (png, info);
+	png_get_IHDR (png, info, &width, &height, &depth, &color, \
+		      NULL, NULL, NULL);
+
+	/* Everything becomes 8 or 16 bit RGB or RGBA, in host order */
+	png_set_expand (png);
+	if (color == PNG_COLOR_TYPE_GRAY || color == PNG_COLOR_TYPE_GRAY_ALPHA)
+		png_set_gray_to_rgb (png);
+	if (depth == 16 && little_endian ())
+		png_set_swap (png);
+	png_read_update_info (png, info);
+	depth = png_get_bit_depth (png, info);
+	channels = png_get_channels (png, info);
+	stride = png_get_rowbytes (png, info);
+
+	data = malloc (stride * height);
+	rows = malloc (height * sizeof (png_bytep));
+	if (data == NULL || rows == NULL) {
+		png_destroy_read_struct (&png, &info, NULL);
+		free (rows);
+		free (data);
+		return NO_MEMORY;
+	}
+	for (y = 0; y < height; y++)
+		rows[y] = &data[stride * y];
+	png_read_image (png, rows);
+	png_read_end (png, NULL);
+	png_destroy_read_struct (&png, &info, NULL);
+	free (rows);
+
+	image->data = data;
+	image->width = width;
+	image->height = height;
+	image->bpc = depth / 8;
+	image->bytes = channels * image->bpc;
+	return NULL;
+}
+
+static const char *save_png (FILE *fp, FixCaImage *image)
+{
+	png_structp	png;
+	png_infop	info;
+	uint16_t	*volatile row = NULL;
+	int	x, y, channels, depth;
+	size_t	stride;
+	const unsigned char *p;
+
+	channels = image->bytes / abs (image->bpc);
+	depth = image->bpc == 1 ? 8 : 16;	/* float is saved as 16 bit */
+	stride = (size_t) image->width * image->bytes;
+
+	png = png_create_write_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	if (png == NULL)
+		return NO_MEMORY;
+	if ((info = png_create_info_struct (png)) == NULL) {
+		png_destroy_write_struct (&png, NULL);
+		return NO_MEMORY;
+	}
+	if (setjmp (png_jmpbuf (png))) {
+		png_destroy_write_struct (&png, &info);
+		free (row);
+		return "Write error";
+	}
+
+	png_init_io (png, fp);
+	png_set_IHDR (png, info, image->width, image->height, depth, \
+		      channels == 4 ? PNG_COLOR_TYPE_RGB_ALPHA : PNG_COLOR_TYPE_RGB, \
+		      PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, \
+		      PNG_FILTER_TYPE_DEFAULT);
+	png_write_info (png, info);
+	if (depth == 16 && little_endian ())
+		png_set_swap (png);
+
+	if (image->bpc < 0 && (row = malloc ((size_t) image->width * \
+					     channels * 2)) == NULL)
+		png_error (png, NO_MEMORY);
+	for (y = 0; y < image->height; y++) {
+		p = &image->data[stride * y];
+		if (image->bpc < 0) {
+			for (x = 0; x < image->width * channels; x++) {
+				float f = ((const float *) p)[x];
+				f = f < 0.0f ? 0.0f : (f > 1.0f ? 1.0f : f);
+				row[x] = (uint16_t) lrintf (f * 65535.0f);
+			}
+			p = (const unsigned char *) row;
+		}
+		png_write_row (png, (png_const_bytep) p);
+	}
+	png_write_end (png, NULL);
+	png_destroy_write_struct (&png, &info);
+	free (row);
+	return NULL;
+}
+#endif
+
+#ifdef HAVE_TIFF
+static const char *load_tiff (const char *name, FixCaImage *image)
+{
+	TIFF	*tif;
+	uint32_t width, height, y;
+	uint16_t bits, samples, format, planar, photometric;
+	size_t	stride;
+
+	if ((tif = TIFFOpen (name, "r")) == NULL)
+		return "Can't open file";
+	TIFFGetField (tif, TIFFTAG_IMAGEWIDTH, &width);
+	TIFFGetField (tif, TIFFTAG_IMAGELENGTH, &height);
+	TIFFGetFieldDefaulted (tif, TIFFTAG_BITSPERSAMPLE, &bits);
+	TIFFGetFieldDefaulted (tif, TIFFTAG_SAMPLESPERPIXEL, &samples);
+	TIFFGetFieldDefaulted (tif, TIFFTAG_SAMPLEFORMAT, &format);
+	TIFFGetFieldDefaulted (tif, TIFFTAG_PLANARCONFIG, &planar);
+	if (!TIFFGetField (tif, TIFFTAG_PHOTOMETRIC, &photometric))
+		photometric = PHOTOMETRIC_MINISBLACK;
+
+	if (photometric != PHOTOMETRIC_RGB || planar != PLANARCONFIG_CONTIG || \
+	    TIFFIsTiled (tif) || (samples != 3 && samples != 4) || \
+	    !(((bits == 8 || bits == 16) && format == SAMPLEFORMAT_UINT) || \
+	      (bits == 32 && format == SAMPLEFORMAT_IEEEFP))) {
+		TIFFClose (tif);
+		return "Only 8 bit, 16 bit or float RGB/RGBA TIFF files in strips";
+	}
+
+	image->width = width;
+	image->height = height;
+	image->bpc = bits == 32 ? -4 : bits / 8;
+	image->bytes = samples * (bits / 8);
+	stride = (size_t) width * image->bytes;
+	if ((image->data = malloc (stride * height)) == NULL) {
+		TIFFClose (tif);
+		return NO_MEMORY;
+	}
+	for (y = 0; y < height; y++) {
+		if (TIFFReadScanline (tif, &image->data[stride * y], y, 0) < 0) {
+			TIFFClose (tif);
+			fix_ca_image_free (image);
+			return "Invalid TIFF file";
+		}
+	}
+	TIFFClose (tif);
+	return NULL;
+}
+
+static const char *save_tiff (const char *name, FixCaImage *image)
+{
+	TIFF	*tif;
+	uint32_t y;
+	uint16_t samples, alpha = EXTRASAMPLE_UNASSALPHA;
+	size_t	stride;
+
+	if ((tif = TIFFOpen (name, "w")) == NULL)
+		return "Can't create file";
+	samples = image->bytes / abs (image->bpc);
+	stride = (size_t) image->width * image->bytes;
+	TIFFSetField (tif, TIFFTAG_IMAGEWIDTH, (uint32_t) image->width);
+	TIFFSetField (tif, TIFFTAG_IMAGELENGTH, (uint32_t) image->height);
+	TIFFSetField (tif, TIFFTAG_BITSPERSAMPLE, (uint16_t) (abs (image->bpc) * 8));
+	TIFFSetField (tif, TIFFTAG_SAMPLESPERPIXEL, samples);
+	TIFFSetField (tif, TIFFTAG_SAMPLEFORMAT, image->bpc < 0 ? \
+		      SAMPLEFORMAT_IEEEFP : SAMPLEFORMAT_UINT);
+	TIFFSetField (tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+	TIFFSetField (tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+	TIFFSetField (tif, TIFFTAG_COMPRESSION, COMPRESSION_NONE);
+	TIFFSetField (tif, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize (tif, 0));
+	if (samples == 4)
+		TIFFSetField (tif, TIFFTAG_EXTRASAMPLES, 1, &alpha);
+
+	for (y = 0; y < (uint32_t) image->height; y++) {
+		if (TIFFWriteScanline (tif, &image->data[stride * y], y, 0) < 0) {
+			TIFFClose (tif);
+			remove (name);
+			return "Write error";
+		}
+	}
+	TIFFClose (tif);
+	return NULL;
+}
+#endif
@@ -0,0 +1,88 @@
+/*
+	fix-ca-io.h	Fix Chromatic Aberration, image files for fix-ca-cli
+	Copyright (c) 2023, 2024 Jose Da Silva (updates and improvements)
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef FIX_CA_IO_H
+#define FIX_CA_IO_H 1
+
+#include <stdio.h>
+
+/* Whole RGB or RGBA image, in memory */
+typedef struct {
+	unsigned char *data;
+	int	width, height;
+	int	bytes;		/* per pixel */
+	int	bpc;		/* per color, 1 or 2, -4 for float */
+} FixCaImage;
+
+typedef enum {
+	FIX_CA_FORMAT_UNKNOWN,
+	FIX_CA_FORMAT_PNG,
+	FIX_CA_FORMAT_PFM,
+	FIX_CA_FORMAT_TIFF,
+	FIX_CA_FORMAT_PAM
+} FixCaFormat;
+
+/* File format from the name's extension, FIX_CA_FORMAT_UNKNOWN if it is
+   not one this build can read and write */
+FixCaFormat	fix_ca_image_format (const char *name);
+
+/* Read or write a file, image is converted to what format can hold.
+   Return NULL, or what went wrong. */
+const char	*fix_ca_image_load (const char *name, FixCaFormat format,
+				    FixCaImage *image);
+const char	*fix_ca_image_save (const char *name, FixCaFormat format,
+				    FixCaImage *image);
+void		fix_ca_image_free (FixCaImage *image);
+
+/* Camera and lens an image was taken with, from its EXIF tags */
+typedef struct {
+	char	make[32];
+	char	model[32];
+	char	lens[64];
+	int	focal10;	/* focal length in 1/10 mm, 0 if unknown */
+} FixCaLens;
+
+/* EXIF of a TIFF file or PNG eXIf chunk.  Returns 0 if there is none,
+   or it names no camera. */
+int		fix_ca_image_lens (const char *name, FixCaFormat format,
+				   FixCaLens *lens);
+
+/* PAM or PFM rows read or written one at a time, for pipes.  Rows are
+   in file order, PFM stores the bottom row first (bottom_up). */
+typedef struct {
+	FILE	*fp;
+	FixCaFormat	format;	/* FIX_CA_FORMAT_PAM or FIX_CA_FORMAT_PFM */
+	int	width, height;
+	int	bytes, bpc;	/* as for FixCaImage */
+	int	maxval;		/* PAM */
+	int	bottom_up;
+	int	swap;		/* file is not in host byte order */
+} FixCaStream;
+
+/* At end of file, returns NULL with format FIX_CA_FORMAT_UNKNOWN */
+const char	*fix_ca_stream_read_header (FixCaStream *stream, FILE *fp);
+/* Start an image with the same layout as from */
+const char	*fix_ca_stream_write_header (FixCaStream *stream, FILE *fp,
+					     const FixCaStream *from);
+const char	*fix_ca_stream_read_row (FixCaStream *stream,
+					 unsigned char *row);
+/* row may be clipped to maxval */
+const char	*fix_ca_stream_write_row (FixCaStream *stream,
+					  unsigned char *row);
+
+#endif
@@ -0,0 +1,374 @@
+/*
+	fix-ca-profile.c	Fix Chromatic Aberration, lens profiles for fix-ca-cli
+	Copyright (c) 2023, 2024 Jose Da Silva (updates and improvements)
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* File layout: a header, the profiles, the tables, then the remap
+   doubles.  Everything is 8 byte aligned so the file can be used as
+   mapped, with no parsing or copying. */
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#if __has_include("fix-ca-config.h")
+#include "fix-ca-config.h"
+#endif
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_UNISTD_H)
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+# define FIX_CA_MMAP 1
+#endif
+
+#include "fix-ca-profile.h"
+
+#define PROFILE_MAGIC	"FixCAlp1"
+#define PROFILE_ORDER	0x01020304
+
+typedef struct {
+	char	magic[8];
+	uint32_t	order;		/* tells the byte order it was made in */
+	uint32_t	n_profiles;
+	uint32_t	n_tables;
+	uint32_t	unused;
+} FixCaProfileHeader;
+
+/* Local function prototypes */
+static const char *read_file (FixCaProfiles *store, const char *name);
+static int	lens_match (const FixCaProfile *profile, const FixCaLens *lens);
+
+static const char *read_file (FixCaProfiles *store, const char *name)
+{
+	FILE	*fp;
+	long	size;
+
+#ifdef FIX_CA_MMAP
+	struct stat st;
+	int	fd;
+
+	if ((fd = open (name, O_RDONLY)) < 0)
+		return errno == ENOENT ? NULL : "Can't open file";
+	if (fstat (fd, &st) == 0 && st.st_size > 0) {
+		store->map = mmap (NULL, (size_t) st.st_size, PROT_READ, \
+				   MAP_SHARED, fd, 0);
+		if (store->map != MAP_FAILED) {
+			store->size = (size_t) st.st_size;
+			store->mapped = 1;
+			close (fd);
+			return NULL;
+		}
+		store->map = NULL;
+	}
+	close (fd);
+#endif
+
+	/* No mmap(), read it all */
+	if ((fp = fopen (name, "rb")) == NULL)
+		return NULL;
+	if (fseek (fp, 0, SEEK_END) != 0 || (size = ftell (fp)) < 0 || \
+	    fseek (fp, 0, SEEK_SET) != 0) {
+		fclose (fp);
+		return "Read error";
+	}
+	if (size > 0 && (store->map = malloc ((size_t) size)) == NULL) {
+		fclose (fp);
+		return "Not enough memory";
+	}
+	store->size = (size_t) size;
+	if (fread (store->map, 1, store->size, fp) != store->size) {
+		fclose (fp);
+		return "Read error";
+	}
+	fclose (fp);
+	return NULL;
+}
+
+const char *fix_ca_profiles_open (FixCaProfiles *store, const char *name)
+{
+	const FixCaProfileHeader *header;
+	const char *err;
+	size_t	i, data;
+
+	memset (store, 0, sizeof (*store));
+	if ((err = read_file (store, name)) != NULL || store->size == 0) {
+		fix_ca_profiles_close (store);
+		return err;
+	}
+
+	header = store->map;
+	if (store->size < sizeof (*header) || \
+	    memcmp (header->magic, PROFILE_MAGIC, 8) != 0) {
+		fix_ca_profiles_close (store);
+		return "Not a lens profile file";
+	}
+	if (header->order != PROFILE_ORDER) {
+		fix_ca_profiles_close (store);
+		return "Lens profile file is from another kind of machine";
+	}
+
+	/* Everything it points to has to be inside the file */
+	data = sizeof (*header) + header->n_profiles * sizeof (FixCaProfile) + \
+	       header->n_tables * sizeof (FixCaProfileTable);
+	if (header->n_profiles > store->size / sizeof (FixCaProfile) || \
+	    header->n_tables > store->size / sizeof (FixCaProfileTable) || \
+	    data > store->size) {
+		fix_ca_profiles_close (store);
+		return "Invalid lens profile file";
+	}
+	store->profiles = (const FixCaProfile *) (header + 1);
+	store->n_profiles = (int) header->n_profiles;
+	store->tables = (const FixCaProfileTable *) \
+			(store->profiles + store->n_profiles);
+	store->n_tables = (int) header->n_tables;
+	for (i = 0; i < header->n_tables; i++) {
+		const FixCaProfileTable *t = &store->tables[i];
+		if (t->profile >= header->n_profiles || t->width <= 0 || \
+		    t->height <= 0 || t->offset < data || t->offset % 8 != 0 || \
+		    t->offset > store->size || (store->size - t->offset) / \
+		    (2 * sizeof (double)) < (uint64_t) t->width + (uint64_t) t->height) {
+			fix_ca_profiles_close (store);
+			return "Invalid lens profile file";
+		}
+	}
+	return NULL;
+}
+
+void fix_ca_profiles_close (FixCaProfiles *store)
+{
+#ifdef FIX_CA_MMAP
+	if (store->mapped)
+		munmap (store->map, store->size);
+	else
+#endif
+		free (store->map);
+	memset (store, 0, sizeof (*store));
+}
+
+static int lens_match (const FixCaProfile *profile, const FixCaLens *lens)
+{
+	return strncmp (profile->make, lens->make, sizeof (profile->make)) == 0 && \
+	       strncmp (profile->model, lens->model, sizeof (profile->model)) == 0 && \
+	       strncmp (profile->lens, lens->lens, sizeof (profile->lens)) == 0;
+}
+
+const FixCaProfile *fix_ca_profiles_find (const FixCaProfiles *store,
+					   const FixCaLens *lens)
+{
+	const FixCaProfile *any = NULL;
+	int	i;
+
+	/* The exact focal length, else one for any */
+	for (i = 0; i < store->n_profiles; i++) {
+		if (!lens_match (&store->profiles[i], lens))
+			continue;
+		if (store->profiles[i].focal10 == lens->focal10)
+			return &store->profiles[i];
+		if (store->profiles[i].focal10 == 0)
+			any = &store->profiles[i];
+	}
+	return any;
+}
+
+void fix_ca_profile_params (const FixCaProfile *profile, FixCaParams *params)
+{
+	params->blue = profile->blue;
+	params->red = profile->red;
+	params->lens_x = profile->lens_x;
+	params->lens_y = profile->lens_y;
+	params->interpolation = profile->interpolation;
+	params->x_blue = profile->x_blue;
+	params->x_red = profile->x_red;
+	params->y_blue = profile->y_blue;
+	params->y_red = profile->y_red;
+	params->blue_curve.n = 0;
+	params->red_curve.n = 0;
+}
+
+int fix_ca_profiles_remap (const FixCaProfiles *store,
+			   const FixCaProfile *profile,
+			   int width, int height, FixCaRemap *remap)
+{
+	const FixCaProfileTable *t;
+	uint32_t index = (uint32_t) (profile - store->profiles);
+	int	i;
+
+	for (i = 0; i < store->n_tables; i++) {
+		t = &store->tables[i];
+		if (t->profile != index || t->width != width || t->height != height)
+			continue;
+		/* Same layout as fix_ca_remap_init(), only read */
+		remap->x_blue = (double *) ((char *) store->map + t->offset);
+		remap->x_red = remap->x_blue + width;
+		remap->y_blue = remap->x_red + width;
+		remap->y_red = remap->y_blue + height;
+		return 1;
+	}
+	return 0;
+}
+
+const char *fix_ca_profiles_save (const char *name, const FixCaLens *lens,
+				  const FixCaParams *params,
+				  const int *sizes, int n_sizes)
+{
+	FixCaProfiles	store;
+	FixCaProfileHeader header;
+	FixCaProfileTable *tables = NULL, *t;
+	FixCaProfile	*profiles = NULL, *p, old;
+	FixCaParams	sized;
+	FixCaRemap	remap;
+	const char	*err;
+	char	*tmp;
+	uint64_t	offset, *from = NULL;	/* old offset, 0 for new */
+	size_t	n;
+	uint32_t	i, replace, np = 0, nt = 0;
+	int	j, keep;
+	FILE	*fp;
+
+	if ((err = fix_ca_profiles_open (&store, name)) != NULL)
+		return err;
+
+	/* The old profiles, with this lens and focal length replaced */
+	profiles = malloc (((size_t) store.n_profiles + 1) * sizeof (FixCaProfile));
+	tables = malloc (((size_t) store.n_tables + (size_t) n_sizes) * \
+			 sizeof (FixCaProfileTable));
+	from = malloc (((size_t) store.n_tables + (size_t) n_sizes) * \
+		       sizeof (uint64_t));
+	tmp = malloc (strlen (name) + 5);
+	if (profiles == NULL || tables == NULL || from == NULL || tmp == NULL) {
+		err = "Not enough memory";
+		goto done;
+	}
+	replace = (uint32_t) store.n_profiles;
+	for (i = 0; i < (uint32_t) store.n_profiles; i++) {
+		profiles[np++] = store.profiles[i];
+		if (lens_match (&store.profiles[i], lens) && \
+		    store.profiles[i].focal10 == lens->focal10)
+			replace = i;
+	}
+	if (replace == np)
+		np++;
+	else
+		old = profiles[replace];
+	p = &profiles[replace];
+	memset (p, 0, sizeof (*p));
+	snprintf (p->make, sizeof (p->make), "%s", lens->make);
+	snprintf (p->model, sizeof (p->model), "%s", lens->model);
+	snprintf (p->lens, sizeof (p->lens), "%s", lens->lens);
+	p->focal10 = lens->focal10;
+	p->interpolation = params->interpolation;
+	p->blue = params->blue;
+	p->red = params->red;
+	p->lens_x = params->lens_x;
+	p->lens_y = params->lens_y;
+	p->x_blue = params->x_blue;
+	p->x_red = params->x_red;
+	p->y_blue = params->y_blue;
+	p->y_red = params->y_red;
+	keep = replace < (uint32_t) store.n_profiles && \
+	       memcmp (&old, p, sizeof (old)) == 0;
+
+	/* Old tables are copied as they are, new ones worked out.  Those of
+	   the profile replaced are still right if its settings are. */
+	for (i = 0; i < (uint32_t) store.n_tables; i++) {
+		if (store.tables[i].profile == replace) {
+			if (!keep)
+				continue;
+			for (j = 0; j < n_sizes; j++)
+				if (store.tables[i].width == sizes[2*j] && \
+				    store.tables[i].height == sizes[2*j + 1])
+					break;
+			if (j < n_sizes)
+				continue;
+		}
+		from[nt] = store.tables[i].offset;
+		tables[nt++] = store.tables[i];
+	}
+	for (i = 0; i < (uint32_t) n_sizes; i++) {
+		t = &tables[nt];
+		memset (t, 0, sizeof (*t));
+		t->profile = replace;
+		t->width = sizes[2*i];
+		t->height = sizes[2*i + 1];
+		from[nt++] = 0;
+	}
+	offset = sizeof (header) + np * sizeof (FixCaProfile) + \
+		 nt * sizeof (FixCaProfileTable);
+	for (i = 0; i < nt; i++) {
+		tables[i].offset = offset;
+		offset += 2 * ((uint64_t) tables[i].width + \
+			       (uint64_t) tables[i].height) * sizeof (double);
+	}
+
+	/* Written beside it, then renamed over it, for runs reading it */
+	sprintf (tmp, "%s.new", name);
+	if ((fp = fopen (tmp, "wb")) == NULL) {
+		err = "Can't create file";
+		goto done;
+	}
+	memset (&header, 0, sizeof (header));
+	memcpy (header.magic, PROFILE_MAGIC, 8);
+	header.order = PROFILE_ORDER;
+	header.n_profiles = np;
+	header.n_tables = nt;
+	if (fwrite (&header, sizeof (header), 1, fp) != 1 || \
+	    fwrite (profiles, sizeof (FixCaProfile), np, fp) != np || \
+	    fwrite (tables, sizeof (FixCaProfileTable), nt, fp) != nt)
+		err = "Write error";
+	for (i = 0; err == NULL && i < nt; i++) {
+		t = &tables[i];
+		n = 2 * ((size_t) t->width + (size_t) t->height);
+		if (from[i] != 0) {
+			if (fwrite ((char *) store.map + from[i], sizeof (double), \
+				    n, fp) != n)
+				err = "Write error";
+			continue;
+		}
+		/* Lens center -1 is the middle, as for the images it is used on */
+		sized = *params;
+		if (sized.lens_x < 0 || sized.lens_x >= t->width)
+			sized.lens_x = round (t->width/2);
+		if (sized.lens_y < 0 || sized.lens_y >= t->height)
+			sized.lens_y = round (t->height/2);
+		if (fix_ca_remap_init (&remap, &sized, t->width, t->height)) {
+			err = "Not enough memory";
+			break;
+		}
+		if (fwrite (remap.x_blue, sizeof (double), n, fp) != n)
+			err = "Write error";
+		fix_ca_remap_clear (&remap);
+	}
+	if (fclose (fp) != 0 && err == NULL)
+		err = "Write error";
+	if (err == NULL && rename (tmp, name) != 0)
+		err = "Can't replace file";
+	if (err != NULL)
+		remove (tmp);
+
+done:
+	fix_ca_profiles_close (&store);
+	free (tmp);
+	free (from);
+	free (tables);
+	free (profiles);
+	return err;
+}
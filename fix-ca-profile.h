@@ -0,0 +1,87 @@
+/*
+	fix-ca-profile.h	Fix Chromatic Aberration, lens profiles for fix-ca-cli
+	Copyright (c) 2023, 2024 Jose Da Silva (updates and improvements)
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef FIX_CA_PROFILE_H
+#define FIX_CA_PROFILE_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fix-ca-core.h"
+#include "fix-ca-io.h"
+
+/* Settings for one camera and lens, as stored in the file.  focal10 of
+   0 matches any focal length. */
+typedef struct {
+	char	make[32];
+	char	model[32];
+	char	lens[64];
+	int32_t	focal10;
+	int32_t	interpolation;
+	double	blue, red;
+	double	lens_x, lens_y;	/* -1 for the image center */
+	double	x_blue, x_red;
+	double	y_blue, y_red;
+} FixCaProfile;
+
+/* Remap worked out for a profile at one image size, offset is where
+   its 2 * (width + height) doubles are in the file */
+typedef struct {
+	uint32_t	profile;
+	int32_t	width, height;
+	uint32_t	unused;
+	uint64_t	offset;
+} FixCaProfileTable;
+
+/* Profile file, mapped read only.  It is in host byte order, made and
+   used on the same kind of machine. */
+typedef struct {
+	void	*map;
+	size_t	size;
+	int	mapped;
+	const FixCaProfile	*profiles;
+	int	n_profiles;
+	const FixCaProfileTable	*tables;
+	int	n_tables;
+} FixCaProfiles;
+
+/* A file that does not exist yet opens as an empty store.  Return NULL,
+   or what went wrong. */
+const char	*fix_ca_profiles_open (FixCaProfiles *store, const char *name);
+void		fix_ca_profiles_close (FixCaProfiles *store);
+
+/* Profile for lens, or NULL */
+const FixCaProfile *fix_ca_profiles_find (const FixCaProfiles *store,
+					   const FixCaLens *lens);
+/* Settings of profile, with no curves, other fields of params are kept */
+void		fix_ca_profile_params (const FixCaProfile *profile,
+				       FixCaParams *params);
+/* Points remap into the file if a table was stored for this size,
+   returns 0 if not.  It stays valid until the store is closed. */
+int		fix_ca_profiles_remap (const FixCaProfiles *store,
+				       const FixCaProfile *profile,
+				       int width, int height, FixCaRemap *remap);
+
+/* Add or replace the profile for lens in file name, with remap tables
+   for the n_sizes width, height pairs in sizes.  The file is rewritten,
+   open stores keep their old copy. */
+const char	*fix_ca_profiles_save (const char *name, const FixCaLens *lens,
+				       const FixCaParams *params,
+				       const int *sizes, int n_sizes);
+
+#endif
@@ -0,0 +1,639 @@
+/*
+	fix-ca-serve.c	Fix Chromatic Aberration, local correction service
+	Copyright (c) 2023, 2024 Jose Da Silva (updates and improvements)
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* Starting fix-ca-cli costs more than correcting a small image, so the
+   service stays up with its worker threads ready.  Each worker keeps
+   its row cache and output buffer from job to job, and remap tables are
+   kept for the last few settings and image sizes, shared by all. */
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#if __has_include("fix-ca-config.h")
+#include "fix-ca-config.h"
+#endif
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(HAVE_SYS_UN_H) && defined(HAVE_SYS_MMAN_H) && defined(HAVE_UNISTD_H)
+# include <signal.h>
+# include <sys/mman.h>
+# include <sys/socket.h>
+# include <sys/stat.h>
+# include <sys/un.h>
+# include <fcntl.h>
+# include <unistd.h>
+# define FIX_CA_SERVE 1
+#endif
+
+#include "fix-ca-io.h"
+#include "fix-ca-serve.h"
+
+#ifdef FIX_CA_SERVE
+
+/* Remap tables kept, by settings and image size */
+#define SERVE_PLANS	8
+#define SERVE_LINE	4096
+
+typedef struct {
+	FixCaParams	params;
+	int	width, height;
+	FixCaRemap	remap;
+	int	valid;
+	int	users;		/* jobs using it now */
+	unsigned long	used;	/* last time, to replace the oldest */
+} ServePlan;
+
+typedef struct ServeJob {
+	struct ServeJob	*next;
+	int	raw;
+	const char	*in, *out;
+	int	width, height, bytes, bpc;	/* raw only */
+	FixCaParams	params;
+	double	arrived;
+	double	ms;
+	int	ahead;
+	int	done;
+	const char	*err;
+} ServeJob;
+
+typedef struct ServeConnection {
+	struct ServeConnection	*next;
+	struct FixCaServer	*server;
+	int	fd;
+} ServeConnection;
+
+typedef struct FixCaServer {
+	const FixCaParams	*defaults;
+	int	quiet;
+	int	listen_fd;
+	pthread_mutex_t	lock;
+	pthread_cond_t	work;		/* a job was queued, or stopping */
+	pthread_cond_t	finished;	/* a job is done, or a connection */
+	ServeJob	*head, *tail;
+	int	queued, running, stopping;
+	ServeConnection	*connections;
+	long	jobs, failed;
+	double	total_ms, max_ms;
+	ServePlan	plans[SERVE_PLANS];
+	unsigned long	clock;
+} FixCaServer;
+
+/* Settings a job can change, as KEY=VALUE */
+static const struct {
+	const char	*key;
+	size_t	offset;
+} serve_keys[] = {
+	{ "blue",	offsetof (FixCaParams, blue) },
+	{ "red",	offsetof (FixCaParams, red) },
+	{ "lens-x",	offsetof (FixCaParams, lens_x) },
+	{ "lens-y",	offsetof (FixCaParams, lens_y) },
+	{ "x-blue",	offsetof (FixCaParams, x_blue) },
+	{ "x-red",	offsetof (FixCaParams, x_red) },
+	{ "y-blue",	offsetof (FixCaParams, y_blue) },
+	{ "y-red",	offsetof (FixCaParams, y_red) }
+};
+
+/* Local function prototypes */
+static double	serve_now (void);
+static ServePlan *serve_plan_get (FixCaServer *server, FixCaParams *params,
+				  int width, int height);
+static void	serve_plan_put (FixCaServer *server, ServePlan *plan);
+static const char *serve_job (FixCaServer *server, ServeJob *job,
+			      FixCaContext *ctx, unsigned char **scratch,
+			      size_t *scratch_size);
+static void	*serve_worker (void *data);
+static const char *serve_parse (FixCaServer *server, char *line,
+				ServeJob *job);
+static void	serve_reply (int fd, const char *format, ...);
+static void	*serve_connection (void *data);
+
+static double serve_now (void)
+{
+	struct timespec	ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int same_plan (const ServePlan *plan, const FixCaParams *params,
+		      int width, int height)
+{
+	return plan->width == width && plan->height == height && \
+	       plan->params.blue == params->blue && \
+	       plan->params.red == params->red && \
+	       plan->params.lens_x == params->lens_x && \
+	       plan->params.lens_y == params->lens_y && \
+	       plan->params.x_blue == params->x_blue && \
+	       plan->params.x_red == params->x_red && \
+	       plan->params.y_blue == params->y_blue && \
+	       plan->params.y_red == params->y_red && \
+	       memcmp (&plan->params.blue_curve, &params->blue_curve, \
+		       sizeof (FixCaCurve)) == 0 && \
+	       memcmp (&plan->params.red_curve, &params->red_curve, \
+		       sizeof (FixCaCurve)) == 0;
+}
+
+/* Remap for params at this size, made in place of the oldest unused
+   one if need be.  NULL if they are all in use, the job makes its own. */
+static ServePlan *serve_plan_get (FixCaServer *server, FixCaParams *params,
+				  int width, int height)
+{
+	ServePlan	*plan, *oldest = NULL;
+	int	i;
+
+	pthread_mutex_lock (&server->lock);
+	server->clock++;
+	for (i = 0; i < SERVE_PLANS; i++) {
+		plan = &server->plans[i];
+		if (plan->valid && same_plan (plan, params, width, height)) {
+			plan->users++;
+			plan->used = server->clock;
+			pthread_mutex_unlock (&server->lock);
+			return plan;
+		}
+		if (plan->users == 0 && (oldest == NULL || plan->used < oldest->used))
+			oldest = plan;
+	}
+	if (oldest != NULL) {
+		if (oldest->valid)
+			fix_ca_remap_clear (&oldest->remap);
+		oldest->valid = fix_ca_remap_init (&oldest->remap, params, \
+						   width, height) == 0;
+		if (oldest->valid) {
+			oldest->params = *params;
+			oldest->width = width;
+			oldest->height = height;
+			oldest->users = 1;
+			oldest->used = server->clock;
+		} else
+			oldest = NULL;
+	}
+	pthread_mutex_unlock (&server->lock);
+	return oldest;
+}
+
+static void serve_plan_put (FixCaServer *server, ServePlan *plan)
+{
+	if (plan == NULL)
+		return;
+	pthread_mutex_lock (&server->lock);
+	plan->users--;
+	pthread_mutex_unlock (&server->lock);
+}
+
+static const char *serve_job (FixCaServer *server, ServeJob *job,
+			      FixCaContext *ctx, unsigned char **scratch,
+			      size_t *scratch_size)
+{
+	FixCaFormat	format = FIX_CA_FORMAT_UNKNOWN;
+	FixCaImage	image;
+	FixCaWindow	win;
+	FixCaParams	params = job->params;
+	ServePlan	*plan;
+	FixCaStats	stats;
+	struct stat	st;
+	unsigned char	*rows, *p;
+	const char	*err = NULL;
+	size_t	size, rows_size;
+	double	start = 0.0, t = 0.0;
+	int	fd = -1, ret, timed = fix_ca_stats_target () != NULL;
+
+	fix_ca_stats_init (&stats);
+	if (timed)
+		start = fix_ca_stats_now ();
+
+	if (job->raw) {
+		image.width = job->width;
+		image.height = job->height;
+		image.bytes = job->bytes;
+		image.bpc = job->bpc;
+		size = (size_t) image.width * image.height * image.bytes;
+		if ((fd = open (job->in, O_RDWR)) < 0)
+			return strerror (errno);
+		if (fstat (fd, &st) != 0 || (size_t) st.st_size < size) {
+			close (fd);
+			return "File is smaller than the image";
+		}
+		image.data = mmap (NULL, size, PROT_READ | PROT_WRITE, \
+				   MAP_SHARED, fd, 0);
+		close (fd);
+		if (image.data == MAP_FAILED)
+			return strerror (errno);
+	} else {
+		if ((format = fix_ca_image_format (job->in)) == FIX_CA_FORMAT_UNKNOWN || \
+		    fix_ca_image_format (job->out) == FIX_CA_FORMAT_UNKNOWN)
+			return "Unknown file format";
+		if ((err = fix_ca_image_load (job->in, format, &image)) != NULL)
+			return err;
+		size = (size_t) image.width * image.height * image.bytes;
+	}
+	if (timed)
+		stats.seconds[FIX_CA_PHASE_FETCH] += fix_ca_stats_now () - start;
+
+	if (params.lens_x < 0 || params.lens_x >= image.width)
+		params.lens_x = round (image.width/2);
+	if (params.lens_y < 0 || params.lens_y >= image.height)
+		params.lens_y = round (image.height/2);
+
+	/* Output buffer and row cache only grow, they're kept for next time */
+	if (size > *scratch_size) {
+		if ((p = realloc (*scratch, size)) == NULL)
+			err = "Not enough memory";
+		else {
+			*scratch = p;
+			*scratch_size = size;
+			stats.alloc_bytes += (int64_t) size;
+		}
+	}
+	if (err == NULL) {
+		plan = serve_plan_get (server, &params, image.width, image.height);
+		rows = ctx->rows;
+		rows_size = ctx->rows_size;
+		fix_ca_context_init (ctx, &params, image.width, image.height, \
+				     image.bytes, image.bpc);
+		ctx->rows = rows;
+		ctx->rows_size = rows_size;
+		ctx->remap = plan != NULL ? &plan->remap : NULL;
+		ctx->stats = timed ? &stats : NULL;
+
+		memset (&win, 0, sizeof (win));
+		win.data = image.data;
+		win.width = image.width;
+		win.height = image.height;
+		ret = fix_ca_run (ctx, &win, *scratch, 0, image.width, \
+				  0, image.height);
+		serve_plan_put (server, plan);
+		ctx->stats = NULL;
+		if (ret != 0)
+			err = "Not enough memory";
+	}
+
+	if (timed)
+		t = fix_ca_stats_now ();
+	if (job->raw) {
+		if (err == NULL)
+			memcpy (image.data, *scratch, size);
+		munmap (image.data, size);
+	} else {
+		if (err == NULL) {
+			p = image.data;
+			image.data = *scratch;
+			err = fix_ca_image_save (job->out, fix_ca_image_format (job->out), \
+						 &image);
+			image.data = p;
+		}
+		fix_ca_image_free (&image);
+	}
+	if (timed && err == NULL) {
+		stats.seconds[FIX_CA_PHASE_WRITE] += fix_ca_stats_now () - t;
+		fix_ca_stats_emit (job->raw ? "serve-raw" : "serve", &stats, \
+				   fix_ca_stats_now () - start);
+	}
+	return err;
+}
+
+/* Until stopped and the queue is empty */
+static void *serve_worker (void *data)
+{
+	FixCaServer	*server = data;
+	FixCaContext	ctx;
+	ServeJob	*job;
+	unsigned char	*scratch = NULL;
+	size_t	scratch_size = 0;
+
+	memset (&ctx, 0, sizeof (ctx));
+	for (;;) {
+		pthread_mutex_lock (&server->lock);
+		while (server->head == NULL && !server->stopping)
+			pthread_cond_wait (&server->work, &server->lock);
+		if ((job = server->head) == NULL) {
+			pthread_mutex_unlock (&server->lock);
+			break;
+		}
+		if ((server->head = job->next) == NULL)
+			server->tail = NULL;
+		server->queued--;
+		server->running++;
+		pthread_mutex_unlock (&server->lock);
+
+		job->err = serve_job (server, job, &ctx, &scratch, &scratch_size);
+
+		pthread_mutex_lock (&server->lock);
+		job->ms = serve_now () - job->arrived;
+		job->done = 1;
+		server->running--;
+		server->jobs++;
+		if (job->err != NULL)
+			server->failed++;
+		server->total_ms += job->ms;
+		if (job->ms > server->max_ms)
+			server->max_ms = job->ms;
+		pthread_cond_broadcast (&server->finished);
+		pthread_mutex_unlock (&server->lock);
+	}
+	fix_ca_context_clear (&ctx);
+	free (scratch);
+	return NULL;
+}
+
+/* Job in line, NULL or what is wrong with it */
+static const char *serve_parse (FixCaServer *server, char *line,
+				ServeJob *job)
+{
+	char	*word, *save, *value, *end, *size[4];
+	double	d;
+	size_t	i;
+
+	memset (job, 0, sizeof (*job));
+	job->params = *server->defaults;
+	word = strtok_r (line, " \t\r\n", &save);
+	job->raw = strcmp (word, "raw") == 0;
+	if ((job->in = strtok_r (NULL, " \t\r\n", &save)) == NULL)
+		return "Missing file name";
+	if (job->raw) {
+		for (i = 0; i < 4; i++)
+			if ((size[i] = strtok_r (NULL, " \t\r\n", &save)) == NULL)
+				return "raw needs FILE W H BYTES BPC";
+		job->width = atoi (size[0]);
+		job->height = atoi (size[1]);
+		job->bytes = atoi (size[2]);
+		job->bpc = atoi (size[3]);
+		if (job->width <= 0 || job->height <= 0 || \
+		    (job->bpc != 1 && job->bpc != 2 && job->bpc != 4 && \
+		     job->bpc != -4 && job->bpc != -8) || \
+		    job->bytes < 3 * abs (job->bpc) || job->bytes > 4 * abs (job->bpc))
+			return "Bad image size or pixel format";
+	} else if ((job->out = strtok_r (NULL, " \t\r\n", &save)) == NULL)
+		return "Missing output file name";
+
+	while ((word = strtok_r (NULL, " \t\r\n", &save)) != NULL) {
+		if ((value = strchr (word, '=')) == NULL)
+			return "Settings are KEY=VALUE";
+		*value++ = '\0';
+		d = strtod (value, &end);
+		if (end == value || *end != '\0' || !isfinite (d))
+			return "Bad setting value";
+		if (strcmp (word, "interpolation") == 0) {
+			if (d != 0 && d != 1 && d != 2)
+				return "interpolation is 0, 1 or 2";
+			job->params.interpolation = (int) d;
+			continue;
+		}
+		for (i = 0; i < sizeof (serve_keys) / sizeof (serve_keys[0]); i++)
+			if (strcmp (word, serve_keys[i].key) == 0)
+				break;
+		if (i == sizeof (serve_keys) / sizeof (serve_keys[0]))
+			return "Unknown setting";
+		if (strncmp (word, "lens", 4) != 0 && (d < -INPUT_MAX || d > INPUT_MAX))
+			return "Shift out of range";
+		*(double *) ((char *) &job->params + serve_keys[i].offset) = d;
+	}
+	return NULL;
+}
+
+static void serve_reply (int fd, const char *format, ...)
+{
+	char	buf[256];
+	va_list	args;
+	int	len;
+
+	va_start (args, format);
+	len = vsnprintf (buf, sizeof (buf) - 1, format, args);
+	va_end (args);
+	if (len < 0)
+		return;
+	if (len > (int) sizeof (buf) - 2)
+		len = (int) sizeof (buf) - 2;
+	buf[len++] = '\n';
+	if (write (fd, buf, (size_t) len) < 0)
+		return;
+}
+
+/* One client, its jobs are answered in the order they are sent */
+static void *serve_connection (void *data)
+{
+	ServeConnection	*conn = data, **c;
+	FixCaServer	*server = conn->server;
+	ServeJob	job;
+	FILE	*fp;
+	char	line[SERVE_LINE], word[16];
+	const char	*err;
+
+	if ((fp = fdopen (conn->fd, "r")) != NULL)
+		while (fgets (line, sizeof (line), fp) != NULL) {
+			if (sscanf (line, "%15s", word) != 1)
+				continue;
+			if (strcmp (word, "stats") == 0) {
+				pthread_mutex_lock (&server->lock);
+				serve_reply (conn->fd, "ok jobs=%ld failed=%ld queued=%d " \
+					     "running=%d mean-ms=%.3f max-ms=%.3f", \
+					     server->jobs, server->failed, server->queued, \
+					     server->running, server->jobs ? \
+					     server->total_ms / server->jobs : 0.0, \
+					     server->max_ms);
+				pthread_mutex_unlock (&server->lock);
+				continue;
+			}
+			if (strcmp (word, "stop") == 0) {
+				pthread_mutex_lock (&server->lock);
+				server->stopping = 1;
+				pthread_mutex_unlock (&server->lock);
+				/* Wakes up accept() */
+				shutdown (server->listen_fd, SHUT_RDWR);
+				serve_reply (conn->fd, "ok");
+				continue;
+			}
+			if (strcmp (word, "fix") != 0 && strcmp (word, "raw") != 0) {
+				serve_reply (conn->fd, "error Unknown command %s", word);
+				continue;
+			}
+			if ((err = serve_parse (server, line, &job)) != NULL) {
+				serve_reply (conn->fd, "error %s", err);
+				continue;
+			}
+
+			job.arrived = serve_now ();
+			pthread_mutex_lock (&server->lock);
+			if (server->stopping) {
+				pthread_mutex_unlock (&server->lock);
+				serve_reply (conn->fd, "error Stopping");
+				continue;
+			}
+			job.ahead = server->queued;
+			if (server->tail != NULL)
+				server->tail->next = &job;
+			else
+				server->head = &job;
+			server->tail = &job;
+			server->queued++;
+			pthread_cond_signal (&server->work);
+			while (!job.done)
+				pthread_cond_wait (&server->finished, &server->lock);
+			pthread_mutex_unlock (&server->lock);
+
+			if (job.err != NULL)
+				serve_reply (conn->fd, "error %s", job.err);
+			else
+				serve_reply (conn->fd, "ok %.3f %d", job.ms, job.ahead);
+			if (!server->quiet)
+				printf ("%s %s%s%s %.3f ms, %d queued\n", \
+					job.raw ? "raw" : "fix", job.in, \
+					job.raw ? "" : " -> ", job.raw ? "" : job.out, \
+					job.ms, job.ahead);
+		}
+
+	pthread_mutex_lock (&server->lock);
+	for (c = &server->connections; *c != conn; c = &(*c)->next)
+		;
+	*c = conn->next;
+	pthread_cond_broadcast (&server->finished);
+	pthread_mutex_unlock (&server->lock);
+	if (fp != NULL)
+		fclose (fp);
+	else
+		close (conn->fd);
+	free (conn);
+	return NULL;
+}
+
+const char *fix_ca_serve (const char *path, const FixCaParams *defaults,
+			  int jobs, int quiet)
+{
+	FixCaServer	server;
+	ServeConnection	*conn;
+	struct sockaddr_un	addr;
+	struct stat	st;
+	pthread_t	*workers, thread;
+	const char	*err = NULL;
+	int	fd, i, started = 0;
+
+	memset (&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen (path) >= sizeof (addr.sun_path))
+		return "Socket path is too long";
+	strcpy (addr.sun_path, path);
+
+	memset (&server, 0, sizeof (server));
+	server.defaults = defaults;
+	server.quiet = quiet;
+	/* A client gone before its answer isn't a reason to stop */
+	signal (SIGPIPE, SIG_IGN);
+
+	/* Left behind by a service that didn't stop cleanly */
+	if (stat (path, &st) == 0 && S_ISSOCK (st.st_mode))
+		unlink (path);
+	if ((server.listen_fd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return strerror (errno);
+	if (bind (server.listen_fd, (struct sockaddr *) &addr, sizeof (addr)) != 0 || \
+	    listen (server.listen_fd, 16) != 0) {
+		err = strerror (errno);
+		close (server.listen_fd);
+		return err;
+	}
+
+	pthread_mutex_init (&server.lock, NULL);
+	pthread_cond_init (&server.work, NULL);
+	pthread_cond_init (&server.finished, NULL);
+	if (jobs < 1)
+		jobs = 1;
+	if ((workers = malloc (sizeof (pthread_t) * jobs)) != NULL)
+		for (; started < jobs; started++)
+			if (pthread_create (&workers[started], NULL, serve_worker, \
+					    &server) != 0)
+				break;
+	if (started == 0)
+		err = "Can't start worker threads";
+	else if (!quiet)
+		printf ("fix-ca-cli: serving on %s, %d workers\n", path, started);
+	fflush (stdout);
+
+	while (err == NULL) {
+		if ((fd = accept (server.listen_fd, NULL, NULL)) < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			pthread_mutex_lock (&server.lock);
+			if (!server.stopping)
+				err = strerror (errno);
+			pthread_mutex_unlock (&server.lock);
+			break;
+		}
+		if ((conn = malloc (sizeof (*conn))) == NULL) {
+			close (fd);
+			continue;
+		}
+		conn->server = &server;
+		conn->fd = fd;
+		pthread_mutex_lock (&server.lock);
+		conn->next = server.connections;
+		server.connections = conn;
+		pthread_mutex_unlock (&server.lock);
+		if (pthread_create (&thread, NULL, serve_connection, conn) != 0) {
+			pthread_mutex_lock (&server.lock);
+			server.connections = conn->next;
+			pthread_mutex_unlock (&server.lock);
+			close (fd);
+			free (conn);
+			continue;
+		}
+		pthread_detach (thread);
+	}
+
+	/* Queued jobs are finished, then clients are told to go */
+	pthread_mutex_lock (&server.lock);
+	server.stopping = 1;
+	pthread_cond_broadcast (&server.work);
+	pthread_mutex_unlock (&server.lock);
+	for (i = 0; i < started; i++)
+		pthread_join (workers[i], NULL);
+	free (workers);
+	pthread_mutex_lock (&server.lock);
+	for (conn = server.connections; conn != NULL; conn = conn->next)
+		shutdown (conn->fd, SHUT_RDWR);
+	while (server.connections != NULL)
+		pthread_cond_wait (&server.finished, &server.lock);
+	pthread_mutex_unlock (&server.lock);
+
+	close (server.listen_fd);
+	unlink (path);
+	for (i = 0; i < SERVE_PLANS; i++)
+		if (server.plans[i].valid)
+			fix_ca_remap_clear (&server.plans[i].remap);
+	pthread_cond_destroy (&server.finished);
+	pthread_cond_destroy (&server.work);
+	pthread_mutex_destroy (&server.lock);
+	return err;
+}
+
+#else
+
+const char *fix_ca_serve (const char *path, const FixCaParams *defaults,
+			  int jobs, int quiet)
+{
+	(void) path; (void) defaults; (void) jobs; (void) quiet;
+	return "Not available on this system";
+}
+
+#endif
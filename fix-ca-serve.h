@@ -0,0 +1,42 @@
+/*
+	fix-ca-serve.h	Fix Chromatic Aberration, local correction service
+	Copyright (c) 2023, 2024 Jose Da Silva (updates and improvements)
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef FIX_CA_SERVE_H
+#define FIX_CA_SERVE_H 1
+
+#include "fix-ca-core.h"
+
+/* Take jobs on the Unix domain socket path until one asks to stop, with
+   jobs worker threads.  Each connection sends lines, one per job, and
+   gets a line back for each once it is done:
+
+	fix IN OUT [KEY=VALUE]...	correct image file IN into OUT
+	raw FILE W H BYTES BPC [KEY=VALUE]...
+					correct the W x H pixels in FILE,
+					e.g. in /dev/shm, in place
+	stats				jobs done, queued and running
+	stop				finish queued jobs and return
+
+   KEY is a long option of fix-ca-cli for a setting, e.g. blue=2, the
+   others are as in defaults.  A job is answered with "ok MS QUEUED",
+   its time in milliseconds from arriving to done and how many jobs were
+   waiting ahead of it, or "error WHY".  Returns NULL, or what went wrong. */
+const char	*fix_ca_serve (const char *path, const FixCaParams *defaults,
+			       int jobs, int quiet);
+
+#endif
@@ -26,12 +26,23 @@
 
 #include <string.h>
 #include <math.h>
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_UNISTD_H)
+# include <sys/mman.h>
+# include <unistd.h>
+# define FIX_CA_MMAP 1
+#endif
 
 #include <libgimp/gimp.h>
 #include <libgimp/gimpui.h>
+#ifdef FIX_CA_MMAP
+# include <glib/gstdio.h>
+#endif
+
+/* Pixel shifting core, kept in its own file so it can be built
+   without Gimp, but compiled here as part of the plug-in. */
+#include "fix-ca-core.c"
 
 #ifdef DEBUG_TIME
-# include <sys/time.h>
 # include <stdio.h>
 #endif
 
@@ -51,8 +62,14 @@
 
 #ifdef TEST_FIX_CA
 #define PROCEDURE_NAME	"Test-Fix-CA"
+#define PROCEDURE_FULL_NAME	"Test-Fix-CA-full"
+#define PROCEDURE_BATCH_NAME	"Test-Fix-CA-batch"
+#define PROCEDURE_ESTIMATE_NAME	"Test-Fix-CA-estimate"
 #else
 #define PROCEDURE_NAME	"Fix-CA"
+#define PROCEDURE_FULL_NAME	"Fix-CA-full"
+#define PROCEDURE_BATCH_NAME	"Fix-CA-batch"
+#define PROCEDURE_ESTIMATE_NAME	"Fix-CA-estimate"
 #endif
 #define DATA_KEY_VALS	"fix_ca"
 
@@ -60,26 +77,109 @@
 #define SCALE_WIDTH	150
 #define ENTRY_WIDTH	4
 
-/* For row buffer management */
-#define SOURCE_ROWS	120
-#define INPUT_MAX	SOURCE_ROWS/4
-#define ROW_INVALID	-100
-#define ITER_INITIAL	-100
+/* The estimate works on a copy scaled to about this many pixels across,
+   fetched as thumbnails, which Gimp makes at most 1024 across */
+#define ESTIMATE_SIZE	2048
+#define ESTIMATE_PIECES	(ESTIMATE_SIZE / 1024)
+
+/* Changes within one frame are merged into one preview render, and
+   a draft preview is refined after this much quiet time */
+#define PREVIEW_FRAME_MS	16
+#define PREVIEW_REFINE_MS	250
 
-/* Storage type */
+/* How fix_ca() walks the drawable to stay within memory_budget */
+typedef enum {
+	FIX_CA_PLAN_RESIDENT,	/* whole selection in one pass */
+	FIX_CA_PLAN_BANDS,	/* full width bands of rows */
+	FIX_CA_PLAN_COLUMNS	/* bands split into column tiles */
+} FixCaPlanType;
+
+typedef struct {
+	FixCaPlanType type;
+	gint	tile_width;
+	gint	tile_height;
+	gsize	peak;		/* estimated bytes in use at once */
+} FixCaPlan;
+
+/* Working buffer, in memory or in a memory-mapped temporary file */
 typedef struct {
-	gdouble  blue;
-	gdouble  red;
-	gdouble  lens_x;
-	gdouble  lens_y;
-	gboolean update_preview;
-	GimpInterpolationType	interpolation;
-	gdouble	 saturation;
-	gdouble  x_blue;
-	gdouble  x_red;
-	gdouble  y_blue;
-	gdouble  y_red;
-} FixCaParams;
+	guchar	*data;
+	gsize	size;
+	gboolean mapped;
+} FixCaBuffer;
+
+/* Where fetch_row() reads the source rows from */
+typedef struct {
+	GeglBuffer *buffer;
+	const Babl *format;
+} FixCaSource;
+
+/* Kept from one item of a batch to the next.  The plan and working
+   buffer are reused while items have the same size and format, the
+   row cache grows to whatever the largest item needs. */
+typedef struct {
+	FixCaPlan	plan;
+	gint	xImg, yImg, bppImg;	/* plan and destImg are for these */
+	gint	x, y, width, height;
+	gint	memory_budget;
+	FixCaBuffer	destImg;
+	FixCaContext	ctx;
+	gint32	into_image;	/* new_layer() arguments, into_image -1 */
+	gint	position;	/* for a new image each time */
+} FixCaShared;
+
+/* One layer of fix_ca_layers(), read and written in the main thread,
+   corrected by a worker */
+typedef struct {
+	gint32	drawable_ID;
+	gint32	result_ID;
+	gint	x, y, width, height;	/* area corrected */
+	FixCaWindow win;	/* source pixels */
+	guchar	*dest;
+	gint	ret;
+	FixCaStats	stats;	/* of the worker's run */
+	gdouble	seconds;
+} FixCaLayerJob;
+
+/* Shared, read only, by every worker of fix_ca_layers() */
+typedef struct {
+	FixCaParams	*params;
+	FixCaRemap	remap;	/* worked out once for all layers */
+	gint	xImg, yImg, bppImg, bpcImg;
+	gboolean	timed;	/* workers count FixCaStats */
+	GAsyncQueue	*done;	/* jobs finished */
+} FixCaLayersRun;
+
+/* Part of the estimate's edge search, for one pass */
+typedef struct {
+	FixCaEstimate	*est;
+	gint	pass;
+	gint	chunk;		/* edges per job */
+} FixCaEstimateRun;
+
+/* One preview render, done on a worker thread.  Only the newest
+   generation is drawn, older ones stop at their next band of rows. */
+typedef struct {
+	GimpPreview *preview;
+	gint	generation;
+	FixCaParams params;	/* copy, the dialog keeps changing its own */
+	FixCaWindow win;	/* source pixels, read in the main thread */
+	gint	x, y, width, height;	/* area corrected */
+	gint	xImg, yImg, bppImg, bpcImg;	/* of the image, maybe scaled */
+	gint	out_width, out_height;	/* preview area it is drawn in */
+	guchar	*prevImg;	/* 8 bit result for gimp_preview_draw_buffer */
+	guint	requested, executed;	/* preview counters when queued */
+} FixCaRender;
+
+/* Last corrected preview area, before saturation and centerline, so
+   that a change only redoes what it affects.  Only the preview worker
+   uses it while the dialog is open. */
+typedef struct {
+	guchar	*data;
+	FixCaParams params;	/* what data was made with */
+	gint	x, y, width, height;
+	gint	xImg, yImg, bppImg, bpcImg;
+} FixCaPreviewCache;
 
 /* Global default */
 static const FixCaParams fix_ca_params_default = {
@@ -93,45 +193,80 @@ static const FixCaParams fix_ca_params_default = {
 	0.0,	/* x_blue */
 	0.0,	/* x_red  */
 	0.0,	/* y_blue */
-	0.0	/* y_red  */
+	0.0,	/* y_red  */
+	0,	/* memory_budget */
+	FIX_CA_OUTPUT_REPLACE,	/* output */
+	FIX_CA_LAYERS_ONE,	/* layers */
+	{ 0 },	/* blue_curve, none */
+	{ 0 }	/* red_curve, none */
 };
 
+/* Preview renders are queued here, newest generation wins */
+static GThreadPool *preview_pool = NULL;
+static gint	preview_generation = 0;
+static guint	preview_refine_id = 0;
+static gint64	preview_last = 0;
+static guint	preview_frame_id = 0;
+static guint	preview_requested = 0;	/* changes seen */
+static FixCaPreviewCache preview_cache;
+static guint	preview_executed = 0;	/* renders queued for them */
+
 /* Local function prototypes */
 static void	query (void);
 static void	run (const gchar *name, gint nparams,
 		     const GimpParam  *param, gint *nreturn_vals,
 		     GimpParam **return_vals);
-static int	fix_ca (gint32 drawable_ID, FixCaParams *params);
-static void	fix_ca_region (guchar *srcPTR, guchar *dstPTR,
-			       gint orig_width, gint orig_height,
-			       gint bytes, gint bpc, FixCaParams *params,
-			       gint x1, gint x2, gint y1, gint y2,
-			       gboolean show_progress);
+static void	run_batch (gint nparams, const GimpParam *param,
+			   gint *nreturn_vals, GimpParam **return_vals);
+static void	run_estimate (gint nparams, const GimpParam *param,
+			      gint *nreturn_vals, GimpParam **return_vals);
+static gboolean	params_valid (FixCaParams *params);
+static gboolean	estimate (gint32 drawable_ID, FixCaParams *params,
+			  gboolean find_center);
+static void	estimate_measure (gpointer data, gpointer user_data);
+static void	estimate_clicked (GtkWidget *button, GtkWidget *preview);
+static int	fix_ca (gint32 drawable_ID, FixCaParams *params, gint32 *result_ID);
+static int	fix_ca_shared (gint32 drawable_ID, FixCaParams *params,
+			       gint32 *result_ID, FixCaShared *shared);
+static void	shared_clear (FixCaShared *shared);
+static int	fix_ca_layers (gint32 drawable_ID, FixCaParams *params,
+			       gint32 *result_ID);
+static void	layer_render (gpointer data, gpointer user_data);
+static gint32	new_layer (gint32 drawable_ID, FixCaOutput output,
+			   gint32 into_image, gint position,
+			   gint x, gint y, gint width, gint height);
+static void	discard_result (gint32 layer_ID, FixCaOutput output);
+static void	discard_results (FixCaLayerJob *jobs, gint n,
+				 FixCaOutput output, gint32 *result_ID);
+static void	fix_ca_plan (FixCaPlan *plan, FixCaParams *params,
+			     gint orig_width, gint orig_height, gint bytes,
+			     gint x, gint y, gint width, gint height);
+static gsize	plan_peak (FixCaParams *params, gint orig_width, gint orig_height,
+			   gint bytes, gint x, gint y, gint width, gint height,
+			   gint tile_width, gint tile_height);
+static gboolean	buffer_new (FixCaBuffer *buf, gsize size, gboolean out_of_core);
+static void	buffer_free (FixCaBuffer *buf);
+static gsize	available_memory (void);
+static void	fetch_row (void *user_data, gint x, gint y, gint width,
+			   guchar *row);
 static gboolean	fix_ca_dialog (gint32 drawable_ID, FixCaParams *params);
+static void	preview_schedule (GtkWidget *widget);
+static gboolean	preview_frame (gpointer data);
 static void	preview_update (GtkWidget *widget, FixCaParams *params);
+static gboolean	preview_refine (gpointer data);
+static void	preview_queue (GtkWidget *widget, FixCaParams *params,
+			       gboolean draft);
+static void	preview_render (gpointer data, gpointer user_data);
+static gboolean	preview_draw (gpointer data);
+static gint	preview_channels (FixCaRender *render);
+static gint	preview_cancelled (void *user_data);
+static void	preview_free (FixCaRender *render);
 static int	color_size (const Babl *format);
-static gdouble	get_pixel (guchar *ptr, gint bpc);
-static void	set_pixel (guchar *dest, gdouble d, gint bpc);
-static int	round_nearest (gdouble d);
-static int	absolute (gint i);
-static gdouble	clip_d (gdouble d);
-static void	bilinear (guchar *dest, \
-			  guchar *yrow0, guchar *yrow1, gint x0, gint x1, \
-			  gint bpp, gint bpc, gdouble dx, gdouble dy);
-static double	cubicY (guchar *yrow, gint bpp, gint bpc, gdouble dx, \
-			gint m1, gint x0, gint p1, gint p2);
-static void	cubicX (guchar *dest, gint bpp, gint bpc, gdouble dy, \
-			gdouble ym1, gdouble x, gdouble xp1, gdouble xp2);
 static void	saturate (guchar *dest, gint width,
 			  gint bpp, gint bpc, gdouble s_scale);
 static void centerline (guchar *dest, gint width, gint bpp, gint bpc, \
 			gint x, gint y, gint xc, gint yc);
-static int	scale (gint i, gint center, gint size, gdouble scale_val, gdouble shift_val);
-static double	scale_d (gint i, gint center, gint size, gdouble scale_val, gdouble shift_val);
-static guchar *load_data (gint fullWidth, gint bpp, guchar *srcPTR,
-			  guchar *src[SOURCE_ROWS], gint src_row[SOURCE_ROWS],
-			  gint src_iter[SOURCE_ROWS], gint band_adj,
-			  gint band_1, gint band_2, gint y, gint iter);
+static void	progress_update (gdouble fraction);
 static void	fix_ca_help (const gchar *help_id, gpointer help_data);
 
 GimpPlugInInfo PLUG_IN_INFO = {
@@ -141,7 +276,11 @@ GimpPlugInInfo PLUG_IN_INFO = {
 	run,	/* run_proc   */
 };
 
+/* tests/micro-fix-ca.c includes this file for its functions, with its
+   own main() */
+#ifndef MICRO_FIX_CA
 MAIN ()
+#endif
 
 static void query (void)
 {
@@ -157,8 +296,57 @@ static void query (void)
 		{ GIMP_PDB_FLOAT, "x_blue", "Blue amount (x axis, directional)" },
 		{ GIMP_PDB_FLOAT, "x_red", "Red amount (x axis, directional)" },
 		{ GIMP_PDB_FLOAT, "y_blue", "Blue amount (y axis, directional)" },
+		{ GIMP_PDB_FLOAT, "y_red", "Red amount (y axis, directional)" },
+		/* Fix-CA-full only, Fix-CA keeps its 12 for old scripts */
+		{ GIMP_PDB_INT32, "memory_budget", "Memory budget in MiB (0=unlimited)" },
+		{ GIMP_PDB_INT32, "output", "Output 0=Replace/1=New layer/2=New image" },
+		{ GIMP_PDB_INT32, "layers", "Layers 0=Drawable/1=All same size/2=Linked" }
+	};
+	static GimpParamDef return_vals[] = {
+		{ GIMP_PDB_DRAWABLE, "result", "Drawable holding the result" }
+	};
+	static GimpParamDef batch_args[] = {
+		{ GIMP_PDB_INT32, "run_mode", "Non-interactive" },
+		{ GIMP_PDB_INT32, "num_drawables", "Number of drawables" },
+		{ GIMP_PDB_INT32ARRAY, "drawables", "Drawables to correct" },
+		{ GIMP_PDB_INT32, "num_files", "Number of files" },
+		{ GIMP_PDB_STRINGARRAY, "files", "Image files to correct" },
+		{ GIMP_PDB_FLOAT, "blue", "Blue amount (lateral)" },
+		{ GIMP_PDB_FLOAT, "red", "Red amount (lateral)" },
+		{ GIMP_PDB_FLOAT, "lens_x", "lens center (x, lateral, -1=center)" },
+		{ GIMP_PDB_FLOAT, "lens_y", "lens center (y, lateral, -1=center)" },
+		{ GIMP_PDB_INT8, "interpolation", "Interpolation 0=None/1=Linear/2=Cubic" },
+		{ GIMP_PDB_FLOAT, "x_blue", "Blue amount (x axis, directional)" },
+		{ GIMP_PDB_FLOAT, "x_red", "Red amount (x axis, directional)" },
+		{ GIMP_PDB_FLOAT, "y_blue", "Blue amount (y axis, directional)" },
+		{ GIMP_PDB_FLOAT, "y_red", "Red amount (y axis, directional)" },
+		{ GIMP_PDB_INT32, "memory_budget", "Memory budget in MiB (0=unlimited)" },
+		{ GIMP_PDB_INT32, "output", "Drawables 0=Replace/1=New layer/2=New image" },
+		{ GIMP_PDB_STRING, "suffix", "Files are saved as NAME+suffix.EXT, \"\" replaces them" }
+	};
+	static GimpParamDef estimate_args[] = {
+		{ GIMP_PDB_INT32, "run_mode", "Non-interactive" },
+		{ GIMP_PDB_IMAGE, "image", "Input image" },
+		{ GIMP_PDB_DRAWABLE, "drawable", "Input drawable" },
+		{ GIMP_PDB_FLOAT, "lens_x", "lens center (x, -1=center)" },
+		{ GIMP_PDB_FLOAT, "lens_y", "lens center (y, -1=center)" },
+		{ GIMP_PDB_INT32, "find_center", "0=Find directional shifts/1=Find lens center instead" }
+	};
+	static GimpParamDef estimate_return_vals[] = {
+		{ GIMP_PDB_FLOAT, "blue", "Blue amount (lateral)" },
+		{ GIMP_PDB_FLOAT, "red", "Red amount (lateral)" },
+		{ GIMP_PDB_FLOAT, "lens_x", "lens center (x, lateral)" },
+		{ GIMP_PDB_FLOAT, "lens_y", "lens center (y, lateral)" },
+		{ GIMP_PDB_FLOAT, "x_blue", "Blue amount (x axis, directional)" },
+		{ GIMP_PDB_FLOAT, "x_red", "Red amount (x axis, directional)" },
+		{ GIMP_PDB_FLOAT, "y_blue", "Blue amount (y axis, directional)" },
 		{ GIMP_PDB_FLOAT, "y_red", "Red amount (y axis, directional)" }
 	};
+	static GimpParamDef batch_return_vals[] = {
+		{ GIMP_PDB_INT32, "num_results", "Number of results" },
+		{ GIMP_PDB_INT32ARRAY, "results", "Drawables holding the results" },
+		{ GIMP_PDB_INT32, "num_skipped", "Drawables outside the selection, left as they were" }
+	};
 
 #ifdef HAVE_GETTEXT
 	/*  Initialize i18n support  */
@@ -182,8 +370,8 @@ static void query (void)
 				_("Chromatic Aberration"),
 				"RGB*",
 				GIMP_PLUGIN,
-				G_N_ELEMENTS (args), 0,
-				args, 0);
+				G_N_ELEMENTS (args) - 3, 0,
+				args, NULL);
 
 #if 0
 	/* Need to decide about menu location */
@@ -192,15 +380,59 @@ static void query (void)
 	else
 #endif
 		gimp_plugin_menu_register (PROCEDURE_NAME, _("<Image>/Filters/Colors"));
+
+	gimp_install_procedure (PROCEDURE_FULL_NAME,
+				FIX_CA_VERSION,
+				_("Fix chromatic aberration as Fix-CA does, "
+				  "with a memory budget, where the result goes "
+				  "and which layers are corrected.  Unlike "
+				  "Fix-CA, it returns the drawable holding the "
+				  "result."),
+				"Kriang Lerdsuwanakij",
+				"Kriang Lerdsuwanakij 2006, 2007",
+				"2024",
+				NULL,
+				"RGB*",
+				GIMP_PLUGIN,
+				G_N_ELEMENTS (args), G_N_ELEMENTS (return_vals),
+				args, return_vals);
+
+	gimp_install_procedure (PROCEDURE_BATCH_NAME,
+				FIX_CA_VERSION,
+				_("Fix chromatic aberration of several drawables "
+				  "and image files with the same settings, in "
+				  "one run of the plug-in."),
+				"Kriang Lerdsuwanakij",
+				"Kriang Lerdsuwanakij 2006, 2007",
+				"2024",
+				NULL,
+				NULL,
+				GIMP_PLUGIN,
+				G_N_ELEMENTS (batch_args), G_N_ELEMENTS (batch_return_vals),
+				batch_args, batch_return_vals);
+
+	gimp_install_procedure (PROCEDURE_ESTIMATE_NAME,
+				FIX_CA_VERSION,
+				_("Estimate the red and blue shifts of a drawable "
+				  "from how far they are off green along strong "
+				  "edges, for Fix-CA."),
+				"Kriang Lerdsuwanakij",
+				"Kriang Lerdsuwanakij 2006, 2007",
+				"2024",
+				NULL,
+				"RGB*",
+				GIMP_PLUGIN,
+				G_N_ELEMENTS (estimate_args), G_N_ELEMENTS (estimate_return_vals),
+				estimate_args, estimate_return_vals);
 }
 
 static void run (const gchar *name, gint nparams,
 		 const GimpParam *param, gint *nreturn_vals,
 		 GimpParam **return_vals)
 {
-	static GimpParam values[1];
+	static GimpParam values[2];
 	GimpDrawable	*drawable;
-	gint32		image_ID;
+	gint32		image_ID, result_ID;
 	GimpRunMode	run_mode;
 	GimpPDBStatusType status;
 	FixCaParams fix_ca_params;
@@ -210,6 +442,15 @@ static void run (const gchar *name, gint nparams,
 	values[0].type = GIMP_PDB_STATUS;
 	status = GIMP_PDB_SUCCESS;
 
+	if (strcmp (name, PROCEDURE_BATCH_NAME) == 0) {
+		run_batch (nparams, param, nreturn_vals, return_vals);
+		return;
+	}
+	if (strcmp (name, PROCEDURE_ESTIMATE_NAME) == 0) {
+		run_estimate (nparams, param, nreturn_vals, return_vals);
+		return;
+	}
+
 	run_mode = param[0].data.d_int32;
 	image_ID = param[1].data.d_int32;
 	drawable = gimp_drawable_get (param[2].data.d_drawable);
@@ -227,9 +468,15 @@ static void run (const gchar *name, gint nparams,
 	fix_ca_params.x_red = fix_ca_params_default.x_red;
 	fix_ca_params.y_blue = fix_ca_params_default.y_blue;
 	fix_ca_params.y_red = fix_ca_params_default.y_red;
-
-	if (param[0].type != GIMP_PDB_INT32 || strcmp(name, PROCEDURE_NAME) != 0 || \
-	    ((run_mode == GIMP_RUN_NONINTERACTIVE) && (nparams < 5 || nparams > 12))) {
+	fix_ca_params.memory_budget = fix_ca_params_default.memory_budget;
+	fix_ca_params.output = fix_ca_params_default.output;
+	fix_ca_params.layers = fix_ca_params_default.layers;
+	fix_ca_params.blue_curve = fix_ca_params_default.blue_curve;
+	fix_ca_params.red_curve = fix_ca_params_default.red_curve;
+
+	if (param[0].type != GIMP_PDB_INT32 || \
+	    (strcmp (name, PROCEDURE_NAME) != 0 && strcmp (name, PROCEDURE_FULL_NAME) != 0) || \
+	    ((run_mode == GIMP_RUN_NONINTERACTIVE) && (nparams < 5 || nparams > 15))) {
 		values[0].data.d_status = GIMP_PDB_CALLING_ERROR;
 		return;
 	}
@@ -276,20 +523,19 @@ static void run (const gchar *name, gint nparams,
 				fix_ca_params.y_red = 0.0;
 			else
 				fix_ca_params.y_red = param[11].data.d_float;
-			if (fix_ca_params.blue < -INPUT_MAX || \
-			    fix_ca_params.blue >  INPUT_MAX || \
-			    fix_ca_params.red  < -INPUT_MAX || \
-			    fix_ca_params.red  >  INPUT_MAX || \
-			    fix_ca_params.interpolation < 0 || \
-			    fix_ca_params.interpolation > 2 || \
-			    fix_ca_params.x_blue < -INPUT_MAX || \
-			    fix_ca_params.x_blue >  INPUT_MAX || \
-			    fix_ca_params.x_red  < -INPUT_MAX || \
-			    fix_ca_params.x_red  >  INPUT_MAX || \
-			    fix_ca_params.y_blue < -INPUT_MAX || \
-			    fix_ca_params.y_blue >  INPUT_MAX || \
-			    fix_ca_params.y_red  < -INPUT_MAX || \
-			    fix_ca_params.y_red  >  INPUT_MAX) {
+			if (nparams < 13)
+				fix_ca_params.memory_budget = 0;
+			else
+				fix_ca_params.memory_budget = param[12].data.d_int32;
+			if (nparams < 14)
+				fix_ca_params.output = FIX_CA_OUTPUT_REPLACE;
+			else
+				fix_ca_params.output = param[13].data.d_int32;
+			if (nparams < 15)
+				fix_ca_params.layers = FIX_CA_LAYERS_ONE;
+			else
+				fix_ca_params.layers = param[14].data.d_int32;
+			if (!params_valid (&fix_ca_params)) {
 				g_message( _("Parameter out of range!") );
 				status = GIMP_PDB_CALLING_ERROR;
 			}
@@ -312,11 +558,23 @@ static void run (const gchar *name, gint nparams,
 	}
 
 	if (status == GIMP_PDB_SUCCESS) {
-		if (fix_ca (drawable->drawable_id, &fix_ca_params)) {
+		if (fix_ca_params.layers == FIX_CA_LAYERS_ONE ? \
+		    fix_ca (drawable->drawable_id, &fix_ca_params, &result_ID) : \
+		    fix_ca_layers (drawable->drawable_id, &fix_ca_params, &result_ID)) {
 			status = GIMP_PDB_CALLING_ERROR;
 		} else {
+			if (run_mode == GIMP_RUN_INTERACTIVE && \
+			    fix_ca_params.output == FIX_CA_OUTPUT_IMAGE)
+				gimp_display_new (gimp_item_get_image (result_ID));
 			gimp_displays_flush ();
 
+			/* Fix-CA returns nothing, as it always has */
+			if (strcmp (name, PROCEDURE_FULL_NAME) == 0) {
+				*nreturn_vals = 2;
+				values[1].type = GIMP_PDB_DRAWABLE;
+				values[1].data.d_drawable = result_ID;
+			}
+
 			if (run_mode == GIMP_RUN_INTERACTIVE)
 				gimp_set_data (DATA_KEY_VALS, &fix_ca_params, sizeof (fix_ca_params));
 
@@ -329,22 +587,354 @@ static void run (const gchar *name, gint nparams,
 	values[0].data.d_status = status;
 }
 
-static int fix_ca (gint32 drawable_ID, FixCaParams *params)
+static void run_batch (gint nparams, const GimpParam *param,
+		       gint *nreturn_vals, GimpParam **return_vals)
+{
+	static GimpParam values[4];
+	static gint32	*results = NULL;
+	GimpPDBStatusType status = GIMP_PDB_SUCCESS;
+	FixCaParams	params = fix_ca_params_default;
+	FixCaParams	item;
+	FixCaShared	shared;
+	const gint32	*drawables;
+	gchar	**files;
+	const gchar	*suffix, *dot;
+	gchar	*out;
+	gint32	image_ID, drawable_ID, result_ID;
+	gint	i, n_drawables, n_files, n_results = 0, ntiles = 0, tiles;
+	gint	n_skipped = 0, x, y, width, height;
+
+	*nreturn_vals = 1;
+	*return_vals  = values;
+	values[0].type = GIMP_PDB_STATUS;
+	values[0].data.d_status = GIMP_PDB_CALLING_ERROR;
+
+	if (nparams != 17 || param[0].data.d_int32 != GIMP_RUN_NONINTERACTIVE)
+		return;
+	n_drawables = param[1].data.d_int32;
+	drawables = param[2].data.d_int32array;
+	n_files = param[3].data.d_int32;
+	files = param[4].data.d_stringarray;
+	params.blue = param[5].data.d_float;
+	params.red = param[6].data.d_float;
+	params.lens_x = param[7].data.d_float;
+	params.lens_y = param[8].data.d_float;
+	params.interpolation = param[9].data.d_int8;
+	params.x_blue = param[10].data.d_float;
+	params.x_red = param[11].data.d_float;
+	params.y_blue = param[12].data.d_float;
+	params.y_red = param[13].data.d_float;
+	params.memory_budget = param[14].data.d_int32;
+	params.output = param[15].data.d_int32;
+	suffix = param[16].data.d_string ? param[16].data.d_string : "";
+
+#ifdef HAVE_GETTEXT
+	/*  Initialize i18n support  */
+	bindtextdomain( GETTEXT_PACKAGE, gimp_locale_directory() );
+#ifdef HAVE_BIND_TEXTDOMAIN_CODESET
+	bind_textdomain_codeset( GETTEXT_PACKAGE, "UTF-8" );
+#endif
+	textdomain( GETTEXT_PACKAGE );
+#endif
+
+	if (n_drawables < 0 || n_files < 0 || !params_valid (&params)) {
+		g_message( _("Parameter out of range!") );
+		return;
+	}
+
+	/* One gegl_init(), tile cache and set of buffers for all items */
+	gegl_init (NULL, NULL);
+	memset (&shared, 0, sizeof (shared));
+	shared.into_image = -1;
+	g_free (results);
+	results = g_new (gint32, n_drawables + 1);
+
+	for (i = 0; status == GIMP_PDB_SUCCESS && i < n_drawables + n_files; i++) {
+		if (i < n_drawables) {
+			image_ID = -1;
+			drawable_ID = drawables[i];
+		} else {
+			image_ID = gimp_file_load (GIMP_RUN_NONINTERACTIVE, \
+						   files[i - n_drawables], \
+						   files[i - n_drawables]);
+			if (image_ID < 0) {
+				status = GIMP_PDB_EXECUTION_ERROR;
+				break;
+			}
+			gimp_image_undo_disable (image_ID);
+			drawable_ID = gimp_image_get_active_drawable (image_ID);
+		}
+		if (!gimp_item_is_drawable (drawable_ID) || \
+		    !gimp_drawable_is_rgb (drawable_ID)) {
+			status = GIMP_PDB_CALLING_ERROR;
+			if (image_ID >= 0)
+				gimp_image_delete (image_ID);
+			break;
+		}
+
+		/* Nothing of it is selected, go on with the rest */
+		if (!gimp_drawable_mask_intersect (drawable_ID, &x, &y, \
+						   &width, &height)) {
+			n_skipped++;
+			if (image_ID >= 0)
+				gimp_image_delete (image_ID);
+			continue;
+		}
+
+		/* Grow the tile cache to the largest item seen */
+		tiles = 2 * MAX (gimp_drawable_width (drawable_ID) / gimp_tile_width () + 1, \
+				 gimp_drawable_height (drawable_ID) / gimp_tile_height () + 1);
+		if (tiles > ntiles) {
+			ntiles = tiles;
+			gimp_tile_cache_ntiles (ntiles);
+		}
+
+		/* Lens center -1 is the middle of each item, as in the dialog.
+		   Files are corrected in place, then saved. */
+		item = params;
+		if (item.lens_x < 0 || item.lens_x >= gimp_drawable_width (drawable_ID))
+			item.lens_x = round (gimp_drawable_width (drawable_ID)/2);
+		if (item.lens_y < 0 || item.lens_y >= gimp_drawable_height (drawable_ID))
+			item.lens_y = round (gimp_drawable_height (drawable_ID)/2);
+		if (image_ID >= 0)
+			item.output = FIX_CA_OUTPUT_REPLACE;
+
+		if (fix_ca_shared (drawable_ID, &item, &result_ID, &shared)) {
+			status = GIMP_PDB_EXECUTION_ERROR;
+		} else if (image_ID < 0) {
+			results[n_results++] = result_ID;
+		} else {
+			const gchar *file = files[i - n_drawables];
+
+			dot = strrchr (file, '.');
+			if (dot == NULL || strchr (dot, G_DIR_SEPARATOR) != NULL)
+				dot = file + strlen (file);
+			out = g_strdup_printf ("%.*s%s%s", (int) (dot - file), \
+					       file, suffix, dot);
+			if (!gimp_file_save (GIMP_RUN_NONINTERACTIVE, image_ID, \
+					     drawable_ID, out, out))
+				status = GIMP_PDB_EXECUTION_ERROR;
+			g_free (out);
+		}
+		if (image_ID >= 0)
+			gimp_image_delete (image_ID);
+	}
+
+	shared_clear (&shared);
+	gimp_displays_flush ();
+	gegl_exit ();
+
+	values[0].data.d_status = status;
+	if (status == GIMP_PDB_SUCCESS) {
+		*nreturn_vals = 4;
+		values[1].type = GIMP_PDB_INT32;
+		values[1].data.d_int32 = n_results;
+		values[2].type = GIMP_PDB_INT32ARRAY;
+		values[2].data.d_int32array = results;
+		values[3].type = GIMP_PDB_INT32;
+		values[3].data.d_int32 = n_skipped;
+	}
+}
+
+static void run_estimate (gint nparams, const GimpParam *param,
+			  gint *nreturn_vals, GimpParam **return_vals)
 {
-	GeglBuffer *srcBuf, *destBuf;
-	guchar     *srcImg, *destImg;
+	static GimpParam values[9];
+	FixCaParams	params = fix_ca_params_default;
+	gint32	drawable_ID;
+	gint	i;
+
+	*nreturn_vals = 1;
+	*return_vals  = values;
+	values[0].type = GIMP_PDB_STATUS;
+	values[0].data.d_status = GIMP_PDB_CALLING_ERROR;
+
+	if (nparams != 6 || param[0].data.d_int32 != GIMP_RUN_NONINTERACTIVE)
+		return;
+	drawable_ID = param[2].data.d_drawable;
+	if (!gimp_item_is_drawable (drawable_ID) || !gimp_drawable_is_rgb (drawable_ID))
+		return;
+	params.lens_x = param[3].data.d_float;
+	params.lens_y = param[4].data.d_float;
+
+	gegl_init (NULL, NULL);
+	if (!estimate (drawable_ID, &params, param[5].data.d_int32 != 0)) {
+		values[0].data.d_status = GIMP_PDB_EXECUTION_ERROR;
+	} else {
+		values[0].data.d_status = GIMP_PDB_SUCCESS;
+		values[1].data.d_float = params.blue;
+		values[2].data.d_float = params.red;
+		values[3].data.d_float = params.lens_x;
+		values[4].data.d_float = params.lens_y;
+		values[5].data.d_float = params.x_blue;
+		values[6].data.d_float = params.x_red;
+		values[7].data.d_float = params.y_blue;
+		values[8].data.d_float = params.y_red;
+		for (i = 1; i < 9; i++)
+			values[i].type = GIMP_PDB_FLOAT;
+		*nreturn_vals = 9;
+	}
+	gegl_exit ();
+}
+
+static gboolean params_valid (FixCaParams *params)
+{
+	return params->blue >= -INPUT_MAX && params->blue <= INPUT_MAX && \
+	       params->red  >= -INPUT_MAX && params->red  <= INPUT_MAX && \
+	       params->interpolation >= 0 && params->interpolation <= 2 && \
+	       params->x_blue >= -INPUT_MAX && params->x_blue <= INPUT_MAX && \
+	       params->x_red  >= -INPUT_MAX && params->x_red  <= INPUT_MAX && \
+	       params->y_blue >= -INPUT_MAX && params->y_blue <= INPUT_MAX && \
+	       params->y_red  >= -INPUT_MAX && params->y_red  <= INPUT_MAX && \
+	       params->memory_budget >= 0 && \
+	       params->output >= FIX_CA_OUTPUT_REPLACE && \
+	       params->output <= FIX_CA_OUTPUT_IMAGE && \
+	       params->layers >= FIX_CA_LAYERS_ONE && \
+	       params->layers <= FIX_CA_LAYERS_LINKED;
+}
+
+/* Shifts of drawable_ID into params, FALSE if too few edges were
+   found.  libgimp is only used here, the edge search is shared out to
+   a pool of threads. */
+static gboolean estimate (gint32 drawable_ID, FixCaParams *params,
+			  gboolean find_center)
+{
+	FixCaEstimate	est;
+	FixCaEstimateRun run;
+	GThreadPool	*pool;
+	guchar	*data, *s;
+	gfloat	*rgb, *d;
+	gint	xImg, yImg, width, height, threads, first;
+	gint	i, j, k, x0, x1, y0, y1, w, h, bpp;
+	gboolean	found;
+
+	xImg = gimp_drawable_width (drawable_ID);
+	yImg = gimp_drawable_height (drawable_ID);
+	width = MIN (xImg, ESTIMATE_SIZE);
+	height = MIN (yImg, ESTIMATE_SIZE);
+	if (xImg > yImg)
+		height = MAX (1, (gint) ((gdouble) yImg * width / xImg));
+	else
+		width = MAX (1, (gint) ((gdouble) xImg * height / yImg));
+	if ((rgb = g_try_new (gfloat, (gsize) width * height * 3)) == NULL)
+		return FALSE;
+
+	/* Gimp scales it down from its own mipmaps, 8 bits per color,
+	   rather than sending every full size tile.  Edges move the same
+	   in every color, so the seams between pieces don't matter. */
+	for (i = 0; i < ESTIMATE_PIECES * ESTIMATE_PIECES; i++) {
+		x0 = width * (i % ESTIMATE_PIECES) / ESTIMATE_PIECES;
+		x1 = width * (i % ESTIMATE_PIECES + 1) / ESTIMATE_PIECES;
+		y0 = height * (i / ESTIMATE_PIECES) / ESTIMATE_PIECES;
+		y1 = height * (i / ESTIMATE_PIECES + 1) / ESTIMATE_PIECES;
+		if (x1 <= x0 || y1 <= y0)
+			continue;
+		w = x1 - x0;
+		h = y1 - y0;
+		data = gimp_drawable_get_sub_thumbnail_data (drawable_ID, \
+			(gint) ((gint64) x0 * xImg / width), \
+			(gint) ((gint64) y0 * yImg / height), \
+			(gint) ((gint64) x1 * xImg / width - (gint64) x0 * xImg / width), \
+			(gint) ((gint64) y1 * yImg / height - (gint64) y0 * yImg / height), \
+			&w, &h, &bpp);
+		if (data == NULL || w != x1 - x0 || h != y1 - y0) {
+			g_free (data);
+			g_free (rgb);
+			return FALSE;
+		}
+		/* Gray, gray alpha, RGB or RGBA, into R'G'B' float */
+		for (j = 0; j < h; j++) {
+			s = data + (gsize) j * w * bpp;
+			d = rgb + ((gsize) (y0 + j) * width + x0) * 3;
+			for (k = 0; k < w; k++, s += bpp, d += 3) {
+				d[0] = s[0] / 255.0f;
+				d[1] = s[bpp >= 3 ? 1 : 0] / 255.0f;
+				d[2] = s[bpp >= 3 ? 2 : 0] / 255.0f;
+			}
+		}
+		g_free (data);
+	}
+
+	if (fix_ca_estimate_init (&est, params, find_center, rgb, width, height, \
+				  xImg, yImg)) {
+		g_free (rgb);
+		return FALSE;
+	}
+	threads = MAX (1, (gint) g_get_num_processors ());
+	run.est = &est;
+	run.chunk = est.n_edges / threads + 1;
+	for (run.pass = 0; run.pass < FIX_CA_ESTIMATE_PASSES; run.pass++) {
+		pool = g_thread_pool_new (estimate_measure, &run, threads, FALSE, NULL);
+		for (first = 0; first < est.n_edges; first += run.chunk)
+			g_thread_pool_push (pool, GINT_TO_POINTER (first + 1), NULL);
+		g_thread_pool_free (pool, FALSE, TRUE);
+		fix_ca_estimate_fit (&est);
+	}
+	found = est.fitted[0] && est.fitted[1];
+	fix_ca_estimate_clear (&est);
+	g_free (rgb);
+	return found;
+}
+
+static void estimate_measure (gpointer data, gpointer user_data)
+{
+	FixCaEstimateRun *run = user_data;
+	gint	first = GPOINTER_TO_INT (data) - 1;
+
+	fix_ca_estimate_measure (run->est, run->pass, first, \
+				 MIN (first + run->chunk, run->est->n_edges));
+}
+
+static int fix_ca (gint32 drawable_ID, FixCaParams *params, gint32 *result_ID)
+{
+	FixCaShared shared;
+	int	ret;
+
+	memset (&shared, 0, sizeof (shared));
+	shared.into_image = -1;
+	ret = fix_ca_shared (drawable_ID, params, result_ID, &shared);
+	shared_clear (&shared);
+	return ret;
+}
+
+static void shared_clear (FixCaShared *shared)
+{
+	if (shared->destImg.data != NULL)
+		buffer_free (&shared->destImg);
+	fix_ca_context_clear (&shared->ctx);
+	memset (shared, 0, sizeof (*shared));
+}
+
+static int fix_ca_shared (gint32 drawable_ID, FixCaParams *params,
+			  gint32 *result_ID, FixCaShared *shared)
+{
+	GeglBuffer *destBuf;
+	FixCaSource source;
 	const Babl *format;
 	gint       x, y, width, height, xImg, yImg, bppImg, bpcImg;
+	gint       tx, ty, tw, th, dx, dy;
+	gsize      dest_size;
+	gboolean   out_of_core;
+	gint       ret = 0;
+	FixCaPlan  plan;
+	FixCaWindow win;
+	FixCaProgress progress;
+	FixCaContext *ctx = &shared->ctx;
+	FixCaBuffer *destImg = &shared->destImg;
+	FixCaStats stats;
+	unsigned char *rows;
+	size_t     rows_size;
+	gboolean   timed = fix_ca_stats_target () != NULL;
+	gdouble    start = 0.0, t = 0.0;
 
 	/* get dimensions */
 	if (!(gimp_drawable_mask_intersect(drawable_ID, &x, &y, &width, &height)))
 		return -1;
 
+	fix_ca_stats_init (&stats);
+	if (timed)
+		start = fix_ca_stats_now ();
 #ifdef DEBUG_TIME
-	double	sec;
-	struct timeval tv1, tv2;
-	gettimeofday(&tv1, NULL);
-
 	printf ("Start fix_ca(), ID=%d x=%d y=%d width=%d height=%d\n", \
 		drawable_ID, x, y, width, height);
 #endif
@@ -357,40 +947,655 @@ static int fix_ca (gint32 drawable_ID, FixCaParams *params)
 		return -1;
 	}
 
-	/* fetch pixel regions and setup shadow buffer */
-	srcBuf  = gimp_drawable_get_buffer (drawable_ID);
-	destBuf = gimp_drawable_get_shadow_buffer (drawable_ID);
-
 	xImg = gimp_drawable_width(drawable_ID);
 	yImg = gimp_drawable_height(drawable_ID);
-	srcImg  = g_new (guchar, xImg * yImg * bppImg);
-	destImg = g_new (guchar, xImg * yImg * bppImg);
 
-	gegl_buffer_get (srcBuf, GEGL_RECTANGLE(x, y, width, height), 1.0, \
-			 format, srcImg, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+	/* Same plan and working buffer as the last item if it matches,
+	   the settings are the same for a whole batch */
+	if (destImg->data != NULL && shared->xImg == xImg && \
+	    shared->yImg == yImg && shared->bppImg == bppImg && \
+	    shared->x == x && shared->y == y && shared->width == width && \
+	    shared->height == height && \
+	    shared->memory_budget == params->memory_budget) {
+		plan = shared->plan;
+	} else {
+		fix_ca_plan (&plan, params, xImg, yImg, bppImg, x, y, width, height);
+		if (destImg->data != NULL)
+			buffer_free (destImg);
+		shared->plan = plan;
+		shared->xImg = xImg;
+		shared->yImg = yImg;
+		shared->bppImg = bppImg;
+		shared->x = x;
+		shared->y = y;
+		shared->width = width;
+		shared->height = height;
+		shared->memory_budget = params->memory_budget;
+	}
+
+	/* Keep GEGL's own tile cache within what is left of the budget */
+	if (params->memory_budget > 0) {
+		guint64 budget = (guint64) params->memory_budget << 20;
+		if (budget > 2 * plan.peak)
+			budget -= plan.peak;
+		else
+			budget /= 2;
+		g_object_set (gegl_config (), "tile-cache-size", budget, NULL);
+	}
 
-	/* adjust pixel regions from srcImg to destImg, according to params */
-	fix_ca_region (srcImg, destImg, xImg, yImg, bppImg, bpcImg, params, \
-		       x, (x + width), y, (y + height), TRUE);
+	/* Working buffers larger than free memory are backed by temporary
+	   files rather than pushing the rest of the system into swap */
+	if (destImg->data == NULL) {
+		dest_size = (gsize) plan.tile_width * plan.tile_height * bppImg;
+		out_of_core = dest_size > available_memory ();
+		if (!buffer_new (destImg, dest_size, out_of_core))
+			return -1;
+		stats.alloc_bytes += (gint64) dest_size;
+	}
+	stats.plan = plan.type == FIX_CA_PLAN_RESIDENT ? "resident" : \
+		     plan.type == FIX_CA_PLAN_BANDS ? "bands" : "columns";
+	stats.tile_width = plan.tile_width;
+	stats.tile_height = plan.tile_height;
+	stats.plan_peak = (gint64) plan.peak;
+
+	/* Source rows are read from the drawable's own tiles into the row
+	   cache as needed, in its own format, so no copy of the source is
+	   made.  A new layer is written directly, skipping shadow and undo. */
+	source.buffer = gimp_drawable_get_buffer (drawable_ID);
+	source.format = format;
+	if (params->output == FIX_CA_OUTPUT_REPLACE) {
+		*result_ID = drawable_ID;
+		destBuf = gimp_drawable_get_shadow_buffer (drawable_ID);
+		dx = 0;
+		dy = 0;
+	} else {
+		*result_ID = new_layer (drawable_ID, params->output, \
+					shared->into_image, shared->position, \
+					x, y, width, height);
+		destBuf = gimp_drawable_get_buffer (*result_ID);
+		dx = x;
+		dy = y;
+	}
 
-	gegl_buffer_set (destBuf, GEGL_RECTANGLE(x, y, width, height), 0, \
-			 format, destImg, GEGL_AUTO_ROWSTRIDE);
+	progress.done = 0;
+	progress.total = (gint64) width * height;
+	progress.update = progress_update;
+	progress.cancelled = NULL;
+	gimp_progress_init (_("Shifting pixel components..."));
+
+	/* The row cache is reused by every tile, and every item */
+	rows = ctx->rows;
+	rows_size = ctx->rows_size;
+	fix_ca_context_init (ctx, params, xImg, yImg, bppImg, bpcImg);
+	ctx->rows = rows;
+	ctx->rows_size = rows_size;
+	ctx->progress = &progress;
+	ctx->stats = timed ? &stats : NULL;
+
+	for (ty = y; ret == 0 && ty < y + height; ty += plan.tile_height) {
+		th = MIN (plan.tile_height, y + height - ty);
+		for (tx = x; ret == 0 && tx < x + width; tx += plan.tile_width) {
+			tw = MIN (plan.tile_width, x + width - tx);
+
+			/* source pixels needed to produce this tile */
+			fix_ca_source_rect (params, xImg, yImg, tx, (tx + tw), \
+					    ty, (ty + th), &win);
+			win.data = NULL;
+			win.fetch_row = fetch_row;
+			win.user_data = &source;
+
+			/* adjust pixel regions into destImg, according to params */
+			if (fix_ca_run (ctx, &win, destImg->data, tx, (tx + tw), \
+					ty, (ty + th))) {
+				g_message (_("Not enough memory!"));
+				ret = -1;
+				break;
+			}
+
+			if (timed)
+				t = fix_ca_stats_now ();
+			gegl_buffer_set (destBuf, GEGL_RECTANGLE((tx - dx), \
+					 (ty - dy), tw, th), 0, format, \
+					 destImg->data, GEGL_AUTO_ROWSTRIDE);
+			if (timed)
+				stats.seconds[FIX_CA_PHASE_WRITE] += fix_ca_stats_now () - t;
+		}
+	}
+	gimp_progress_update (0.0);
 
-	g_free (destImg);
-	g_free (srcImg);
 	g_object_unref (destBuf);
-	g_object_unref (srcBuf);
+	g_object_unref (source.buffer);
 
-	gimp_drawable_merge_shadow (drawable_ID, TRUE);
-	gimp_drawable_update (drawable_ID, x, y, width, height);
+	if (ret != 0) {
+		/* Only this layer if earlier ones share its image */
+		if (shared->into_image >= 0)
+			gimp_image_remove_layer (shared->into_image, *result_ID);
+		else
+			discard_result (*result_ID, params->output);
+		return ret;
+	}
 
-#ifdef DEBUG_TIME
-	gettimeofday(&tv2, NULL);
+	if (params->output == FIX_CA_OUTPUT_REPLACE) {
+		if (timed)
+			t = fix_ca_stats_now ();
+		gimp_drawable_merge_shadow (drawable_ID, TRUE);
+		if (timed)
+			stats.seconds[FIX_CA_PHASE_MERGE_SHADOW] += fix_ca_stats_now () - t;
+		gimp_drawable_update (drawable_ID, x, y, width, height);
+	} else {
+		gimp_drawable_update (*result_ID, 0, 0, width, height);
+	}
+	ctx->stats = NULL;
+	if (timed)
+		fix_ca_stats_emit ("fix-ca", &stats, fix_ca_stats_now () - start);
+	return 0;
+}
+
+/* Correct all layers the size of drawable_ID, or those linked to it,
+   with the same settings.  libgimp is not thread safe, so layers are
+   read and written here, while a pool of workers corrects them. */
+static int fix_ca_layers (gint32 drawable_ID, FixCaParams *params,
+			  gint32 *result_ID)
+{
+	FixCaLayersRun run;
+	FixCaLayerJob *jobs, *job;
+	FixCaShared shared;
+	FixCaPlan plan;
+	FixCaWindow win;
+	GThreadPool *pool;
+	GeglBuffer *buffer;
+	const Babl *format;
+	gint32	*layers, *todo, image_ID = -1, layer_ID;
+	gint	i, n_layers, count = 0, next, submitted = 0, finished = 0;
+	gint	x, y, width, height;
+	gint	threads, in_flight = 0, max_jobs, ret = 0;
+	gsize	job_size;
+	gint64	pixels = 0, start;
+	gchar	*text;
+	FixCaStats stats;
+	gdouble	t = 0.0, seconds = 0.0;
+
+	format = gimp_drawable_get_format (drawable_ID);
+	fix_ca_stats_init (&stats);
+	run.timed = fix_ca_stats_target () != NULL;
+	if (run.timed)
+		seconds = fix_ca_stats_now ();
+	run.params = params;
+	run.xImg = gimp_drawable_width (drawable_ID);
+	run.yImg = gimp_drawable_height (drawable_ID);
+	run.bppImg = babl_format_get_bytes_per_pixel (format);
+	run.bpcImg = color_size (format);
+	if (run.bpcImg <= -99) {
+		g_message( _("Invalid color type!") );
+		return -1;
+	}
+
+	/* Layers the same size and format share one remap and settings */
+	layers = gimp_image_get_layers (gimp_item_get_image (drawable_ID), &n_layers);
+	todo = g_new (gint32, n_layers + 1);
+	todo[count++] = drawable_ID;
+	for (i = 0; i < n_layers; i++) {
+		if (layers[i] == drawable_ID || gimp_item_is_group (layers[i]) || \
+		    gimp_drawable_width (layers[i]) != run.xImg || \
+		    gimp_drawable_height (layers[i]) != run.yImg || \
+		    gimp_drawable_get_format (layers[i]) != format)
+			continue;
+		if (params->layers == FIX_CA_LAYERS_LINKED && \
+		    !gimp_item_get_linked (layers[i]))
+			continue;
+		todo[count++] = layers[i];
+	}
+	g_free (layers);
+
+	/* A job holds a layer's source window in memory, as well as what
+	   fix_ca() would use for it.  If one job alone does not fit the
+	   budget or free memory, the layers are done one at a time the
+	   way fix_ca() does, in bands and with buffers in files. */
+	fix_ca_plan (&plan, params, run.xImg, run.yImg, run.bppImg, \
+		     0, 0, run.xImg, run.yImg);
+	fix_ca_source_rect (params, run.xImg, run.yImg, 0, run.xImg, \
+			    0, run.yImg, &win);
+	job_size = plan.peak + (gsize) win.width * win.height * run.bppImg;
+	jobs = g_new0 (FixCaLayerJob, count);
+	if (plan.type != FIX_CA_PLAN_RESIDENT || job_size > available_memory () || \
+	    (params->memory_budget > 0 && \
+	     job_size > ((gsize) params->memory_budget << 20))) {
+		memset (&shared, 0, sizeof (shared));
+		shared.into_image = -1;
+		*result_ID = -1;
+		if (params->output == FIX_CA_OUTPUT_REPLACE)
+			gimp_image_undo_group_start (gimp_item_get_image (drawable_ID));
+		for (i = 0; i < count; i++) {
+			if (!gimp_drawable_mask_intersect (todo[i], &x, &y, \
+							   &width, &height))
+				continue;
+			if ((ret = fix_ca_shared (todo[i], params, &layer_ID, &shared)))
+				break;
+			jobs[i].result_ID = layer_ID;
+			if (todo[i] == drawable_ID)
+				*result_ID = layer_ID;
+			if (params->output == FIX_CA_OUTPUT_IMAGE && shared.into_image < 0)
+				shared.into_image = gimp_item_get_image (layer_ID);
+			shared.position++;
+		}
+		if (params->output == FIX_CA_OUTPUT_REPLACE)
+			gimp_image_undo_group_end (gimp_item_get_image (drawable_ID));
+		shared_clear (&shared);
+		if (ret != 0)
+			discard_results (jobs, count, params->output, result_ID);
+		g_free (jobs);
+		g_free (todo);
+		if (ret == 0 && *result_ID < 0)
+			ret = -1;
+		return ret;
+	}
+
+	if (fix_ca_remap_init (&run.remap, params, run.xImg, run.yImg)) {
+		g_message (_("Not enough memory!"));
+		g_free (jobs);
+		g_free (todo);
+		return -1;
+	}
+
+	/* Keep as many jobs in flight as the budget and free memory
+	   allow, enough to keep workers busy.  One always fits, it was
+	   checked above, but free memory may have gone down since. */
+	threads = MAX (1, (gint) g_get_num_processors ());
+	max_jobs = MIN (threads + 1, (gint) MIN (available_memory () / job_size, \
+						 (gsize) G_MAXINT));
+	if (params->memory_budget > 0)
+		max_jobs = MIN (max_jobs, \
+				(gint) (((gsize) params->memory_budget << 20) / job_size));
+	max_jobs = MAX (1, max_jobs);
+	stats.plan = "layers";
+	stats.tile_width = run.xImg;
+	stats.tile_height = run.yImg;
+	stats.plan_peak = (gint64) job_size * max_jobs;
+
+	run.done = g_async_queue_new ();
+	pool = g_thread_pool_new (layer_render, &run, threads, FALSE, NULL);
+
+	if (params->output == FIX_CA_OUTPUT_REPLACE)
+		gimp_image_undo_group_start (gimp_item_get_image (drawable_ID));
+	gimp_progress_init (_("Shifting pixel components..."));
+	start = g_get_monotonic_time ();
+	*result_ID = -1;
+
+	for (next = 0; finished < submitted || (ret == 0 && next < count); ) {
+		if (ret == 0 && next < count && in_flight < max_jobs) {
+			job = &jobs[next++];
+			job->drawable_ID = todo[next - 1];
+			if (!gimp_drawable_mask_intersect (job->drawable_ID, &job->x, \
+							   &job->y, &job->width, \
+							   &job->height))
+				continue;
+
+			fix_ca_source_rect (params, run.xImg, run.yImg, job->x, \
+					    job->x + job->width, job->y, \
+					    job->y + job->height, &job->win);
+			job->win.fetch_row = NULL;
+			job->win.data = g_try_malloc ((gsize) job->win.width * \
+						      job->win.height * run.bppImg);
+			job->dest = g_try_malloc ((gsize) job->width * \
+						  job->height * run.bppImg);
+			if (job->win.data == NULL || job->dest == NULL) {
+				g_free (job->win.data);
+				g_free (job->dest);
+				g_message (_("Not enough memory!"));
+				ret = -1;
+				continue;
+			}
+			stats.alloc_bytes += ((gint64) job->win.width * job->win.height + \
+					      (gint64) job->width * job->height) * run.bppImg;
+			if (run.timed)
+				t = fix_ca_stats_now ();
+			buffer = gimp_drawable_get_buffer (job->drawable_ID);
+			gegl_buffer_get (buffer, GEGL_RECTANGLE(job->win.x, job->win.y, \
+					 job->win.width, job->win.height), 1.0, format, \
+					 job->win.data, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+			g_object_unref (buffer);
+			if (run.timed)
+				stats.seconds[FIX_CA_PHASE_FETCH] += fix_ca_stats_now () - t;
+
+			/* Result layers are made in order, to keep the stack */
+			if (params->output == FIX_CA_OUTPUT_REPLACE) {
+				job->result_ID = job->drawable_ID;
+			} else {
+				job->result_ID = new_layer (job->drawable_ID, \
+							    params->output, image_ID, \
+							    submitted, job->x, job->y, \
+							    job->width, job->height);
+				if (params->output == FIX_CA_OUTPUT_IMAGE && image_ID < 0)
+					image_ID = gimp_item_get_image (job->result_ID);
+			}
+			if (job->drawable_ID == drawable_ID)
+				*result_ID = job->result_ID;
+
+			g_thread_pool_push (pool, job, NULL);
+			submitted++;
+			in_flight++;
+			continue;
+		}
+
+		job = g_async_queue_pop (run.done);
+		in_flight--;
+		finished++;
+		g_free (job->win.data);
+		fix_ca_stats_add (&stats, &job->stats);
+		/* Counters are per thread, so each layer is reported too */
+		if (job->stats.count_hw)
+			fix_ca_stats_emit ("fix-ca-layer", &job->stats, job->seconds);
+		if (run.timed)
+			t = fix_ca_stats_now ();
+		if (job->ret != 0) {
+			if (ret == 0)
+				g_message (_("Not enough memory!"));
+			ret = -1;
+		} else if (ret == 0) {
+			if (params->output == FIX_CA_OUTPUT_REPLACE) {
+				buffer = gimp_drawable_get_shadow_buffer (job->drawable_ID);
+				gegl_buffer_set (buffer, GEGL_RECTANGLE(job->x, job->y, \
+						 job->width, job->height), 0, format, \
+						 job->dest, GEGL_AUTO_ROWSTRIDE);
+				g_object_unref (buffer);
+				if (run.timed) {
+					stats.seconds[FIX_CA_PHASE_WRITE] += fix_ca_stats_now () - t;
+					t = fix_ca_stats_now ();
+				}
+				gimp_drawable_merge_shadow (job->drawable_ID, TRUE);
+				if (run.timed)
+					stats.seconds[FIX_CA_PHASE_MERGE_SHADOW] += \
+						fix_ca_stats_now () - t;
+				gimp_drawable_update (job->drawable_ID, job->x, job->y, \
+						      job->width, job->height);
+			} else {
+				buffer = gimp_drawable_get_buffer (job->result_ID);
+				gegl_buffer_set (buffer, GEGL_RECTANGLE(0, 0, \
+						 job->width, job->height), 0, format, \
+						 job->dest, GEGL_AUTO_ROWSTRIDE);
+				g_object_unref (buffer);
+				if (run.timed)
+					stats.seconds[FIX_CA_PHASE_WRITE] += fix_ca_stats_now () - t;
+				gimp_drawable_update (job->result_ID, 0, 0, \
+						      job->width, job->height);
+			}
+		}
+		g_free (job->dest);
+
+		/* Throughput over all layers so far */
+		pixels += (gint64) job->width * job->height;
+		text = g_strdup_printf (_("Layer %d of %d, %.1f Mpixels/s"), \
+					finished, count, (double) pixels / \
+					MAX (1, g_get_monotonic_time () - start));
+		gimp_progress_set_text (text);
+		g_free (text);
+		gimp_progress_update ((gdouble) finished / count);
+	}
+	gimp_progress_update (0.0);
+
+	if (params->output == FIX_CA_OUTPUT_REPLACE)
+		gimp_image_undo_group_end (gimp_item_get_image (drawable_ID));
+	g_thread_pool_free (pool, FALSE, TRUE);
+	g_async_queue_unref (run.done);
+	fix_ca_remap_clear (&run.remap);
+	if (ret != 0)
+		discard_results (jobs, count, params->output, result_ID);
+	g_free (jobs);
+	g_free (todo);
+	/* Phases of the workers add up over all threads */
+	if (run.timed)
+		fix_ca_stats_emit ("fix-ca-layers", &stats, fix_ca_stats_now () - seconds);
+
+	/* The drawable itself may be outside the selection */
+	if (ret == 0 && *result_ID < 0)
+		ret = -1;
+	return ret;
+}
+
+static void layer_render (gpointer data, gpointer user_data)
+{
+	FixCaLayerJob *job = data;
+	FixCaLayersRun *run = user_data;
+	FixCaContext ctx;
+
+	fix_ca_context_init (&ctx, run->params, run->xImg, run->yImg, \
+			     run->bppImg, run->bpcImg);
+	ctx.remap = &run->remap;
+	if (run->timed) {
+		fix_ca_stats_init (&job->stats);
+		ctx.stats = &job->stats;
+		job->seconds = fix_ca_stats_now ();
+	}
+	job->ret = fix_ca_run (&ctx, &job->win, job->dest, job->x, \
+			       job->x + job->width, job->y, job->y + job->height);
+	if (run->timed)
+		job->seconds = fix_ca_stats_now () - job->seconds;
+	fix_ca_context_clear (&ctx);
+	g_async_queue_push (run->done, job);
+}
+
+/* A new image is made unless into_image is one made by an earlier
+   call, the layer then goes at position in its stack */
+static gint32 new_layer (gint32 drawable_ID, FixCaOutput output,
+			 gint32 into_image, gint position,
+			 gint x, gint y, gint width, gint height)
+{
+	GimpColorProfile *profile;
+	gint32	image_ID, layer_ID;
+	gint	off_x, off_y;
+	gchar	*name, *layer_name;
+
+	image_ID = gimp_item_get_image (drawable_ID);
+	gimp_drawable_offsets (drawable_ID, &off_x, &off_y);
+	name = gimp_item_get_name (drawable_ID);
+	layer_name = g_strdup_printf (_("%s (CA fixed)"), name);
+	g_free (name);
+
+	if (output == FIX_CA_OUTPUT_IMAGE && into_image >= 0) {
+		layer_ID = gimp_layer_new (into_image, layer_name, width, height, \
+					   gimp_drawable_type (drawable_ID), \
+					   100.0, GIMP_LAYER_MODE_NORMAL);
+		gimp_image_insert_layer (into_image, layer_ID, 0, position);
+	} else if (output == FIX_CA_OUTPUT_IMAGE) {
+		/* Selection sized image, same precision and colors */
+		profile = gimp_image_get_color_profile (image_ID);
+		image_ID = gimp_image_new_with_precision (width, height, GIMP_RGB, \
+				gimp_image_get_precision (image_ID));
+		gimp_image_undo_disable (image_ID);
+		if (profile) {
+			gimp_image_set_color_profile (image_ID, profile);
+			g_object_unref (profile);
+		}
+		layer_ID = gimp_layer_new (image_ID, layer_name, width, height, \
+					   gimp_drawable_type (drawable_ID), \
+					   100.0, GIMP_LAYER_MODE_NORMAL);
+		gimp_image_insert_layer (image_ID, layer_ID, 0, 0);
+		gimp_image_undo_enable (image_ID);
+	} else {
+		/* Selection sized layer, just above the drawable */
+		layer_ID = gimp_layer_new (image_ID, layer_name, width, height, \
+					   gimp_drawable_type (drawable_ID), \
+					   100.0, GIMP_LAYER_MODE_NORMAL);
+		gimp_layer_set_offsets (layer_ID, off_x + x, off_y + y);
+		gimp_image_insert_layer (image_ID, layer_ID, \
+					 gimp_item_get_parent (drawable_ID), \
+					 gimp_image_get_item_position (image_ID, \
+								       drawable_ID));
+	}
+	g_free (layer_name);
+
+	return layer_ID;
+}
+
+/* Undo new_layer() after a failed run, the new image goes with it */
+static void discard_result (gint32 layer_ID, FixCaOutput output)
+{
+	if (output == FIX_CA_OUTPUT_IMAGE)
+		gimp_image_delete (gimp_item_get_image (layer_ID));
+	else if (output == FIX_CA_OUTPUT_LAYER)
+		gimp_image_remove_layer (gimp_item_get_image (layer_ID), layer_ID);
+}
+
+/* The same for every layer fix_ca_layers() made, they all went into
+   one new image, or each next to its own layer */
+static void discard_results (FixCaLayerJob *jobs, gint n, FixCaOutput output,
+			     gint32 *result_ID)
+{
+	gint	i;
+
+	if (output == FIX_CA_OUTPUT_REPLACE)
+		return;
+	for (i = 0; i < n; i++) {
+		if (jobs[i].result_ID <= 0)
+			continue;
+		discard_result (jobs[i].result_ID, output);
+		if (output == FIX_CA_OUTPUT_IMAGE)
+			break;
+	}
+	*result_ID = -1;
+}
 
-	sec = tv2.tv_sec - tv1.tv_sec + (tv2.tv_usec - tv1.tv_usec)/1000000.0;
-	printf("End fix-ca(), Elapsed time: %.2f\n", sec);
+static void fix_ca_plan (FixCaPlan *plan, FixCaParams *params,
+			 gint orig_width, gint orig_height, gint bytes,
+			 gint x, gint y, gint width, gint height)
+{
+	gsize	budget;
+	gint	rows;
+
+	/* Everything at once, unless this does not fit the budget */
+	plan->type = FIX_CA_PLAN_RESIDENT;
+	plan->tile_width = width;
+	plan->tile_height = height;
+	plan->peak = plan_peak (params, orig_width, orig_height, bytes, \
+				x, y, width, height, width, height);
+	if (params->memory_budget <= 0)
+		return;
+	budget = (gsize) params->memory_budget << 20;
+
+	/* Stream full width bands, each band reads as many rows as its
+	   row cache holds, so don't go thinner than that */
+	rows = fix_ca_source_rows (params, orig_width, orig_height, y, y + height);
+	plan->type = FIX_CA_PLAN_BANDS;
+	while (plan->peak > budget && plan->tile_height > rows) {
+		plan->tile_height = (plan->tile_height + 1) / 2;
+		plan->peak = plan_peak (params, orig_width, orig_height, bytes, \
+					x, y, width, height, plan->tile_width, \
+					plan->tile_height);
+	}
+	if (plan->peak <= budget) {
+		if (plan->tile_height == height)
+			plan->type = FIX_CA_PLAN_RESIDENT;
+		return;
+	}
+
+	/* Rows are too wide, also split each band into columns */
+	plan->type = FIX_CA_PLAN_COLUMNS;
+	while (plan->peak > budget && plan->tile_width > 2 * rows) {
+		plan->tile_width = (plan->tile_width + 1) / 2;
+		plan->peak = plan_peak (params, orig_width, orig_height, bytes, \
+					x, y, width, height, plan->tile_width, \
+					plan->tile_height);
+	}
+}
+
+static gsize plan_peak (FixCaParams *params, gint orig_width, gint orig_height,
+			gint bytes, gint x, gint y, gint width, gint height,
+			gint tile_width, gint tile_height)
+{
+	FixCaWindow win;
+	gint	tx, ty;
+	gsize	size, cache = 0;
+
+	/* Widest row cache needed by any one tile.  Source rows come
+	   straight from the drawable, no source window is kept. */
+	for (ty = y; ty < y + height; ty += tile_height) {
+		for (tx = x; tx < x + width; tx += tile_width) {
+			fix_ca_source_rect (params, orig_width, orig_height, tx, \
+				     MIN (tx + tile_width, x + width), ty, \
+				     MIN (ty + tile_height, y + height), &win);
+			size = (gsize) fix_ca_source_rows (params, orig_width, \
+					orig_height, ty, MIN (ty + tile_height, \
+					y + height)) * win.width * bytes;
+			if (size > cache)
+				cache = size;
+		}
+	}
+
+	/* destination tile, row cache and one output row */
+	return (gsize) tile_width * tile_height * bytes + \
+	       cache + (gsize) tile_width * bytes;
+}
+
+static gboolean buffer_new (FixCaBuffer *buf, gsize size, gboolean out_of_core)
+{
+	buf->size = size;
+	buf->mapped = FALSE;
+#ifdef FIX_CA_MMAP
+	if (out_of_core) {
+		gchar	*path;
+		gint	fd;
+
+		/* The file is unlinked at once, it goes away with the mapping */
+		fd = g_file_open_tmp ("fix-ca-XXXXXX", &path, NULL);
+		if (fd >= 0) {
+			g_unlink (path);
+			g_free (path);
+			if (ftruncate (fd, (off_t) size) == 0) {
+				buf->data = mmap (NULL, size, PROT_READ | PROT_WRITE, \
+						  MAP_SHARED, fd, 0);
+				if (buf->data != MAP_FAILED)
+					buf->mapped = TRUE;
+			}
+			close (fd);
+			if (buf->mapped)
+				return TRUE;
+		}
+	}
 #endif
-	return 0;
+	buf->data = g_try_malloc (size);
+	if (buf->data == NULL) {
+		g_message (_("Not enough memory!"));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* Empty again, buffer_new() is needed before the next use */
+static void buffer_free (FixCaBuffer *buf)
+{
+#ifdef FIX_CA_MMAP
+	if (buf->mapped)
+		munmap (buf->data, buf->size);
+	else
+		g_free (buf->data);
+#else
+	g_free (buf->data);
+#endif
+	buf->data = NULL;
+	buf->size = 0;
+	buf->mapped = FALSE;
+}
+
+static gsize available_memory (void)
+{
+#if defined(FIX_CA_MMAP) && defined(_SC_AVPHYS_PAGES) && defined(_SC_PAGESIZE)
+	long	pages, page_size;
+
+	pages = sysconf (_SC_AVPHYS_PAGES);
+	page_size = sysconf (_SC_PAGESIZE);
+	if (pages > 0 && page_size > 0)
+		return (gsize) pages * (gsize) page_size;
+#endif
+	return G_MAXSIZE;	/* unknown, keep everything in memory */
+}
+
+static void fetch_row (void *user_data, gint x, gint y, gint width,
+		       guchar *row)
+{
+	FixCaSource *source = user_data;
+
+	gegl_buffer_get (source->buffer, GEGL_RECTANGLE(x, y, width, 1), 1.0, \
+			 source->format, row, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
 }
 
 static gboolean fix_ca_dialog (gint32 drawable_ID, FixCaParams *params)
@@ -398,9 +1603,11 @@ static gboolean fix_ca_dialog (gint32 drawable_ID, FixCaParams *params)
 	GtkWidget *dialog;
 	GtkWidget *main_vbox;
 	GtkWidget *combo;
-	GtkWidget *preview; /* GimpDrawablePreview widget */
+	GtkWidget *preview; /* GimpZoomPreview widget */
 	GtkWidget *table;
 	GtkWidget *frame;
+	GtkWidget *button;
+	GtkWidget *hbox;
 	GtkObject *adj;
 	gboolean  run;
 	gint      xImg, yImg;
@@ -421,7 +1628,7 @@ static gboolean fix_ca_dialog (gint32 drawable_ID, FixCaParams *params)
 	gtk_container_add (GTK_CONTAINER (GTK_DIALOG (dialog)->vbox), main_vbox);
 	gtk_widget_show (main_vbox);
 
-	preview = gimp_drawable_preview_new_from_drawable_id (drawable_ID);
+	preview = gimp_zoom_preview_new_from_drawable_id (drawable_ID);
 	xImg = gimp_drawable_width(drawable_ID);
 	yImg = gimp_drawable_height(drawable_ID);
 	if (params->lens_x <= 0 || params->lens_x >= xImg) params->lens_x = round (xImg/2);
@@ -430,11 +1637,29 @@ static gboolean fix_ca_dialog (gint32 drawable_ID, FixCaParams *params)
 	gtk_box_pack_start (GTK_BOX (main_vbox), preview, TRUE, TRUE, 0);
 	gtk_widget_show (preview);
 
+	/* One worker, queued renders that are already stale are skipped */
+	preview_pool = g_thread_pool_new (preview_render, NULL, 1, FALSE, NULL);
+
 	g_signal_connect (preview, "invalidated",
-			  G_CALLBACK (preview_update),
-			  params);
+			  G_CALLBACK (preview_schedule),
+			  NULL);
+	g_object_set_data (G_OBJECT (preview), "fix-ca-params", params);
+
+	/* Sets the sliders below, which are added to it as they are made */
+	hbox = gtk_hbox_new (FALSE, 6);
+	gtk_box_pack_start (GTK_BOX (main_vbox), hbox, FALSE, FALSE, 0);
+	gtk_widget_show (hbox);
+
+	button = gtk_button_new_with_mnemonic (_("_Estimate shifts"));
+	gtk_box_pack_start (GTK_BOX (hbox), button, FALSE, FALSE, 0);
+	gtk_widget_show (button);
+	g_object_set_data (G_OBJECT (button), "drawable", \
+			   GINT_TO_POINTER (drawable_ID));
+	g_signal_connect (button, "clicked",
+			  G_CALLBACK (estimate_clicked),
+			  preview);
 
-	table = gtk_table_new (2, 2, FALSE);
+	table = gtk_table_new (4, 2, FALSE);
 	gtk_table_set_col_spacings (GTK_TABLE (table), 6);
 	gtk_table_set_row_spacings (GTK_TABLE (table), 6);
 	gtk_box_pack_start (GTK_BOX (main_vbox), table, FALSE, FALSE, 0);
@@ -450,7 +1675,7 @@ static gboolean fix_ca_dialog (gint32 drawable_ID, FixCaParams *params)
 			  G_CALLBACK (gimp_double_adjustment_update),
 			  &(params->saturation));
 	g_signal_connect_swapped (adj, "value_changed",
-			  G_CALLBACK (gimp_preview_invalidate),
+			  G_CALLBACK (preview_schedule),
 			  preview);
 
 	combo = gimp_int_combo_box_new (_("None (Fastest)"),	GIMP_INTERPOLATION_NONE,
@@ -466,9 +1691,34 @@ static gboolean fix_ca_dialog (gint32 drawable_ID, FixCaParams *params)
 				   _("_Interpolation:"), 0.0, 0.5,
 				   combo, 2, FALSE);
 	g_signal_connect_swapped (combo, "changed",
-				  G_CALLBACK (gimp_preview_invalidate),
+				  G_CALLBACK (preview_schedule),
 				  preview);
 
+	combo = gimp_int_combo_box_new (_("Replace layer"),	FIX_CA_OUTPUT_REPLACE,
+					_("New layer"),		FIX_CA_OUTPUT_LAYER,
+					_("New image"),		FIX_CA_OUTPUT_IMAGE,
+					NULL);
+
+	gimp_int_combo_box_connect (GIMP_INT_COMBO_BOX (combo),
+				    params->output,
+				    G_CALLBACK (gimp_int_combo_box_get_active),
+				    &params->output);
+	gimp_table_attach_aligned (GTK_TABLE (table), 0, 2,
+				   _("_Output:"), 0.0, 0.5,
+				   combo, 2, FALSE);
+
+	combo = gimp_int_combo_box_new (_("This layer"),	FIX_CA_LAYERS_ONE,
+					_("All layers this size"), FIX_CA_LAYERS_ALL,
+					_("Linked layers"),	FIX_CA_LAYERS_LINKED,
+					NULL);
+
+	gimp_int_combo_box_connect (GIMP_INT_COMBO_BOX (combo),
+				    params->layers,
+				    G_CALLBACK (gimp_int_combo_box_get_active),
+				    &params->layers);
+	gimp_table_attach_aligned (GTK_TABLE (table), 0, 3,
+				   _("_Layers:"), 0.0, 0.5,
+				   combo, 2, FALSE);
 
 	frame = gimp_frame_new (_("Lateral"));
 	gtk_box_pack_start (GTK_BOX (main_vbox), frame, FALSE, FALSE, 0);
@@ -489,8 +1739,9 @@ static gboolean fix_ca_dialog (gint32 drawable_ID, FixCaParams *params)
 	g_signal_connect (adj, "value_changed",
 			  G_CALLBACK (gimp_double_adjustment_update),
 			  &(params->blue));
+	g_object_set_data (G_OBJECT (button), "blue", adj);
 	g_signal_connect_swapped (adj, "value_changed",
-			  G_CALLBACK (gimp_preview_invalidate),
+			  G_CALLBACK (preview_schedule),
 			  preview);
 
 	adj = gimp_scale_entry_new (GTK_TABLE (table), 0, 1,
@@ -502,8 +1753,9 @@ static gboolean fix_ca_dialog (gint32 drawable_ID, FixCaParams *params)
 	g_signal_connect (adj, "value_changed",
 			  G_CALLBACK (gimp_double_adjustment_update),
 			  &(params->red));
+	g_object_set_data (G_OBJECT (button), "red", adj);
 	g_signal_connect_swapped (adj, "value_changed",
-			  G_CALLBACK (gimp_preview_invalidate),
+			  G_CALLBACK (preview_schedule),
 			  preview);
 
 	adj = gimp_scale_entry_new (GTK_TABLE (table), 0, 2,
@@ -516,7 +1768,7 @@ static gboolean fix_ca_dialog (gint32 drawable_ID, FixCaParams *params)
 			  G_CALLBACK (gimp_double_adjustment_update),
 			  &(params->lens_x));
 	g_signal_connect_swapped (adj, "value_changed",
-			  G_CALLBACK (gimp_preview_invalidate),
+			  G_CALLBACK (preview_schedule),
 			  preview);
 
 	adj = gimp_scale_entry_new (GTK_TABLE (table), 0, 3,
@@ -529,7 +1781,7 @@ static gboolean fix_ca_dialog (gint32 drawable_ID, FixCaParams *params)
 			  G_CALLBACK (gimp_double_adjustment_update),
 			  &(params->lens_y));
 	g_signal_connect_swapped (adj, "value_changed",
-			  G_CALLBACK (gimp_preview_invalidate),
+			  G_CALLBACK (preview_schedule),
 			  preview);
 
 
@@ -552,8 +1804,9 @@ static gboolean fix_ca_dialog (gint32 drawable_ID, FixCaParams *params)
 	g_signal_connect (adj, "value_changed",
 			  G_CALLBACK (gimp_double_adjustment_update),
 			  &(params->x_blue));
+	g_object_set_data (G_OBJECT (button), "x-blue", adj);
 	g_signal_connect_swapped (adj, "value_changed",
-			  G_CALLBACK (gimp_preview_invalidate),
+			  G_CALLBACK (preview_schedule),
 			  preview);
 
 	adj = gimp_scale_entry_new (GTK_TABLE (table), 0, 1,
@@ -565,8 +1818,9 @@ static gboolean fix_ca_dialog (gint32 drawable_ID, FixCaParams *params)
 	g_signal_connect (adj, "value_changed",
 			  G_CALLBACK (gimp_double_adjustment_update),
 			  &(params->x_red));
+	g_object_set_data (G_OBJECT (button), "x-red", adj);
 	g_signal_connect_swapped (adj, "value_changed",
-			  G_CALLBACK (gimp_preview_invalidate),
+			  G_CALLBACK (preview_schedule),
 			  preview);
 
 	frame = gimp_frame_new (_("Directional, Y axis"));
@@ -588,8 +1842,9 @@ static gboolean fix_ca_dialog (gint32 drawable_ID, FixCaParams *params)
 	g_signal_connect (adj, "value_changed",
 			  G_CALLBACK (gimp_double_adjustment_update),
 			  &(params->y_blue));
+	g_object_set_data (G_OBJECT (button), "y-blue", adj);
 	g_signal_connect_swapped (adj, "value_changed",
-			  G_CALLBACK (gimp_preview_invalidate),
+			  G_CALLBACK (preview_schedule),
 			  preview);
 
 	adj = gimp_scale_entry_new (GTK_TABLE (table), 0, 1,
@@ -601,81 +1856,426 @@ static gboolean fix_ca_dialog (gint32 drawable_ID, FixCaParams *params)
 	g_signal_connect (adj, "value_changed",
 			  G_CALLBACK (gimp_double_adjustment_update),
 			  &(params->y_red));
+	g_object_set_data (G_OBJECT (button), "y-red", adj);
 	g_signal_connect_swapped (adj, "value_changed",
-			  G_CALLBACK (gimp_preview_invalidate),
+			  G_CALLBACK (preview_schedule),
 			  preview);
 
 	gtk_widget_show (dialog);
 
 	run = (gimp_dialog_run (GIMP_DIALOG (dialog)) == GTK_RESPONSE_OK);
 
+	/* Stop the render in progress, then wait for the worker to exit */
+	if (preview_frame_id) {
+		g_source_remove (preview_frame_id);
+		preview_frame_id = 0;
+	}
+	if (preview_refine_id) {
+		g_source_remove (preview_refine_id);
+		preview_refine_id = 0;
+	}
+	g_atomic_int_inc (&preview_generation);
+	g_thread_pool_free (preview_pool, FALSE, TRUE);
+	preview_pool = NULL;
+	g_free (preview_cache.data);
+	preview_cache.data = NULL;
+
 	gtk_widget_destroy (dialog);
 
 	return run;
 }
 
+static void estimate_clicked (GtkWidget *button, GtkWidget *preview)
+{
+	static const gchar *keys[] = {
+		"blue", "red", "x-blue", "x-red", "y-blue", "y-red"
+	};
+	FixCaParams *params, found;
+	gdouble	values[6];
+	gint32	drawable_ID;
+	gint	i;
+
+	params = g_object_get_data (G_OBJECT (preview), "fix-ca-params");
+	drawable_ID = GPOINTER_TO_INT (g_object_get_data (G_OBJECT (button), \
+							  "drawable"));
+	found = *params;
+
+	gtk_widget_set_sensitive (button, FALSE);
+	if (!estimate (drawable_ID, &found, FALSE)) {
+		g_message (_("Not enough clear edges to estimate the shifts!"));
+	} else {
+		/* Through the sliders, which update params and the preview */
+		values[0] = found.blue;
+		values[1] = found.red;
+		values[2] = found.x_blue;
+		values[3] = found.x_red;
+		values[4] = found.y_blue;
+		values[5] = found.y_red;
+		for (i = 0; i < 6; i++)
+			gtk_adjustment_set_value (GTK_ADJUSTMENT (g_object_get_data \
+						  (G_OBJECT (button), keys[i])), values[i]);
+	}
+	gtk_widget_set_sensitive (button, TRUE);
+}
+
+/* The controls and the preview's own "invalidated" signal come here,
+   instead of each change starting a render of its own */
+static void preview_schedule (GtkWidget *widget)
+{
+	preview_requested++;
+	if (preview_frame_id == 0)
+		preview_frame_id = g_timeout_add (PREVIEW_FRAME_MS, \
+						  preview_frame, widget);
+}
+
+static gboolean preview_frame (gpointer data)
+{
+	GtkWidget *widget = data;
+
+	preview_frame_id = 0;
+	if (gimp_preview_get_update (GIMP_PREVIEW (widget)))
+		preview_update (widget, g_object_get_data (G_OBJECT (widget), \
+							   "fix-ca-params"));
+	return FALSE;
+}
+
 static void preview_update (GtkWidget *widget, FixCaParams *params)
 {
-	GimpDrawablePreview *preview;
+	gint64	now = g_get_monotonic_time ();
+	gboolean draft;
+
+	/* While input keeps coming, e.g. a scale being dragged, show a quick
+	   nearest neighbour draft, then the selected interpolation once it
+	   has been quiet for PREVIEW_REFINE_MS */
+	draft = params->interpolation != GIMP_INTERPOLATION_NONE && \
+		now - preview_last < PREVIEW_REFINE_MS * 1000;
+	preview_last = now;
+
+	if (preview_refine_id) {
+		g_source_remove (preview_refine_id);
+		preview_refine_id = 0;
+	}
+	preview_queue (widget, params, draft);
+	if (draft)
+		preview_refine_id = g_timeout_add (PREVIEW_REFINE_MS, \
+						   preview_refine, widget);
+}
+
+static gboolean preview_refine (gpointer data)
+{
+	GtkWidget *widget = data;
+
+	preview_refine_id = 0;
+	preview_queue (widget, g_object_get_data (G_OBJECT (widget), \
+						  "fix-ca-params"), FALSE);
+	return FALSE;
+}
+
+static void preview_queue (GtkWidget *widget, FixCaParams *params,
+			   gboolean draft)
+{
+	GimpZoomPreview *preview;
 	GimpPreview *ptr;
 	gint32	preview_ID;
-	gint	b, i, j, x, y, width, height, xImg, yImg, bppImg, bpcImg, size;
 	GeglBuffer *srcBuf;
-	guchar	*srcImg, *destImg, *prevImg;
 	const Babl *format;
-	gdouble d;
+	FixCaRender *render;
+	FixCaParams *scaled;
+	gint	x0, y0, x1, y1, xImg, yImg, w, h, bpp;
+	gdouble	factor;
 
-	preview = GIMP_DRAWABLE_PREVIEW (widget);
+	preview = GIMP_ZOOM_PREVIEW (widget);
 	ptr = GIMP_PREVIEW (preview);
-	gimp_preview_get_position (ptr, &x, &y);
-	gimp_preview_get_size (ptr, &width, &height);
 
-	preview_ID = gimp_drawable_preview_get_drawable_id (preview);
+	/* Anything still rendering is out of date now */
+	render = g_new0 (FixCaRender, 1);
+	render->generation = g_atomic_int_add (&preview_generation, 1) + 1;
+	render->preview = ptr;
+	render->params = *params;
+	render->requested = preview_requested;
+	render->executed = ++preview_executed;
+	if (draft)
+		render->params.interpolation = GIMP_INTERPOLATION_NONE;
+
+	preview_ID = gimp_zoom_preview_get_drawable_id (preview);
+	xImg = gimp_drawable_width(preview_ID);
+	yImg = gimp_drawable_height(preview_ID);
+
+	/* Part of the drawable on view, and at what scale */
+	gimp_preview_get_size (ptr, &render->out_width, &render->out_height);
+	gimp_preview_untransform (ptr, 0, 0, &x0, &y0);
+	gimp_preview_untransform (ptr, render->out_width, render->out_height, \
+				  &x1, &y1);
+	x0 = CLAMP (x0, 0, xImg - 1);
+	y0 = CLAMP (y0, 0, yImg - 1);
+	x1 = CLAMP (x1, x0 + 1, xImg);
+	y1 = CLAMP (y1, y0 + 1, yImg);
+	factor = MIN ((gdouble) render->out_width / (x1 - x0), \
+		      (gdouble) render->out_height / (y1 - y0));
 
 	format = gimp_drawable_get_format (preview_ID);
-	bppImg = babl_format_get_bytes_per_pixel(format);
-	bpcImg = color_size (format);
+	render->bppImg = babl_format_get_bytes_per_pixel(format);
+	render->bpcImg = color_size (format);
+	if (render->bpcImg <= -99) {
+		g_free (render);
+		return;
+	}
+
+	if (factor < 1.0) {
+		/* Zoomed out, correct the image as if it was this small,
+		   with the shifts and lens center scaled to match */
+		scaled = &render->params;
+		scaled->blue *= factor;
+		scaled->red *= factor;
+		scaled->x_blue *= factor;
+		scaled->x_red *= factor;
+		scaled->y_blue *= factor;
+		scaled->y_red *= factor;
+		scaled->lens_x = round (scaled->lens_x * factor);
+		scaled->lens_y = round (scaled->lens_y * factor);
+		render->xImg = MAX (1, (gint) ceil (xImg * factor));
+		render->yImg = MAX (1, (gint) ceil (yImg * factor));
+		render->x = MIN ((gint) floor (x0 * factor), render->xImg - 1);
+		render->y = MIN ((gint) floor (y0 * factor), render->yImg - 1);
+		render->width = MIN (render->out_width, render->xImg - render->x);
+		render->height = MIN (render->out_height, render->yImg - render->y);
+	} else {
+		/* 1:1 or zoomed in, correct at full size and enlarge after */
+		factor = 1.0;
+		render->xImg = xImg;
+		render->yImg = yImg;
+		render->x = x0;
+		render->y = y0;
+		render->width = x1 - x0;
+		render->height = y1 - y0;
+	}
 #ifdef DEBUG_TIME
-	printf("preview_update(), bppImg=%d, bpcImg=%d, x=%d y=%d w=%d h=%d\n", \
-		bppImg, bpcImg, x, y, width, height);
+	printf("preview_queue(), bppImg=%d, bpcImg=%d, x=%d y=%d w=%d h=%d\n", \
+		render->bppImg, render->bpcImg, render->x, render->y, \
+		render->width, render->height);
 #endif
-	if (bpcImg <= -99)
-		return;
 
-	xImg = gimp_drawable_width(preview_ID);
-	yImg = gimp_drawable_height(preview_ID);
-	size = xImg * yImg * bppImg;
-	srcImg  = g_new (guchar, size);
-	destImg = g_new (guchar, size);
-	prevImg = g_new (guchar, width * height * bppImg);
+	/* libgimp talks to Gimp over a pipe that is not thread safe, so the
+	   source pixels the visible area depends on are read here */
+	fix_ca_source_rect (&render->params, render->xImg, render->yImg, \
+			    render->x, (render->x + render->width), render->y, \
+			    (render->y + render->height), &render->win);
+	if (factor < 1.0) {
+		/* Gimp scales it down from its own mipmaps, 8 bits per
+		   color, rather than sending every full size tile */
+		x0 = (gint) floor (render->win.x / factor);
+		y0 = (gint) floor (render->win.y / factor);
+		x1 = MIN ((gint) ceil ((render->win.x + render->win.width) / factor), xImg);
+		y1 = MIN ((gint) ceil ((render->win.y + render->win.height) / factor), yImg);
+		w = render->win.width;
+		h = render->win.height;
+		render->win.data = gimp_drawable_get_sub_thumbnail_data (preview_ID, \
+					x0, y0, (x1 - x0), (y1 - y0), &w, &h, &bpp);
+		if (render->win.data == NULL || w != render->win.width || \
+		    h != render->win.height) {
+			preview_free (render);
+			return;
+		}
+		render->bppImg = bpp;
+		render->bpcImg = 1;
+	} else {
+		render->win.data = g_new (guchar, (gsize) render->win.width * \
+					  render->win.height * render->bppImg);
+		srcBuf = gimp_drawable_get_buffer (preview_ID);
+		gegl_buffer_get (srcBuf, GEGL_RECTANGLE(render->win.x, render->win.y, \
+				 render->win.width, render->win.height), 1.0, format, \
+				 render->win.data, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+		g_object_unref (srcBuf);
+	}
 
-	srcBuf  = gimp_drawable_get_buffer (preview_ID);
-	gegl_buffer_get (srcBuf, GEGL_RECTANGLE(0, 0, xImg, yImg), 1.0, \
-			 format, srcImg, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+	g_thread_pool_push (preview_pool, render, NULL);
+}
 
-	fix_ca_region (srcImg, destImg, xImg, yImg, bppImg, bpcImg, params, \
-		       0, xImg, y, (y + height), FALSE);
+/* Worker thread, correct the visible area unless superseded */
+static void preview_render (gpointer data, gpointer user_data)
+{
+	FixCaRender *render = data;
+	FixCaParams *params = &render->params;
+	FixCaProgress progress;
+	FixCaContext ctx;
+	FixCaStats stats;
+	gint	b, c, channels, width, height, bppImg, bpcImg, ret;
+	gsize	i, size;
+	guchar	*destImg, *row;
+	gdouble d, start = 0.0, t;
+	gboolean timed = fix_ca_stats_target () != NULL;
+
+	if (preview_cancelled (render)) {
+		preview_free (render);
+		return;
+	}
 
+	width = render->width;
+	height = render->height;
+	bppImg = render->bppImg;
+	bpcImg = render->bpcImg;
 	b = absolute (bpcImg);
-	for (i = 0; i < height; i++) {
-		if (b == 1) {
-		memcpy (&prevImg[width * i * bppImg],
-			&destImg[(xImg * (y + i) + x) * bppImg],
-			width * bppImg);
+	size = (gsize) width * height * bppImg;
+
+	/* Only redo the channels whose settings changed, none at all if
+	   just the saturation did */
+	channels = preview_channels (render);
+	fix_ca_stats_init (&stats);
+	if (timed)
+		start = fix_ca_stats_now ();
+	if (channels) {
+		destImg = g_new (guchar, size);
+		progress.done = 0;
+		progress.total = (gint64) width * height;
+		progress.update = NULL;
+		progress.cancelled = preview_cancelled;
+		progress.user_data = render;
+		fix_ca_context_init (&ctx, params, render->xImg, render->yImg, \
+				     bppImg, bpcImg);
+		ctx.channels = channels;
+		ctx.progress = &progress;
+		ctx.stats = timed ? &stats : NULL;
+		ret = fix_ca_run (&ctx, &render->win, destImg, render->x, \
+				  (render->x + width), render->y, (render->y + height));
+		fix_ca_context_clear (&ctx);
+		if (ret) {
+			g_free (destImg);
+			preview_free (render);
+			return;
+		}
+
+		if (channels == FIX_CA_CHANNEL_ALL) {
+			g_free (preview_cache.data);
+			preview_cache.data = destImg;
+			preview_cache.x = render->x;
+			preview_cache.y = render->y;
+			preview_cache.width = width;
+			preview_cache.height = height;
+			preview_cache.xImg = render->xImg;
+			preview_cache.yImg = render->yImg;
+			preview_cache.bppImg = bppImg;
+			preview_cache.bpcImg = bpcImg;
 		} else {
-			for (j = 0; j < width*bppImg/b; j++) {
-				d = get_pixel (&destImg[(xImg*(y+i)+x)*bppImg+j*b], bpcImg);
-				set_pixel (&prevImg[width*i*bppImg/b+j], d, 1);
+			/* Red is the first color, blue the third */
+			c = (channels == FIX_CA_CHANNEL_RED) ? 0 : 2*b;
+			for (i = 0; i < (gsize) width * height; i++)
+				memcpy (&preview_cache.data[i*bppImg + c], \
+					&destImg[i*bppImg + c], b);
+			g_free (destImg);
+		}
+		preview_cache.params = *params;
+	}
+
+	destImg = g_new (guchar, size);
+	memcpy (destImg, preview_cache.data, size);
+	render->prevImg = g_new (guchar, size);
+
+	/* Preview only, exaggerate colors and show the lens center */
+	t = timed ? fix_ca_stats_now () : 0.0;
+	for (i = 0; i < (gsize) height; i++) {
+		row = &destImg[i * width * bppImg];
+		if (params->saturation != 0.0)
+			saturate (row, width, bppImg, bpcImg, \
+				  1+params->saturation/100);
+		centerline (row, width, bppImg, bpcImg, render->x, render->y + i, \
+			    params->lens_x, params->lens_y);
+	}
+	if (timed)
+		stats.seconds[FIX_CA_PHASE_SATURATE] += fix_ca_stats_now () - t;
+
+	if (b == 1) {
+		memcpy (render->prevImg, destImg, size);
+	} else {
+		for (i = 0; i < (gsize) width*height*bppImg/b; i++) {
+			d = get_pixel (&destImg[i*b], bpcImg);
+			set_pixel (&render->prevImg[i], d, 1);
+		}
+	}
+	g_free (destImg);
+
+	/* Zoomed in, or off by rounding when zoomed out, fit the area */
+	if (width != render->out_width || height != render->out_height) {
+		gint	p = bppImg / b, ox, oy, sx, sy;
+		guchar	*outImg;
+
+		outImg = g_new (guchar, (gsize) render->out_width * \
+				render->out_height * p);
+		for (oy = 0; oy < render->out_height; oy++) {
+			sy = (gint) ((gint64) oy * height / render->out_height);
+			for (ox = 0; ox < render->out_width; ox++) {
+				sx = (gint) ((gint64) ox * width / render->out_width);
+				memcpy (&outImg[((gsize) oy * render->out_width + ox) * p], \
+					&render->prevImg[((gsize) sy * width + sx) * p], p);
 			}
 		}
+		g_free (render->prevImg);
+		render->prevImg = outImg;
+	}
+
+	if (timed) {
+		stats.requests = render->requested;
+		stats.renders = render->executed;
+		fix_ca_stats_emit ("preview", &stats, fix_ca_stats_now () - start);
 	}
 
-	gimp_preview_draw_buffer (ptr, prevImg, width * bppImg/b);
+	/* Widgets are only touched from the main loop */
+	g_idle_add (preview_draw, render);
+}
+
+/* Channels to redo for render, all if the cached result can't be used */
+static gint preview_channels (FixCaRender *render)
+{
+	FixCaParams *cached = &preview_cache.params;
+	FixCaParams *params = &render->params;
+	gint	channels = 0;
+
+	if (preview_cache.data == NULL || preview_cache.x != render->x || \
+	    preview_cache.y != render->y || \
+	    preview_cache.width != render->width || \
+	    preview_cache.height != render->height || \
+	    preview_cache.xImg != render->xImg || \
+	    preview_cache.yImg != render->yImg || \
+	    preview_cache.bppImg != render->bppImg || \
+	    preview_cache.bpcImg != render->bpcImg || \
+	    cached->lens_x != params->lens_x || \
+	    cached->lens_y != params->lens_y || \
+	    cached->interpolation != params->interpolation)
+		return FIX_CA_CHANNEL_ALL;
+
+	if (cached->red != params->red || cached->x_red != params->x_red || \
+	    cached->y_red != params->y_red)
+		channels |= FIX_CA_CHANNEL_RED;
+	if (cached->blue != params->blue || cached->x_blue != params->x_blue || \
+	    cached->y_blue != params->y_blue)
+		channels |= FIX_CA_CHANNEL_BLUE;
+	return channels;
+}
+
+/* Main loop, draw the result if nothing newer was asked for since */
+static gboolean preview_draw (gpointer data)
+{
+	FixCaRender *render = data;
+
+	if (!preview_cancelled (render))
+		gimp_preview_draw_buffer (render->preview, render->prevImg, \
+					  render->out_width * render->bppImg / \
+					  absolute (render->bpcImg));
+	preview_free (render);
+	return FALSE;
+}
+
+static gint preview_cancelled (void *user_data)
+{
+	FixCaRender *render = user_data;
+
+	return render->generation != g_atomic_int_get (&preview_generation);
+}
 
-	g_object_unref (srcBuf);
-	g_free(prevImg);
-	g_free(destImg);
-	g_free(srcImg);
+static void preview_free (FixCaRender *render)
+{
+	g_free (render->prevImg);
+	g_free (render->win.data);
+	g_free (render);
 }
 
 static int color_size (const Babl *format)
@@ -710,215 +2310,6 @@ static int color_size (const Babl *format)
 	return -99;
 }
 
-static gdouble get_pixel (guchar *ptr, gint bpc)
-{
-	/* Returned value is in the range of [0.0..1.0]. */
-	gdouble ret = 0.0;
-	if (bpc == 1) {
-		ret += *ptr;
-		ret /= 255;
-	} else if (bpc == 2) {
-		uint16_t *p = (uint16_t *)(ptr);
-		ret += *p;
-		ret /= 65535;
-	} else if (bpc == 4) {
-		uint32_t *p = (uint32_t *)(ptr);
-		ret += *p;
-		ret /= 4294967295;
-	} else if (bpc == 8) {
-		uint64_t *p = (uint64_t *)(ptr);
-		long double lret = 0.0;
-		lret += *p;
-		lret /= 18446744073709551615UL;
-		ret = lret;
-	} else if (bpc == -8) {
-		double *p = (double *)(ptr);
-		ret += *p;
-	} else if (bpc == -4) {
-		float *p = (float *)(ptr);
-		ret += *p;
-	//} else if (bpc == -2) {
-	//	half *p = ptr;
-	//	ret += *p;
-	}
-
-	return ret;
-}
-
-static void set_pixel (guchar *dest, gdouble d, gint bpc)
-{
-	/* input value is in the range of [0.0..1.0]. */
-	if (bpc == 1) {
-		*dest = round(d * 255);
-	}  else if (bpc == 2) {
-		uint16_t *p = (uint16_t *)(dest);
-		*p = round(d * 65535);
-	} else if (bpc == 4) {
-		uint32_t *p = (uint32_t *)(dest);
-		*p = round(d * 4294967295);
-	} else if (bpc == 8) {
-		uint64_t *p = (uint64_t *)(dest);
-		*p = roundl(d * 18446744073709551615UL);
-	} else if (bpc == -8) {
-		double *p = (double *)(dest);
-		*p = d;
-	} else if (bpc == -4) {
-		float *p = (float *)(dest);
-		*p = (float)(d);
-	//} else if (bpc == -2) {
-	//	half *p = (half *)(dest);
-	//	*p = d;
-	}
-
-	return;
-}
-
-static int round_nearest (gdouble d)
-{
-	if (d >= 0) {
-		if (d > INT_MAX)
-			return INT_MAX;
-		else
-			return (int)(d + 0.5);
-	} else {
-		if (d < INT_MIN)
-			return INT_MIN;
-		else
-			return -((int)(0.5 - d));
-	}
-}
-
-static int absolute (gint i)
-{
-	if (i >= 0)
-		return i;
-	else
-		return -i;
-}
-
-static int scale (gint i, gint center, gint size, gdouble scale_val, gdouble shift_val)
-{
-	gdouble d = (i - center) * scale_val + center - shift_val;
-	gint j = round_nearest (d);
-	if (j <= 0)
-		return 0;
-	else if (j >= size)
-		return size-1;
-	else
-		return j;
-}
-
-static double scale_d (gint i, gint center, gint size, gdouble scale_val, gdouble shift_val)
-{
-	gdouble d = (i - center) * scale_val + center - shift_val;
-	if (d <= 0.0)
-		return 0.0;
-	else if (d >= size-1)
-		return size-1;
-	else
-		return d;
-}
-
-static guchar *load_data (gint fullWidth, gint bpp, guchar *srcPTR,
-			  guchar *src[SOURCE_ROWS], gint src_row[SOURCE_ROWS],
-			  gint src_iter[SOURCE_ROWS], gint band_adj,
-			  gint band_left, gint band_right, gint y, gint iter)
-{
-	gint	i, l, x, diff, diff_max = -1, row_best = -1;
-	int	iter_oldest;
-
-	for (i = 0; i < SOURCE_ROWS; ++i) {
-		if (src_row[i] == y) {
-			src_iter[i] = iter;	/* Make sure to keep this row
-						   during this iteration */
-			return src[i];
-		}
-	}
-
-	/* Find a row to replace */
-	iter_oldest = INT_MAX;		/* Largest possible */
-	for (i = 0; i < SOURCE_ROWS; ++i) {
-		if (src_iter[i] < iter_oldest) {
-			iter_oldest = src_iter[i];
-			diff_max = absolute (y - src_row[i]);
-			row_best = i;
-		}
-		else if (src_iter[i] == iter_oldest) {
-			diff = absolute (y - src_row[i]);
-			if (diff > diff_max) {
-				diff_max = diff;
-				row_best = i;
-			}
-		}
-	}
-
-	x = ((fullWidth * y) + band_left) * bpp;
-	i = band_adj * bpp;
-	l = i + (band_right-band_left+1) * bpp;
-	memcpy (&src[row_best][i], &srcPTR[x + i], l - i);
-	src_row[row_best] = y;
-	src_iter[row_best] = iter;
-	return src[row_best];
-}
-
-static void set_data (guchar *dstPTR, guchar *dest, gint bpp, \
-		      gint fullWidth, gint xstart, gint yrow, gint width)
-{
-	gint l, x;
-	x = ((fullWidth * yrow) + xstart) * bpp;
-	l = width * bpp;
-	memcpy (&dstPTR[x], dest, l);
-}
-
-static gdouble clip_d (gdouble d)
-{
-	if (d <= 0.0)
-		return 0.0;
-	if (d >= 1.0)
-		return 1.0;
-	return d;
-}
-
-static void bilinear (guchar *dest, \
-		      guchar *yrow0, guchar *yrow1, gint x0, gint x1, \
-		      gint bpp, gint bpc, gdouble dx, gdouble dy)
-{
-	gdouble d, x0y0, x1y0, x0y1, x1y1;
-	x0y0 = get_pixel (&yrow0[x0*bpp], bpc);
-	x1y0 = get_pixel (&yrow0[x1*bpp], bpc);
-	x0y1 = get_pixel (&yrow1[x0*bpp], bpc);
-	x1y1 = get_pixel (&yrow1[x1*bpp], bpc);
-	d = (1-dy) * (x0y0 + dx * (x1y0-x0y0))
-	     + dy  * (x0y1 + dx * (x1y1-x0y1));
-	set_pixel (dest, clip_d(d), bpc);
-}
-
-static gdouble cubicY (guchar *yrow, gint bpp, gint bpc, gdouble dx, \
-			   gint m1, gint x0, gint p1, gint p2)
-{
-	/* Catmull-Rom from Gimp gimpdrawable-transform.c */
-	gdouble d, xm1, x, xp1, xp2;
-	xm1 = get_pixel (&yrow[m1*bpp], bpc);
-	x   = get_pixel (&yrow[x0*bpp], bpc);
-	xp1 = get_pixel (&yrow[p1*bpp], bpc);
-	xp2 = get_pixel (&yrow[p2*bpp], bpc);
-	d = ((( ( - xm1 + 3 * x - 3 * xp1 + xp2 ) * dx +
-	      ( 2 * xm1 - 5 * x + 4 * xp1 - xp2 ) ) * dx +
-			     ( - xm1 + xp1 ) ) * dx + (x + x) ) / 2.0;
-	return d;
-}
-
-static void cubicX (guchar *dest, gint bpp, gint bpc, gdouble dy, \
-		    gdouble ym1, gdouble y, gdouble yp1, gdouble yp2)
-{
-	/* Catmull-Rom from Gimp gimpdrawable-transform.c */
-	gdouble d;
-	d = ((( ( - ym1 + 3 * y - 3 * yp1 + yp2 ) * dy +
-	      ( 2 * ym1 - 5 * y + 4 * yp1 - yp2 ) ) * dy +
-			     ( - ym1 + yp1 ) ) * dy + (y + y) ) / 2.0;
-	set_pixel (dest, clip_d(d), bpc);
-}
-
 static void saturate (guchar *dest, gint width, \
 		      gint bpp, gint bpc, gdouble s_scale)
 {
@@ -949,19 +2340,13 @@ static void centerline (guchar *dest, gint width, gint bpp, gint bpc, \
 	gdouble	c = 1.0;
 	dest += b;
 	if (y == yc) {
-		i = absolute(xc - x) %16;
-		if (i < 8) c = 0.0;
+		/* dashes are placed from xc, so they line up between regions */
 		while (width-- > 0) {
+			i = absolute(xc - x++) % 16;
+			c = (i < 8) ? 0.0 : 1.0;
 			set_pixel (dest-b, c, bpc);
 			set_pixel (dest  , c, bpc);
 			set_pixel (dest+b, c, bpc);
-			if (i-- < 0) {
-				i = 7;
-				if (c > 0)
-					c = 0.0;
-				else
-					c = 1.0;
-			}
 			dest += bpp;
 		}
 		return;
@@ -995,356 +2380,9 @@ static void centerline (guchar *dest, gint width, gint bpp, gint bpc, \
 	}
 }
 
-static void fix_ca_region (guchar *srcPTR, guchar *dstPTR,
-			   gint orig_width, gint orig_height, gint bytes, gint bpc,
-			   FixCaParams *params, gint x1, gint x2, gint y1, gint y2,
-			   gboolean show_progress)
+static void progress_update (gdouble fraction)
 {
-	guchar	*src[SOURCE_ROWS];
-	gint	src_row[SOURCE_ROWS];
-	gint	src_iter[SOURCE_ROWS];
-	gint	b, i;
-
-	guchar	*dest;
-	gint	x, y, x_center, y_center, max_dim;
-	gdouble	scale_blue, scale_red, scale_max;
-
-	gdouble	x_shift_max, x_shift_min;
-
-	gint	band_1, band_2, band_adj;
-
-#ifdef DEBUG_TIME
-	double	sec;
-	struct	timeval tv1, tv2;
-	gettimeofday (&tv1, NULL);
-#endif
-
-	if (show_progress)
-		gimp_progress_init (_("Shifting pixel components..."));
-
-	/* Allocate buffers for reading, writing */
-	for (i = 0; i < SOURCE_ROWS; ++i) {
-		src[i] = g_new (guchar, orig_width * bytes);
-		src_row[i] = ROW_INVALID;	/* Invalid row */
-		src_iter[i] = ITER_INITIAL;	/* Oldest iteration */
-	}
-	dest = g_new (guchar, (x2-x1) * bytes);
-
-	x_center = params->lens_x;
-	y_center = params->lens_y;
-	/* Scale to get source */
-	if (x_center >= y_center)
-		max_dim = x_center;
-	else
-		max_dim = y_center;
-	if (orig_width - x_center > max_dim)
-		max_dim = orig_width - x_center;
-	if (orig_height - y_center > max_dim)
-		max_dim = orig_height - y_center;
-	scale_blue = max_dim / (max_dim + params->blue);
-	scale_red = max_dim / (max_dim + params->red);
-
-	/* Optimize by loading only parts of a row */
-	if (scale_blue > scale_red)
-		scale_max = scale_blue;
-	else
-		scale_max = scale_red;
-
-	if (params->x_blue > params->x_red) {
-		x_shift_min = params->x_red;
-		x_shift_max = params->x_blue;
-	} else {
-		x_shift_min = params->x_blue;
-		x_shift_max = params->x_red;
-	}
-
-	/* Horizontal band to load for each row */
-	band_1 = scale (x1, x_center, orig_width, scale_max, x_shift_max);
-	band_2 = scale (x2-1, x_center, orig_width, scale_max, x_shift_min);
-	if (band_1 > x1)	/* Make sure green is also covered */
-		band_1 = x1;
-	if (band_2 < x2-1)
-		band_2 = x2-1;
-
-	/* Extra pixels needed for interpolation */
-	if (params->interpolation != GIMP_INTERPOLATION_NONE) {
-		if (band_1 > 0)
-			--band_1;
-		if (band_2 < orig_width-1)
-			++band_2;
-	}
-	/* More pixels needed for cubic interpolation */
-	if (params->interpolation == GIMP_INTERPOLATION_CUBIC) {
-		if (band_1 > 0)
-			--band_1;
-		if (band_2 < orig_width-1)
-			++band_2;
-	}
-
-	band_adj = band_1 * bytes;
-	b = absolute (bpc);
-#ifdef DEBUG_TIME
-	printf("fix_ca_region(), xc=%d of %d yc=%d of %d b=%d, %d, %d\n", \
-		x_center, orig_width, y_center, orig_height, bpc, b, bytes);
-#endif
-
-	for (y = y1; y < y2; ++y) {
-		/* Get current row, for green channel */
-		guchar *ptr;
-		ptr = load_data (orig_width, bytes, srcPTR, src, src_row, src_iter,
-				 band_adj, band_1, band_2, y, y);
-
-		/* Collect Green and Alpha channels all at once */
-		memcpy (dest, &ptr[x1], (x2-x1)*bytes);
-
-		if (params->interpolation == GIMP_INTERPOLATION_NONE) {
-			guchar	*ptr_blue, *ptr_red;
-			gint	y_blue, y_red, x_blue, x_red;
-
-			/* Get blue and red row */
-			y_blue = scale (y, y_center, orig_height, scale_blue, params->y_blue);
-			y_red = scale (y, y_center, orig_height, scale_red, params->y_red);
-			ptr_blue = load_data (orig_width, bytes, srcPTR, src, src_row, src_iter,
-					      band_adj, band_1, band_2, y_blue, y);
-			ptr_red = load_data (orig_width, bytes, srcPTR, src, src_row, src_iter,
-					     band_adj, band_1, band_2, y_red, y);
-
-			for (x = x1; x < x2; ++x) {
-				/* Blue and red channel */
-				x_blue = scale (x, x_center, orig_width, scale_blue, params->x_blue);
-				x_red = scale (x, x_center, orig_width, scale_red, params->x_red);
-
-				memcpy (&dest[(x-x1)*bytes + 2*b], \
-					&ptr_blue[x_blue*bytes + 2*b], b);
-				memcpy (&dest[(x-x1)*bytes], \
-					&ptr_red[x_red*bytes], b);
-			}
-		} else if (params->interpolation == GIMP_INTERPOLATION_LINEAR) {
-			/* Pointer to pixel data rows y, y+1 */
-			guchar	*ptr_blue_1, *ptr_blue_2, *ptr_red_1, *ptr_red_2;
-			/* Floating point row, fractional row */
-			gdouble	y_blue_d, y_red_d, d_y_blue, d_y_red;
-			/* Integer row y */
-			gint	y_blue_1, y_red_1;
-			/* Floating point column, fractional column */
-			gdouble	x_blue_d, x_red_d, d_x_blue, d_x_red;
-			/* Integer column x, x+1 */
-			gint	x_blue_1, x_red_1, x_blue_2, x_red_2;
-
-			/* Get blue and red row */
-			y_blue_d = scale_d (y, y_center, orig_height, scale_blue, params->y_blue);
-			y_red_d = scale_d (y, y_center, orig_height, scale_red, params->y_red);
-
-			/* Integer and fractional row */
-			y_blue_1 = floor (y_blue_d);
-			y_red_1 = floor (y_red_d);
-			d_y_blue = y_blue_d - y_blue_1;
-			d_y_red = y_red_d - y_red_1;
-
-			/* Load pixel data */
-			ptr_blue_1 = load_data (orig_width, bytes, srcPTR, src, src_row, src_iter,
-						band_adj, band_1, band_2, y_blue_1, y);
-			ptr_red_1 = load_data (orig_width, bytes, srcPTR, src, src_row, src_iter,
-					       band_adj, band_1, band_2, y_red_1, y);
-			if (y_blue_1 == orig_height-1)
-				ptr_blue_2 = ptr_blue_1;
-			else
-				ptr_blue_2 = load_data (orig_width, bytes, srcPTR, src, src_row, src_iter,
-							band_adj, band_1, band_2, y_blue_1+1, y);
-			if (y_red_1 == orig_height-1)
-				ptr_red_2 = ptr_red_1;
-			else
-				ptr_red_2 = load_data (orig_width, bytes, srcPTR, src, src_row, src_iter,
-						       band_adj, band_1, band_2, y_red_1+1, y);
-
-			for (x = x1; x < x2; ++x) {
-				/* Blue and red channel */
-				x_blue_d = scale_d (x, x_center, orig_width, scale_blue, params->x_blue);
-				x_red_d = scale_d (x, x_center, orig_width, scale_red, params->x_red);
-
-				/* Integer and fractional column */
-				x_blue_1 = floor (x_blue_d);
-				x_red_1 = floor (x_red_d);
-				d_x_blue = x_blue_d - x_blue_1;
-				d_x_red = x_red_d - x_red_1;
-				if (x_blue_1 == orig_width-1)
-					x_blue_2 = x_blue_1;
-				else
-					x_blue_2 = x_blue_1 + 1;
-				if (x_red_1 == orig_width-1)
-					x_red_2 = x_red_1;
-				else
-					x_red_2 = x_red_1 + 1;
-
-				/* Interpolation */
-				bilinear ((dest+((x-x1)*bytes+2*b)), \
-					  (ptr_blue_1+2*b), (ptr_blue_2+2*b), x_blue_1, x_blue_2, \
-					  bytes, bpc, d_x_blue, d_y_blue);
-				bilinear ((dest+((x-x1)*bytes)), \
-					  ptr_red_1, ptr_red_2, x_red_1, x_red_2, \
-					  bytes, bpc, d_x_red, d_y_red);
-			}
-		} else if (params->interpolation == GIMP_INTERPOLATION_CUBIC) {
-			/* Pointer to pixel data rows y-1, y */
-			guchar	*ptr_blue_1, *ptr_blue_2, *ptr_red_1, *ptr_red_2;
-			/* Pointer to pixel data rows y+1, y+2 */
-			guchar	*ptr_blue_3, *ptr_blue_4, *ptr_red_3, *ptr_red_4;
-			/* Floating point row, fractional row */
-			gdouble	y_blue_d, y_red_d, d_y_blue, d_y_red;
-			/* Integer row y */
-			gint	y_blue_2, y_red_2;
-			/* Floating point column, fractional column */
-			gdouble	x_blue_d, x_red_d, d_x_blue, d_x_red;
-			/* Integer column x-1, x */
-			gint	x_blue_1, x_red_1, x_blue_2, x_red_2;
-			/* Integer column x+1, x+2 */
-			gint	x_blue_3, x_red_3, x_blue_4, x_red_4;
-
-			/* Get blue and red row */
-			y_blue_d = scale_d (y, y_center, orig_height, scale_blue, params->y_blue);
-			y_red_d = scale_d (y, y_center, orig_height, scale_red, params->y_red);
-
-			y_blue_2 = floor (y_blue_d);
-			y_red_2 = floor (y_red_d);
-			d_y_blue = y_blue_d - y_blue_2;
-			d_y_red = y_red_d - y_red_2;
-
-			/* Row */
-			ptr_blue_2 = load_data (orig_width, bytes, srcPTR, src, src_row, src_iter,
-						band_adj, band_1, band_2, y_blue_2, y);
-			ptr_red_2 = load_data (orig_width, bytes, srcPTR, src, src_row, src_iter,
-					       band_adj, band_1, band_2, y_red_2, y);
-
-			/* Row - 1 */
-			if (y_blue_2 == 0)
-				ptr_blue_1 = ptr_blue_2;
-			else
-				ptr_blue_1 = load_data (orig_width, bytes, srcPTR, src, src_row, src_iter,
-							band_adj, band_1, band_2, y_blue_2-1, y);
-			if (y_red_2 == 0)
-				ptr_red_1 = ptr_red_2;
-			else
-				ptr_red_1 = load_data (orig_width, bytes, srcPTR, src, src_row, src_iter,
-						       band_adj, band_1, band_2, y_red_2-1, y);
-
-			/* Row + 1 */
-			if (y_blue_2 == orig_height-1)
-				ptr_blue_3 = ptr_blue_2;
-			else
-				ptr_blue_3 = load_data (orig_width, bytes, srcPTR, src, src_row, src_iter,
-							band_adj, band_1, band_2, y_blue_2+1, y);
-			if (y_red_2 == orig_height-1)
-				ptr_red_3 = ptr_red_2;
-			else
-				ptr_red_3 = load_data (orig_width, bytes, srcPTR, src, src_row, src_iter,
-						       band_adj, band_1, band_2, y_red_2+1, y);
-
-			/* Row + 2 */
-			if (y_blue_2 == orig_height-1)
-				ptr_blue_4 = ptr_blue_2;
-			else if (y_blue_2 == orig_height-2)
-				ptr_blue_4 = ptr_blue_3;
-			else
-				ptr_blue_4 = load_data (orig_width, bytes, srcPTR, src, src_row, src_iter,
-							band_adj, band_1, band_2, y_blue_2+2, y);
-			if (y_red_2 == orig_height-1)
-				ptr_red_4 = ptr_red_2;
-			else if (y_red_2 == orig_height-2)
-				ptr_red_4 = ptr_red_3;
-			else
-				ptr_red_4 = load_data (orig_width, bytes, srcPTR, src, src_row, src_iter,
-						       band_adj, band_1, band_2, y_red_2+2, y);
-
-			for (x = x1; x < x2; ++x) {
-				double y1, y2, y3, y4;
-
-				/* Blue and red channel */
-				x_blue_d = scale_d (x, x_center, orig_width, scale_blue, params->x_blue);
-				x_red_d = scale_d (x, x_center, orig_width, scale_red, params->x_red);
-
-				x_blue_2 = floor (x_blue_d);
-				x_red_2 = floor (x_red_d);
-				d_x_blue = x_blue_d - x_blue_2;
-				d_x_red = x_red_d - x_red_2;
-
-				/* Column - 1 */
-				if (x_blue_2 == 0)
-					x_blue_1 = x_blue_2;
-				else
-					x_blue_1 = x_blue_2 - 1;
-				if (x_red_2 == 0)
-					x_red_1 = x_red_2;
-				else
-					x_red_1 = x_red_2 - 1;
-
-				/* Column + 1 */
-				if (x_blue_2 == orig_width-1)
-					x_blue_3 = x_blue_2;
-				else
-					x_blue_3 = x_blue_2 + 1;
-				if (x_red_2 == orig_width-1)
-					x_red_3 = x_red_2;
-				else
-					x_red_3 = x_red_2 + 1;
-
-				/* Column + 2 */
-				if (x_blue_3 == orig_width-1)
-					x_blue_4 = x_blue_3;
-				else
-					x_blue_4 = x_blue_3 + 1;
-				if (x_red_3 == orig_width-1)
-					x_red_4 = x_red_3;
-				else
-					x_red_4 = x_red_3 + 1;
-
-				y1 = cubicY (ptr_blue_1+2*b, bytes, bpc, d_x_blue, \
-					     x_blue_1, x_blue_2, x_blue_3, x_blue_4);
-				y2 = cubicY (ptr_blue_2+2*b, bytes, bpc, d_x_blue, \
-					     x_blue_1, x_blue_2, x_blue_3, x_blue_4);
-				y3 = cubicY (ptr_blue_3+2*b, bytes, bpc, d_x_blue, \
-					     x_blue_1, x_blue_2, x_blue_3, x_blue_4);
-				y4 = cubicY (ptr_blue_4+2*b, bytes, bpc, d_x_blue, \
-					     x_blue_1, x_blue_2, x_blue_3, x_blue_4);
-				cubicX ((dest+(x-x1)*bytes+2*b), bytes, bpc, d_y_blue, y1, y2, y3, y4);
-
-				y1 = cubicY (ptr_red_1, bytes, bpc, d_x_red, \
-					     x_red_1, x_red_2, x_red_3, x_red_4);
-				y2 = cubicY (ptr_red_2, bytes, bpc, d_x_red, \
-					     x_red_1, x_red_2, x_red_3, x_red_4);
-				y3 = cubicY (ptr_red_3, bytes, bpc, d_x_red, \
-					     x_red_1, x_red_2, x_red_3, x_red_4);
-				y4 = cubicY (ptr_red_4, bytes, bpc, d_x_red, \
-					     x_red_1, x_red_2, x_red_3, x_red_4);
-				cubicX ((dest+(x-x1)*bytes), bytes, bpc, d_y_red, y1, y2, y3, y4);
-			}
-		}
-
-		if (!show_progress) {
-			if (params->saturation != 0.0)
-				saturate (dest, x2-x1, bytes, bpc, 1+params->saturation/100);
-
-			centerline (dest, x2-x1, bytes, bpc, x1, y, x_center, y_center);
-		}
-
-		set_data (dstPTR, dest, bytes, orig_width, x1, y, (x2-x1));
-
-		if (show_progress && ((y-y1) % 8 == 0))
-			gimp_progress_update ((gdouble) (y-y1) / (y2-y1));
-	}
-
-	if (show_progress)
-		gimp_progress_update (0.0);
-
-	for (i = 0; i < SOURCE_ROWS; ++i)
-		g_free(src[i]);
-	g_free (dest);
-
-#ifdef DEBUG_TIME
-	gettimeofday (&tv2, NULL);
-
-	sec = tv2.tv_sec - tv1.tv_sec + (tv2.tv_usec - tv1.tv_usec)/1000000.0;
-	printf ("fix-ca Elapsed time: %.2f\n", sec);
-#endif
+	gimp_progress_update (fraction);
 }
 
 static void fix_ca_help (const gchar *help_id, gpointer help_data)
@@ -1352,14 +2390,14 @@ static void fix_ca_help (const gchar *help_id, gpointer help_data)
 	gimp_message (_("The image to modify is in RGB format.  Color precision "
 			"can be float, double, 8, 16, 32, 64.  The green pixels "
 			"are kept stationary, and you can shift the red and blue "
-			"colors within a range of {-10..+10} pixels.\n\n"
+			"colors within a range of {-100..+100} pixels.\n\n"
 			"Lateral Chromatic Aberration is due to camera lens(es) "
 			"with no aberration at the lens center, and increasing "
 			"gradually toward the edges of the image.\n\n"
 			"Directional X and Y axis aberrations are a flat amount "
 			"of aberration due to image seen through something like "
 			"glass, water, or another medium of different density.  "
-			"You can shift pixels up/left {-10..+10} down/right.\n\n"
+			"You can shift pixels up/left {-100..+100} down/right.\n\n"
 			"Lateral aberration correction is applied first, since "
 			"the lens(es) are closest to the film or image sensor, "
 			"and directional corrections applied last since this is "
@@ -0,0 +1,263 @@
+/*
+	gegl-fix-ca.c	Fix Chromatic Aberration GEGL operation
+	Copyright (c) 2006, 2007 Kriang Lerdsuwanakij - (original author)
+	Copyright (c) 2023, 2024 Jose Da Silva (updates and improvements)
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* Same correction as the Fix-CA plug-in, as a GEGL area filter, so
+   GEGL does the tiling, threading and caching.  It can be used from
+   Gimp's GEGL tool with on-canvas preview, or on the command line:
+	gegl in.jpg -o out.png -- fix-ca:chromatic-aberration blue=2 red=-1
+*/
+
+/* This file is read again by gegl-op.h, only include guarded headers */
+#if __has_include("fix-ca-config.h")
+#include "fix-ca-config.h"
+#endif
+
+#include <glib/gi18n-lib.h>
+#include "fix-ca-core.h"
+
+#ifdef GEGL_PROPERTIES
+
+property_double (blue, _("Blue"), 0.0)
+	description (_("Blue amount (lateral)"))
+	value_range (-INPUT_MAX, INPUT_MAX)
+
+property_double (red, _("Red"), 0.0)
+	description (_("Red amount (lateral)"))
+	value_range (-INPUT_MAX, INPUT_MAX)
+
+property_double (lens_x, _("Lens X"), -1.0)
+	description (_("Lens center (x, lateral), -1 for image center"))
+	value_range (-1.0, G_MAXINT)
+
+property_double (lens_y, _("Lens Y"), -1.0)
+	description (_("Lens center (y, lateral), -1 for image center"))
+	value_range (-1.0, G_MAXINT)
+
+property_int (interpolation, _("Interpolation"), FIX_CA_INTERPOLATION_LINEAR)
+	description (_("Interpolation 0=None/1=Linear/2=Cubic"))
+	value_range (FIX_CA_INTERPOLATION_NONE, FIX_CA_INTERPOLATION_CUBIC)
+
+property_double (x_blue, _("X Blue"), 0.0)
+	description (_("Blue amount (x axis, directional)"))
+	value_range (-INPUT_MAX, INPUT_MAX)
+
+property_double (x_red, _("X Red"), 0.0)
+	description (_("Red amount (x axis, directional)"))
+	value_range (-INPUT_MAX, INPUT_MAX)
+
+property_double (y_blue, _("Y Blue"), 0.0)
+	description (_("Blue amount (y axis, directional)"))
+	value_range (-INPUT_MAX, INPUT_MAX)
+
+property_double (y_red, _("Y Red"), 0.0)
+	description (_("Red amount (y axis, directional)"))
+	value_range (-INPUT_MAX, INPUT_MAX)
+
+#else
+
+#define GEGL_OP_AREA_FILTER
+#define GEGL_OP_NAME     fix_ca
+#define GEGL_OP_C_SOURCE gegl-fix-ca.c
+
+#include "gegl-op.h"
+#include "fix-ca-core.c"
+
+/* Processing format, 4 floats per pixel */
+#define FIX_CA_FORMAT	"R'G'B'A float"
+#define FIX_CA_BPP	16
+#define FIX_CA_BPC	-4
+
+static void get_params (GeglProperties *o, const GeglRectangle *in_rect,
+			FixCaParams *params)
+{
+	memset (params, 0, sizeof (*params));
+	params->blue = o->blue;
+	params->red = o->red;
+	params->interpolation = o->interpolation;
+	params->x_blue = o->x_blue;
+	params->x_red = o->x_red;
+	params->y_blue = o->y_blue;
+	params->y_red = o->y_red;
+
+	/* Lens center is relative to the input, default is its middle */
+	params->lens_x = o->lens_x;
+	params->lens_y = o->lens_y;
+	if (params->lens_x < 0 || params->lens_x >= in_rect->width)
+		params->lens_x = round (in_rect->width/2);
+	if (params->lens_y < 0 || params->lens_y >= in_rect->height)
+		params->lens_y = round (in_rect->height/2);
+}
+
+static void prepare (GeglOperation *operation)
+{
+	GeglOperationAreaFilter *area = GEGL_OPERATION_AREA_FILTER (operation);
+	GeglProperties *o = GEGL_PROPERTIES (operation);
+	const Babl *format = babl_format (FIX_CA_FORMAT);
+	const GeglRectangle *in_rect;
+	FixCaParams params, turned;
+	gdouble lateral, directional;
+	gint	margin;
+
+	/* Furthest a pixel can come from, used by GEGL for invalidation.
+	   get_required_for_output() gives the exact area for processing.
+	   The core's row cache covers every row any row reads from, and
+	   with x and y swapped, every column. */
+	in_rect = gegl_operation_source_get_bounding_box (operation, "input");
+	if (in_rect && !gegl_rectangle_is_infinite_plane (in_rect) && \
+	    in_rect->width > 0 && in_rect->height > 0) {
+		get_params (o, in_rect, &params);
+		turned = params;
+		turned.lens_x = params.lens_y;
+		turned.lens_y = params.lens_x;
+		turned.x_blue = params.y_blue;
+		turned.y_blue = params.x_blue;
+		turned.x_red = params.y_red;
+		turned.y_red = params.x_red;
+		margin = MAX (fix_ca_source_rows (&params, in_rect->width, \
+						  in_rect->height, 0, in_rect->height), \
+			      fix_ca_source_rows (&turned, in_rect->height, \
+						  in_rect->width, 0, in_rect->width));
+	} else {
+		/* Lateral shifts are at most twice the edge amount, unless
+		   the image is smaller than that */
+		lateral = 2 * MAX (fabs (o->blue), fabs (o->red));
+		directional = MAX (MAX (fabs (o->x_blue), fabs (o->x_red)), \
+				   MAX (fabs (o->y_blue), fabs (o->y_red)));
+		margin = ceil (lateral + directional) + 2;
+	}
+	area->left = area->right = area->top = area->bottom = margin;
+
+	gegl_operation_set_format (operation, "input", format);
+	gegl_operation_set_format (operation, "output", format);
+}
+
+static GeglRectangle get_bounding_box (GeglOperation *operation)
+{
+	const GeglRectangle *in_rect;
+	GeglRectangle result = { 0, 0, 0, 0 };
+
+	/* Pixels are only moved around inside the input */
+	in_rect = gegl_operation_source_get_bounding_box (operation, "input");
+	if (in_rect)
+		result = *in_rect;
+	return result;
+}
+
+static GeglRectangle get_required_for_output (GeglOperation *operation,
+					      const gchar *input_pad,
+					      const GeglRectangle *roi)
+{
+	const GeglRectangle *in_rect;
+	GeglRectangle area;
+	FixCaParams params;
+	FixCaWindow win;
+
+	in_rect = gegl_operation_source_get_bounding_box (operation, "input");
+	if (!in_rect || gegl_rectangle_is_infinite_plane (in_rect))
+		return *roi;
+	if (!gegl_rectangle_intersect (&area, roi, in_rect))
+		return area;
+
+	get_params (GEGL_PROPERTIES (operation), in_rect, &params);
+	fix_ca_source_rect (&params, in_rect->width, in_rect->height, \
+			    area.x - in_rect->x, area.x + area.width - in_rect->x, \
+			    area.y - in_rect->y, area.y + area.height - in_rect->y, \
+			    &win);
+	area.x = win.x + in_rect->x;
+	area.y = win.y + in_rect->y;
+	area.width = win.width;
+	area.height = win.height;
+	return area;
+}
+
+static gboolean process (GeglOperation *operation, GeglBuffer *input,
+			 GeglBuffer *output, const GeglRectangle *result,
+			 gint level)
+{
+	const GeglRectangle *in_rect;
+	const Babl	*format = babl_format (FIX_CA_FORMAT);
+	GeglRectangle	area;
+	FixCaParams	params;
+	FixCaWindow	win;
+	guchar		*dest;
+	gint		ret;
+
+	in_rect = gegl_operation_source_get_bounding_box (operation, "input");
+	if (!in_rect || !gegl_rectangle_intersect (&area, result, in_rect))
+		return TRUE;
+
+	/* Core works in coordinates relative to the input */
+	get_params (GEGL_PROPERTIES (operation), in_rect, &params);
+	area.x -= in_rect->x;
+	area.y -= in_rect->y;
+	fix_ca_source_rect (&params, in_rect->width, in_rect->height, \
+			    area.x, area.x + area.width, \
+			    area.y, area.y + area.height, &win);
+
+	win.data = g_try_malloc ((gsize) win.width * win.height * FIX_CA_BPP);
+	dest = g_try_malloc ((gsize) area.width * area.height * FIX_CA_BPP);
+	if (win.data == NULL || dest == NULL) {
+		g_free (win.data);
+		g_free (dest);
+		return FALSE;
+	}
+
+	gegl_buffer_get (input, GEGL_RECTANGLE (win.x + in_rect->x, \
+			 win.y + in_rect->y, win.width, win.height), 1.0, \
+			 format, win.data, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_CLAMP);
+
+	ret = fix_ca_region (&win, dest, in_rect->width, in_rect->height, \
+			     FIX_CA_BPP, FIX_CA_BPC, &params, area.x, \
+			     area.x + area.width, area.y, area.y + area.height, \
+			     NULL);
+	if (ret == 0)
+		gegl_buffer_set (output, GEGL_RECTANGLE (area.x + in_rect->x, \
+				 area.y + in_rect->y, area.width, area.height), \
+				 0, format, dest, GEGL_AUTO_ROWSTRIDE);
+
+	g_free (dest);
+	g_free (win.data);
+	return ret == 0;
+}
+
+static void gegl_op_class_init (GeglOpClass *klass)
+{
+	GeglOperationClass	 *operation_class;
+	GeglOperationFilterClass *filter_class;
+
+	operation_class = GEGL_OPERATION_CLASS (klass);
+	filter_class    = GEGL_OPERATION_FILTER_CLASS (klass);
+
+	operation_class->prepare = prepare;
+	operation_class->get_bounding_box = get_bounding_box;
+	operation_class->get_required_for_output = get_required_for_output;
+	filter_class->process = process;
+
+	gegl_operation_class_set_keys (operation_class,
+		"name",        "fix-ca:chromatic-aberration",
+		"title",       _("Chromatic Aberration"),
+		"categories",  "enhance",
+		"description", _("Fix chromatic aberration caused by imperfect "
+				 "lens.  It works by shifting red and blue "
+				 "components of image pixels in the specified "
+				 "amounts."),
+		NULL);
+}
+
+#endif
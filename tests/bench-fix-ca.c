@@ -0,0 +1,870 @@
+/*
+	bench-fix-ca.c	Fix Chromatic Aberration, speed of the core without Gimp
+	Copyright (c) 2023, 2024 Jose Da Silva (updates and improvements)
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* Times fix_ca_run() over synthetic images of every color size, each
+   interpolation and kind of shift, at several sizes, and over the PNG
+   files of a directory.  Each case runs in its own process, so its peak
+   resident memory is its own.  Run by "make bench".
+
+   With --check, as test3.sh of "make check", it instead corrects a small
+   image every other way the tools run the core, tiled with shared remap
+   tables, through fetch_row(), a channel at a time, and for linear, by
+   fix_ca_sweep()'s contact sheet, and compares each with one
+   fix_ca_region() over the whole image.  They must be the same to the
+   bit, except the sweep, which works in floats: it may be off by one
+   step of 16 bits, or of the color size if it has fewer.  Pixels on
+   and off the axes are also followed through shift curves.
+
+   With --speed, for "make perf-check", a fixed set of cases is timed
+   and compared with a baseline file, which --record writes.  Timings
+   swing too much between runs to be part of "make check". */
+
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE 1
+#endif
+#include "../fix-ca-core.h"
+#include "../fix-ca-io.c"
+
+#include <dirent.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_SYS_RESOURCE_H
+# include <sys/resource.h>
+#endif
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define BENCH_LIST	16
+#define CHECK_WIDTH	301
+#define CHECK_HEIGHT	203
+#define CHECK_TILE	64
+#define CHECK_MP	2.0	/* size of the timed cases */
+#define CHECK_RUNS	5	/* best of */
+
+typedef struct {
+	const char	*name;
+	int	bpc;
+} BenchColor;
+
+static const BenchColor bench_colors[] = {
+	{ "8", 1 }, { "16", 2 }, { "32", 4 }, { "64", 8 },
+	{ "float", -4 }, { "double", -8 }
+};
+
+static const char *bench_interpolations[] = { "none", "linear", "cubic" };
+static const char *bench_shifts[] = { "lateral", "directional", "combined",
+				       "curve" };
+/* Timed by --speed and --record: 8, 16 bit and float */
+static const int check_colors[] = { 0, 1, 4 };
+
+typedef struct {
+	double	sizes[BENCH_LIST];	/* megapixels */
+	int	n_sizes;
+	int	colors[BENCH_LIST];	/* into bench_colors */
+	int	n_colors;
+	int	interpolations[BENCH_LIST];
+	int	n_interpolations;
+	int	shifts[BENCH_LIST];	/* into bench_shifts */
+	int	n_shifts;
+	const char	*images;	/* directory of PNG files, or NULL */
+	double	seconds;		/* least time to spend on a case */
+	double	memory;			/* MiB a case may use, 0 for any */
+	int	check;			/* compare the ways of running the core */
+	const char	*speed;		/* baseline file to compare with */
+	const char	*record;	/* baseline file to write */
+	double	tolerance;		/* slower than the baseline, percent */
+} BenchOptions;
+
+/* Local function prototypes */
+static void	usage (FILE *fp);
+static int	parse_list (const char *arg, const char *const *names, int n_names,
+			    int *list);
+static void	store (unsigned char *ptr, int bpc, double d);
+static void	synthetic (FixCaImage *image, int width, int height, int bpc);
+static void	shifts (FixCaParams *params, int shift);
+static double	throughput (FixCaImage *image, int interpolation, int shift,
+			    double seconds);
+static void	run_case (BenchOptions *opt, const char *file, double mp,
+			  int color, int interpolation, int shift);
+static void	fetch_row (void *user_data, int x, int y, int width,
+			   unsigned char *row);
+static double	difference (const FixCaImage *image, const unsigned char *a,
+			    const unsigned char *b);
+static int	check_paths (int color, int interpolation);
+static double	curve_shift (const double *distance, const double *shift,
+			     int n, double r);
+static int	check_curves (void);
+static int	check_speed (BenchOptions *opt);
+static int	record_speed (const char *file);
+static double	speed_case (FixCaImage *image, int interpolation);
+static void	host_name (char *host, size_t size);
+
+static void usage (FILE *fp)
+{
+	fprintf (fp, "Usage: bench-fix-ca [OPTION]...\n"
+		 "Time the fix-ca core on synthetic images and PNG files.\n\n"
+		 "  --sizes=MP,...          megapixels, default 1,12\n"
+		 "  --bpc=LIST              8,16,32,64,float,double, default all\n"
+		 "  --interpolation=LIST    none,linear,cubic, default all\n"
+		 "  --shifts=LIST           lateral,directional,combined,curve,\n"
+		 "                          default all\n"
+		 "  --images=DIR            also each PNG file in DIR\n"
+		 "  --seconds=S             least time per case, default 0.5\n"
+		 "  --memory=MIB            skip cases needing more, default half\n"
+		 "                          of physical memory\n"
+		 "  --check                 compare the ways of running the core\n"
+		 "  --speed=FILE            compare speed with the baseline in FILE\n"
+		 "  --record=FILE           write this host's speed to FILE\n"
+		 "  --tolerance=PCT         slower than the baseline allowed, 30\n");
+}
+
+/* Comma separated names (or their numbers) into list, returns the count,
+   0 if one isn't known */
+static int parse_list (const char *arg, const char *const *names, int n_names,
+		       int *list)
+{
+	char	*copy = strdup (arg), *word, *save;
+	int	i, n = 0;
+
+	for (word = strtok_r (copy, ",", &save); word != NULL && n < BENCH_LIST; \
+	     word = strtok_r (NULL, ",", &save)) {
+		for (i = 0; i < n_names; i++)
+			if (strcmp (word, names[i]) == 0)
+				break;
+		if (i == n_names && word[0] >= '0' && word[0] <= '9' && \
+		    word[1] == '\0' && word[0] - '0' < n_names)
+			i = word[0] - '0';
+		if (i == n_names) {
+			free (copy);
+			return 0;
+		}
+		list[n++] = i;
+	}
+	free (copy);
+	return n;
+}
+
+static void store (unsigned char *ptr, int bpc, double d)
+{
+	switch (bpc) {
+		case 1: *ptr = (unsigned char) (d * 255 + 0.5); break;
+		case 2: *(uint16_t *) ptr = (uint16_t) (d * 65535 + 0.5); break;
+		case 4: *(uint32_t *) ptr = (uint32_t) (d * 4294967295.0 + 0.5); break;
+		case 8: *(uint64_t *) ptr = (uint64_t) (d * 18446744073709549568.0); break;
+		case -4: *(float *) ptr = (float) d; break;
+		case -8: *(double *) ptr = d; break;
+	}
+}
+
+/* Blocks with sharp edges over a gradient, red and blue a little off
+   from green so there is something to correct */
+static void synthetic (FixCaImage *image, int width, int height, int bpc)
+{
+	size_t	i;
+	int	b = abs (bpc), c, x, y;
+	double	d;
+
+	image->width = width;
+	image->height = height;
+	image->bpc = bpc;
+	image->bytes = 3 * b;
+	image->data = malloc ((size_t) width * height * image->bytes);
+	if (image->data == NULL)
+		return;
+	for (y = 0; y < height; y++)
+		for (x = 0; x < width; x++) {
+			i = ((size_t) y * width + x) * image->bytes;
+			for (c = 0; c < 3; c++) {
+				d = (((x + c) / 37 + (y + c) / 29) & 1) ? 0.8 : 0.2;
+				d += 0.15 * x / width;
+				store (&image->data[i + c * b], bpc, d);
+			}
+		}
+}
+
+static void shifts (FixCaParams *params, int shift)
+{
+	if (shift == 3) {
+		/* Lateral, bent through the same edge amounts */
+		params->blue_curve.n = 2;
+		params->blue_curve.distance[0] = 0.5;
+		params->blue_curve.shift[0] = -1.0;
+		params->blue_curve.distance[1] = 1.0;
+		params->blue_curve.shift[1] = 2.5;
+		params->red_curve.n = 2;
+		params->red_curve.distance[0] = 0.5;
+		params->red_curve.shift[0] = 1.0;
+		params->red_curve.distance[1] = 1.0;
+		params->red_curve.shift[1] = -1.5;
+		return;
+	}
+	if (shift != 1) {
+		params->blue = 2.5;
+		params->red = -1.5;
+	}
+	if (shift != 0) {
+		params->x_blue = 1.5;
+		params->y_red = -1.0;
+	}
+}
+
+/* Mpix/s correcting the whole image for at least seconds, -1 if out of
+   memory */
+static double throughput (FixCaImage *image, int interpolation, int shift,
+			  double seconds)
+{
+	FixCaParams	params;
+	FixCaContext	ctx;
+	FixCaWindow	win;
+	unsigned char	*dest;
+	double	start, pixels = 0;
+	int	runs, ret = 0;
+
+	if ((dest = malloc ((size_t) image->width * image->height * \
+			    image->bytes)) == NULL)
+		return -1;
+	memset (&params, 0, sizeof (params));
+	params.lens_x = image->width / 2;
+	params.lens_y = image->height / 2;
+	params.interpolation = interpolation;
+	shifts (&params, shift);
+	memset (&win, 0, sizeof (win));
+	win.data = image->data;
+	win.width = image->width;
+	win.height = image->height;
+	fix_ca_context_init (&ctx, &params, image->width, image->height, \
+			     image->bytes, image->bpc);
+
+	start = fix_ca_stats_now ();
+	for (runs = 0; ret == 0 && (runs == 0 || \
+	     fix_ca_stats_now () - start < seconds); runs++) {
+		ret = fix_ca_run (&ctx, &win, dest, 0, image->width, 0, image->height);
+		pixels += (double) image->width * image->height;
+	}
+	seconds = fix_ca_stats_now () - start;
+	fix_ca_context_clear (&ctx);
+	free (dest);
+	return ret ? -1 : pixels / seconds / 1e6;
+}
+
+/* In a child process, so peak memory is the case's own */
+static void run_case (BenchOptions *opt, const char *file, double mp,
+		      int color, int interpolation, int shift)
+{
+	FixCaImage	image;
+	const char	*err = NULL;
+	double	mpix, rss = -1;
+	int	width = 0, height = 0, bpc = bench_colors[color].bpc;
+	char	label[64];
+	pid_t	pid;
+
+	if (file == NULL) {
+		width = (int) sqrt (mp * 1e6 * 1.5);
+		height = (int) (width / 1.5);
+		snprintf (label, sizeof (label), "%g MP", mp);
+		if (opt->memory > 0 && 2.0 * width * height * 3 * abs (bpc) > \
+		    opt->memory * 1048576.0) {
+			printf ("%-32s %-7s %-7s %-12s skipped, over --memory\n", \
+				label, bench_colors[color].name, \
+				bench_interpolations[interpolation], bench_shifts[shift]);
+			return;
+		}
+	} else {
+		snprintf (label, sizeof (label), "%.32s", strrchr (file, '/') != NULL ? \
+			  strrchr (file, '/') + 1 : file);
+	}
+
+	fflush (stdout);
+	if ((pid = fork ()) < 0) {
+		perror ("bench-fix-ca: fork");
+		return;
+	}
+	if (pid > 0) {
+		waitpid (pid, NULL, 0);
+		return;
+	}
+
+	if (file == NULL)
+		synthetic (&image, width, height, bpc);
+	else if ((err = fix_ca_image_load (file, fix_ca_image_format (file), \
+					   &image)) != NULL) {
+		printf ("%-32s %s\n", label, err);
+		exit (1);
+	}
+	if (image.data == NULL || \
+	    (mpix = throughput (&image, interpolation, shift, opt->seconds)) < 0) {
+		printf ("%-32s not enough memory\n", label);
+		exit (1);
+	}
+
+#ifdef HAVE_SYS_RESOURCE_H
+	{
+		struct rusage	ru;
+		if (getrusage (RUSAGE_SELF, &ru) == 0)
+			rss = ru.ru_maxrss / 1024.0;
+	}
+#endif
+	printf ("%-32s %-7s %-7s %-12s %9.2f %9.1f\n", label, \
+		file == NULL ? bench_colors[color].name : \
+		image.bpc == 2 ? "16" : image.bpc == -4 ? "float" : "8", \
+		bench_interpolations[interpolation], bench_shifts[shift], \
+		mpix, rss);
+	exit (0);
+}
+
+static void fetch_row (void *user_data, int x, int y, int width,
+		       unsigned char *row)
+{
+	FixCaImage	*image = user_data;
+
+	memcpy (row, &image->data[((size_t) y * image->width + x) * image->bytes], \
+		(size_t) width * image->bytes);
+}
+
+/* Largest difference of the colors of a and b, as a fraction of white */
+static double difference (const FixCaImage *image, const unsigned char *a,
+			  const unsigned char *b)
+{
+	size_t	i, n = (size_t) image->width * image->height * 3;
+	double	d, max = 0.0;
+	int	bpc = image->bpc, s = abs (bpc);
+
+	for (i = 0; i < n; i++, a += s, b += s) {
+		switch (bpc) {
+			case 1: d = (*a - *b) / 255.0; break;
+			case 2: d = (*(const uint16_t *) a - *(const uint16_t *) b) / 65535.0; break;
+			case 4: d = ((double) *(const uint32_t *) a - *(const uint32_t *) b) / 4294967295.0; break;
+			case 8: d = ((double) *(const uint64_t *) a - (double) *(const uint64_t *) b) / 18446744073709551615.0; break;
+			case -4: d = *(const float *) a - *(const float *) b; break;
+			default: d = *(const double *) a - *(const double *) b; break;
+		}
+		if (fabs (d) > max)
+			max = fabs (d);
+	}
+	return max;
+}
+
+/* Each way of running the core against fix_ca_region(), returns the
+   number that differ */
+static int check_paths (int color, int interpolation)
+{
+	FixCaImage	image;
+	FixCaParams	params;
+	FixCaContext	ctx;
+	FixCaRemap	remap;
+	FixCaWindow	win, tile;
+	unsigned char	*ref, *out, *tmp, *part;
+	size_t	size, row;
+	double	score, d, bound;
+	int	i, x, y, x2, y2, r, failed = 0, bpc = bench_colors[color].bpc;
+	const char	*what = bench_interpolations[interpolation];
+
+	synthetic (&image, CHECK_WIDTH, CHECK_HEIGHT, bpc);
+	size = (size_t) CHECK_WIDTH * CHECK_HEIGHT * image.bytes;
+	ref = malloc (size);
+	out = malloc (size);
+	tmp = malloc (size);
+	part = malloc (size);
+	if (image.data == NULL || ref == NULL || out == NULL || tmp == NULL || \
+	    part == NULL) {
+		printf ("not enough memory\n");
+		return 1;
+	}
+
+	/* Lens off center and every shift, so edges are clipped */
+	memset (&params, 0, sizeof (params));
+	params.lens_x = 120;
+	params.lens_y = 90;
+	params.interpolation = interpolation;
+	params.blue = 5.0;
+	params.red_curve.n = 3;		/* red bent, blue straight */
+	params.red_curve.distance[0] = 0.3;
+	params.red_curve.shift[0] = -3.0;
+	params.red_curve.distance[1] = 0.6;
+	params.red_curve.shift[1] = 1.5;
+	params.red_curve.distance[2] = 1.0;
+	params.red_curve.shift[2] = -4.0;
+	params.x_blue = 2.5;
+	params.y_blue = -1.5;
+	params.x_red = -2.0;
+	params.y_red = 1.25;
+	memset (&win, 0, sizeof (win));
+	win.data = image.data;
+	win.width = CHECK_WIDTH;
+	win.height = CHECK_HEIGHT;
+	r = fix_ca_region (&win, ref, CHECK_WIDTH, CHECK_HEIGHT, image.bytes, \
+			   bpc, &params, 0, CHECK_WIDTH, 0, CHECK_HEIGHT, NULL);
+
+	/* Tiles, each with its own window, sharing remap tables and the
+	   row cache, as the plug-in and fix-ca-cli do */
+	fix_ca_context_init (&ctx, &params, CHECK_WIDTH, CHECK_HEIGHT, \
+			     image.bytes, bpc);
+	r |= fix_ca_remap_init (&remap, &params, CHECK_WIDTH, CHECK_HEIGHT);
+	ctx.remap = &remap;
+	for (y = 0; r == 0 && y < CHECK_HEIGHT; y += CHECK_TILE)
+		for (x = 0; r == 0 && x < CHECK_WIDTH; x += CHECK_TILE) {
+			x2 = x + CHECK_TILE < CHECK_WIDTH ? x + CHECK_TILE : CHECK_WIDTH;
+			y2 = y + CHECK_TILE < CHECK_HEIGHT ? y + CHECK_TILE : CHECK_HEIGHT;
+			fix_ca_source_rect (&params, CHECK_WIDTH, CHECK_HEIGHT, \
+					    x, x2, y, y2, &tile);
+			row = (size_t) tile.width * image.bytes;
+			for (i = 0; i < tile.height; i++)
+				memcpy (&part[i * row], &image.data[(((size_t) tile.y + i) * \
+					CHECK_WIDTH + tile.x) * image.bytes], row);
+			tile.data = part;
+			r = fix_ca_run (&ctx, &tile, tmp, x, x2, y, y2);
+			row = (size_t) (x2 - x) * image.bytes;
+			for (i = 0; i < y2 - y; i++)
+				memcpy (&out[((size_t) (y + i) * CHECK_WIDTH + x) * \
+					image.bytes], &tmp[i * row], row);
+		}
+	fix_ca_context_clear (&ctx);
+	fix_ca_remap_clear (&remap);
+	if (r == 0 && memcmp (ref, out, size) != 0) {
+		printf ("%-7s %-7s tiled, shared remap: differs\n", \
+			bench_colors[color].name, what);
+		failed++;
+	}
+
+	/* Rows through fetch_row(), as for Gimp tiles */
+	tile = win;
+	tile.data = NULL;
+	tile.fetch_row = fetch_row;
+	tile.user_data = &image;
+	r |= fix_ca_region (&tile, out, CHECK_WIDTH, CHECK_HEIGHT, image.bytes, \
+			    bpc, &params, 0, CHECK_WIDTH, 0, CHECK_HEIGHT, NULL);
+	if (r == 0 && memcmp (ref, out, size) != 0) {
+		printf ("%-7s %-7s fetch_row: differs\n", bench_colors[color].name, what);
+		failed++;
+	}
+
+	/* Red, then blue over that, as the preview redoes one channel */
+	r |= fix_ca_region_channels (&win, tmp, CHECK_WIDTH, CHECK_HEIGHT, \
+				     image.bytes, bpc, &params, 0, CHECK_WIDTH, \
+				     0, CHECK_HEIGHT, NULL, FIX_CA_CHANNEL_RED);
+	tile = win;
+	tile.data = tmp;
+	r |= fix_ca_region_channels (&tile, out, CHECK_WIDTH, CHECK_HEIGHT, \
+				     image.bytes, bpc, &params, 0, CHECK_WIDTH, \
+				     0, CHECK_HEIGHT, NULL, FIX_CA_CHANNEL_BLUE);
+	if (r == 0 && memcmp (ref, out, size) != 0) {
+		printf ("%-7s %-7s one channel at a time: differs\n", \
+			bench_colors[color].name, what);
+		failed++;
+	}
+
+	/* The sweep's sheet, in floats, linear only */
+	if (interpolation == FIX_CA_INTERPOLATION_LINEAR) {
+		r |= fix_ca_sweep (&win, CHECK_WIDTH, CHECK_HEIGHT, image.bytes, \
+				   bpc, &params, 1, 0, CHECK_WIDTH, 0, CHECK_HEIGHT, \
+				   &score, out, 1);
+		bound = bpc == 1 ? 1 / 255.0 : 1 / 65535.0;
+		if (r == 0 && (d = difference (&image, ref, out)) > bound * 1.0001) {
+			printf ("%-7s %-7s sweep: off by %g, more than %g\n", \
+				bench_colors[color].name, what, d, bound);
+			failed++;
+		}
+	}
+
+	if (r != 0) {
+		printf ("%-7s %-7s not enough memory\n", bench_colors[color].name, what);
+		failed++;
+	}
+	free (image.data);
+	free (ref);
+	free (out);
+	free (tmp);
+	free (part);
+	return failed;
+}
+
+/* Best of CHECK_RUNS timings of image in Mpix/s, combined shifts */
+static double speed_case (FixCaImage *image, int interpolation)
+{
+	double	mpix, best = 0;
+	int	r;
+
+	for (r = 0; r < CHECK_RUNS; r++)
+		if ((mpix = throughput (image, interpolation, 2, 0.15)) > best)
+			best = mpix;
+	return best;
+}
+
+/* The host name baselines are kept under */
+static void host_name (char *host, size_t size)
+{
+	if (gethostname (host, size) != 0 || host[0] == '\0')
+		strcpy (host, "localhost");
+	host[size - 1] = '\0';
+}
+
+/* Times the fixed cases and appends them to file, where they take the
+   place of any this host had before, returns 1 on failure */
+static int record_speed (const char *file)
+{
+	FixCaImage	image;
+	FILE	*fp;
+	char	host[64], key[32];
+	double	best;
+	int	c, i;
+	int	width = (int) sqrt (CHECK_MP * 1e6 * 1.5);
+
+	host_name (host, sizeof (host));
+	if ((fp = fopen (file, "a")) == NULL) {
+		perror (file);
+		return 1;
+	}
+	for (c = 0; c < 3; c++) {
+		synthetic (&image, width, (int) (width / 1.5), \
+			   bench_colors[check_colors[c]].bpc);
+		if (image.data == NULL) {
+			printf ("not enough memory\n");
+			fclose (fp);
+			return 1;
+		}
+		for (i = 0; i < 3; i++) {
+			snprintf (key, sizeof (key), "%s/%s", \
+				  bench_colors[check_colors[c]].name, bench_interpolations[i]);
+			best = speed_case (&image, i);
+			fprintf (fp, "%s %s %.3f\n", host, key, best);
+			printf ("%-14s %9.2f Mpix/s, recorded\n", key, best);
+		}
+		free (image.data);
+	}
+	return fclose (fp) != 0;
+}
+
+/* A curve's shift at r, worked out apart from curve_at() */
+static double curve_shift (const double *distance, const double *shift,
+			   int n, double r)
+{
+	double	r0 = 0.0, s0 = 0.0;
+	int	k;
+
+	for (k = 0; k < n; k++) {
+		if (r <= distance[k] || k == n - 1)
+			return s0 + (shift[k] - s0) * (r - r0) / (distance[k] - r0);
+		r0 = distance[k];
+		s0 = shift[k];
+	}
+	return 0.0;
+}
+
+/* Each pixel of a 32 bit image holds its own index, so the result tells
+   where every color came from.  A pixel at dx, dy from the lens center
+   should come from dx - s(r) dx / r, dy - s(r) dy / r, r its radius, but
+   curves are looked up per axis, s(|dx|) along x and s(|dy|) along y.
+   On the axes those are the same, and off them for a straight blue
+   curve through the center; the bent red one must follow the per axis
+   lookup.  Returns the number of pixels that are wrong. */
+static int check_curves (void)
+{
+	static const double	blue_d[] = { 1.0 }, blue_s[] = { 6.0 };
+	static const double	red_d[] = { 0.3, 1.0 }, red_s[] = { 6.0, 0.0 };
+	static const int	points[][2] = {
+		{ 60, 0 }, { 0, -50 }, { 60, 60 }, { -50, -50 }, { 45, -80 }
+	};
+	FixCaImage	image;
+	FixCaParams	params;
+	FixCaWindow	win;
+	unsigned char	*out;
+	uint32_t	v;
+	double	radius, r, s, e[2];
+	int	c, i, k, x, y, dx, dy, failed = 0;
+
+	image.width = CHECK_WIDTH;
+	image.height = CHECK_HEIGHT;
+	image.bpc = 4;
+	image.bytes = 3 * 4;
+	image.data = malloc ((size_t) CHECK_WIDTH * CHECK_HEIGHT * image.bytes);
+	out = malloc ((size_t) CHECK_WIDTH * CHECK_HEIGHT * image.bytes);
+	if (image.data == NULL || out == NULL) {
+		printf ("not enough memory\n");
+		free (image.data);
+		free (out);
+		return 1;
+	}
+	for (i = 0; i < CHECK_WIDTH * CHECK_HEIGHT; i++)
+		for (c = 0; c < 3; c++) {
+			v = (uint32_t) i;
+			memcpy (&image.data[(size_t) i * image.bytes + c * 4], &v, 4);
+		}
+
+	memset (&params, 0, sizeof (params));
+	params.lens_x = 120;
+	params.lens_y = 90;
+	params.interpolation = FIX_CA_INTERPOLATION_NONE;
+	params.blue_curve.n = 1;
+	params.blue_curve.distance[0] = blue_d[0];
+	params.blue_curve.shift[0] = blue_s[0];
+	params.red_curve.n = 2;
+	for (k = 0; k < 2; k++) {
+		params.red_curve.distance[k] = red_d[k];
+		params.red_curve.shift[k] = red_s[k];
+	}
+	memset (&win, 0, sizeof (win));
+	win.data = image.data;
+	win.width = CHECK_WIDTH;
+	win.height = CHECK_HEIGHT;
+	if (fix_ca_region (&win, out, CHECK_WIDTH, CHECK_HEIGHT, image.bytes, \
+			   4, &params, 0, CHECK_WIDTH, 0, CHECK_HEIGHT, NULL) != 0) {
+		printf ("curves: fix_ca_region failed\n");
+		free (image.data);
+		free (out);
+		return 1;
+	}
+
+	/* Furthest edge, right of the center */
+	radius = CHECK_WIDTH - params.lens_x;
+	for (i = 0; i < (int) (sizeof (points) / sizeof (points[0])); i++) {
+		dx = points[i][0];
+		dy = points[i][1];
+		x = (int) params.lens_x + dx;
+		y = (int) params.lens_y + dy;
+		for (c = 0; c < 3; c += 2) {
+			if (c == 2) {
+				/* Radial */
+				r = sqrt ((double) dx * dx + (double) dy * dy);
+				s = curve_shift (blue_d, blue_s, 1, r / radius);
+				e[0] = x - s * dx / r;
+				e[1] = y - s * dy / r;
+			} else {
+				/* Per axis */
+				s = curve_shift (red_d, red_s, 2, abs (dx) / radius);
+				e[0] = x - (dx < 0 ? -s : s);
+				s = curve_shift (red_d, red_s, 2, abs (dy) / radius);
+				e[1] = y - (dy < 0 ? -s : s);
+			}
+			memcpy (&v, &out[((size_t) y * CHECK_WIDTH + x) * image.bytes + c * 4], 4);
+			if ((int) v % CHECK_WIDTH != (int) floor (e[0] + 0.5) || \
+			    (int) v / CHECK_WIDTH != (int) floor (e[1] + 0.5)) {
+				printf ("curves: %s at %d,%d from %d,%d, not %.2f,%.2f\n", \
+					c == 2 ? "blue" : "red", x, y, (int) v % CHECK_WIDTH, \
+					(int) v / CHECK_WIDTH, e[0], e[1]);
+				failed++;
+			}
+		}
+	}
+	if (failed == 0)
+		printf ("curves: on and off the axes, from where they should be\n");
+	free (image.data);
+	free (out);
+	return failed;
+}
+
+/* Fixed cases against the last baseline of this host in opt->speed,
+   returns the number that are slower than it allows, or have none */
+static int check_speed (BenchOptions *opt)
+{
+	FixCaImage	image;
+	FILE	*fp;
+	char	host[64], line[256], h[64], name[32], key[32];
+	double	best, base, b;
+	int	c, i, failed = 0;
+	int	width = (int) sqrt (CHECK_MP * 1e6 * 1.5);
+
+	host_name (host, sizeof (host));
+	for (c = 0; c < 3; c++) {
+		synthetic (&image, width, (int) (width / 1.5), \
+			   bench_colors[check_colors[c]].bpc);
+		if (image.data == NULL) {
+			printf ("not enough memory\n");
+			return 1;
+		}
+		for (i = 0; i < 3; i++) {
+			snprintf (key, sizeof (key), "%s/%s", \
+				  bench_colors[check_colors[c]].name, bench_interpolations[i]);
+			base = 0;
+			if ((fp = fopen (opt->speed, "r")) != NULL) {
+				while (fgets (line, sizeof (line), fp) != NULL)
+					if (sscanf (line, "%63s %31s %lf", h, name, &b) == 3 && \
+					    strcmp (h, host) == 0 && strcmp (name, key) == 0)
+						base = b;
+				fclose (fp);
+			}
+			if (base <= 0) {
+				printf ("%-14s no baseline for %s in %s\n", key, host, opt->speed);
+				failed++;
+				continue;
+			}
+			best = speed_case (&image, i);
+			printf ("%-14s %9.2f Mpix/s, baseline %.2f, %+.0f%%", key, best, \
+				base, 100 * (best - base) / base);
+			if (best < base * (1 - opt->tolerance / 100)) {
+				printf (", slower than %.0f%% allows\n", opt->tolerance);
+				failed++;
+			} else
+				printf ("\n");
+		}
+		free (image.data);
+	}
+	return failed;
+}
+
+int main (int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "sizes",		required_argument, NULL, 's' },
+		{ "bpc",		required_argument, NULL, 'b' },
+		{ "interpolation",	required_argument, NULL, 'i' },
+		{ "shifts",		required_argument, NULL, 'k' },
+		{ "images",		required_argument, NULL, 'd' },
+		{ "seconds",		required_argument, NULL, 't' },
+		{ "memory",		required_argument, NULL, 'm' },
+		{ "check",		no_argument, NULL, 'c' },
+		{ "speed",		required_argument, NULL, 'S' },
+		{ "record",		required_argument, NULL, 'r' },
+		{ "tolerance",		required_argument, NULL, 'T' },
+		{ "help",		no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	const char	*color_names[sizeof (bench_colors) / sizeof (bench_colors[0])];
+	BenchOptions	opt;
+	DIR	*dir;
+	struct dirent	*entry;
+	char	*copy, *word, *save, *file;
+	int	c, i, s, k, n;
+	long	pages, page_size;
+
+	memset (&opt, 0, sizeof (opt));
+	opt.sizes[0] = 1;
+	opt.sizes[1] = 12;
+	opt.n_sizes = 2;
+	opt.n_colors = (int) (sizeof (bench_colors) / sizeof (bench_colors[0]));
+	for (i = 0; i < opt.n_colors; i++) {
+		opt.colors[i] = i;
+		color_names[i] = bench_colors[i].name;
+	}
+	opt.n_interpolations = 3;
+	opt.n_shifts = 4;
+	for (i = 0; i < 3; i++)
+		opt.interpolations[i] = i;
+	for (i = 0; i < 4; i++)
+		opt.shifts[i] = i;
+	opt.seconds = 0.5;
+	opt.tolerance = 30;
+	pages = sysconf (_SC_PHYS_PAGES);
+	page_size = sysconf (_SC_PAGESIZE);
+	if (pages > 0 && page_size > 0)
+		opt.memory = (double) pages * page_size / 2 / 1048576.0;
+
+	while ((c = getopt_long (argc, argv, "h", long_options, NULL)) != -1) {
+		n = 1;
+		switch (c) {
+			case 's':
+				copy = strdup (optarg);
+				opt.n_sizes = 0;
+				for (word = strtok_r (copy, ",", &save); word != NULL && \
+				     opt.n_sizes < BENCH_LIST; word = strtok_r (NULL, ",", &save))
+					if ((opt.sizes[opt.n_sizes++] = atof (word)) <= 0)
+						n = 0;
+				free (copy);
+				break;
+			case 'b':
+				n = opt.n_colors = parse_list (optarg, color_names, \
+					(int) (sizeof (bench_colors) / sizeof (bench_colors[0])), \
+					opt.colors);
+				break;
+			case 'i':
+				n = opt.n_interpolations = parse_list (optarg, \
+					bench_interpolations, 3, opt.interpolations);
+				break;
+			case 'k':
+				n = opt.n_shifts = parse_list (optarg, bench_shifts, 4, opt.shifts);
+				break;
+			case 'd':
+				opt.images = optarg;
+				break;
+			case 't':
+				opt.seconds = atof (optarg);
+				break;
+			case 'm':
+				opt.memory = atof (optarg);
+				break;
+			case 'c':
+				opt.check = 1;
+				break;
+			case 'S':
+				opt.speed = optarg;
+				break;
+			case 'r':
+				opt.record = optarg;
+				break;
+			case 'T':
+				opt.tolerance = atof (optarg);
+				n = opt.tolerance >= 0 && opt.tolerance < 100;
+				break;
+			case 'h':
+				usage (stdout);
+				return 0;
+			default:
+				usage (stderr);
+				return 2;
+		}
+		if (n == 0) {
+			fprintf (stderr, "bench-fix-ca: bad value %s\n", optarg);
+			return 2;
+		}
+	}
+
+	if (opt.check || opt.speed != NULL || opt.record != NULL) {
+		n = 0;
+		if (opt.check) {
+			for (c = 0; c < (int) (sizeof (bench_colors) / sizeof (bench_colors[0])); c++)
+				for (i = 0; i < 3; i++)
+					n += check_paths (c, i);
+			if (n == 0)
+				printf ("tiled, fetch_row, per channel and sweep results match\n");
+			n += check_curves ();
+		}
+		if (opt.record != NULL)
+			n += record_speed (opt.record);
+		if (opt.speed != NULL)
+			n += check_speed (&opt);
+		return n != 0;
+	}
+
+	printf ("%-32s %-7s %-7s %-12s %9s %9s\n", "image", "bpc", "interp", \
+		"shifts", "Mpix/s", "RSS MiB");
+	for (s = 0; s < opt.n_sizes; s++)
+		for (c = 0; c < opt.n_colors; c++)
+			for (i = 0; i < opt.n_interpolations; i++)
+				for (k = 0; k < opt.n_shifts; k++)
+					run_case (&opt, NULL, opt.sizes[s], opt.colors[c], \
+						  opt.interpolations[i], opt.shifts[k]);
+
+	/* Real photos, combined shifts, in whatever format they are */
+	if (opt.images != NULL && (dir = opendir (opt.images)) != NULL) {
+		while ((entry = readdir (dir)) != NULL) {
+			n = (int) strlen (entry->d_name);
+			if (n < 5 || strcmp (entry->d_name + n - 4, ".png") != 0)
+				continue;
+			if ((file = malloc (strlen (opt.images) + n + 2)) == NULL)
+				break;
+			sprintf (file, "%s/%s", opt.images, entry->d_name);
+			for (i = 0; i < opt.n_interpolations; i++)
+				run_case (&opt, file, 0, 0, opt.interpolations[i], 2);
+			free (file);
+		}
+		closedir (dir);
+	}
+	return 0;
+}
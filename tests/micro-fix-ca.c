@@ -0,0 +1,498 @@
+/*
+	micro-fix-ca.c	Fix Chromatic Aberration, speed of the inner functions
+	Copyright (c) 2023, 2024 Jose Da Silva (updates and improvements)
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* Times each hot function of fix-ca on its own, in ns per sample, with
+   a 95% confidence interval over repeated runs.  The plug-in is included
+   whole, like test-fix-ca.c does, so its static functions and the preview
+   functions saturate() and centerline() can be called, MICRO_FIX_CA
+   leaves out its MAIN().  Run by "make micro".
+
+   Source columns and rows come from remap_fill() for three sets of
+   shifts: "monotonic", every pixel moved by under a pixel so sources go
+   up one by one, "lateral", the usual scaling about the lens center, and
+   "worst", every shift at its limit INPUT_MAX.  A sample is one call,
+   except for centerline(), where it is one preview row. */
+
+#define MICRO_FIX_CA 1
+#include "../fix-ca.c"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MICRO_WIDTH	1536
+#define MICRO_HEIGHT	1024
+#define MICRO_LIST	16
+
+typedef struct {
+	const char	*name;
+	int	bpc;
+} MicroColor;
+
+static const MicroColor micro_colors[] = {
+	{ "8", 1 }, { "16", 2 }, { "32", 4 }, { "64", 8 },
+	{ "float", -4 }, { "double", -8 }
+};
+#define MICRO_COLORS	(int) (sizeof (micro_colors) / sizeof (micro_colors[0]))
+
+static const char *micro_patterns[] = { "monotonic", "lateral", "worst" };
+#define MICRO_PATTERNS	3
+
+/* Image and source tables of one case */
+typedef struct {
+	int	bpc, b, bytes;
+	unsigned char	*data;		/* MICRO_WIDTH x MICRO_HEIGHT, RGB */
+	unsigned char	*out;		/* one row */
+	double	*values;		/* one row of 3 doubles per pixel */
+	double	xb[MICRO_WIDTH], xr[MICRO_WIDTH];
+	double	yb[MICRO_HEIGHT], yr[MICRO_HEIGHT];
+	int	y;			/* next row to use */
+	int	n_rows;			/* row cache for load_data() */
+	unsigned char	*rows, **src;
+	int	*src_row, *src_iter;
+} MicroCase;
+
+/* Run one unit of work, returns the samples in it */
+typedef long	(*MicroKernel) (MicroCase *mc);
+
+typedef struct {
+	const char	*name;
+	MicroKernel	kernel;
+	int	patterns;	/* depends on the source pattern */
+} MicroEntry;
+
+static volatile double	micro_sink;
+
+/* Local function prototypes */
+static long	k_get_pixel (MicroCase *mc);
+static long	k_set_pixel (MicroCase *mc);
+static long	k_bilinear (MicroCase *mc);
+static long	k_cubicY (MicroCase *mc);
+static long	k_cubicX (MicroCase *mc);
+static long	k_saturate (MicroCase *mc);
+static long	k_centerline (MicroCase *mc);
+static long	k_load_data (MicroCase *mc);
+static int	micro_case_init (MicroCase *mc, int bpc, int pattern);
+static void	micro_case_clear (MicroCase *mc);
+static int	double_cmp (const void *a, const void *b);
+static double	t_95 (int df);
+static void	micro_run (const MicroEntry *entry, int color, int pattern,
+			   int reps, double min_time);
+static int	parse_list (const char *arg, const char *const *names,
+			    int n_names, int *list);
+
+static const MicroEntry micro_kernels[] = {
+	{ "get_pixel",	k_get_pixel,	0 },
+	{ "set_pixel",	k_set_pixel,	0 },
+	{ "bilinear",	k_bilinear,	1 },
+	{ "cubicY",	k_cubicY,	1 },
+	{ "cubicX",	k_cubicX,	0 },
+	{ "saturate",	k_saturate,	0 },
+	{ "centerline",	k_centerline,	0 },
+	{ "load_data",	k_load_data,	1 }
+};
+#define MICRO_KERNELS	(int) (sizeof (micro_kernels) / sizeof (micro_kernels[0]))
+
+static long k_get_pixel (MicroCase *mc)
+{
+	unsigned char	*row = &mc->data[(size_t) mc->y * MICRO_WIDTH * mc->bytes];
+	double	d = 0.0;
+	int	i;
+
+	for (i = 0; i < 3 * MICRO_WIDTH; i++)
+		d += get_pixel (&row[i * mc->b], mc->bpc);
+	micro_sink = d;
+	mc->y = (mc->y + 1) % MICRO_HEIGHT;
+	return 3 * MICRO_WIDTH;
+}
+
+static long k_set_pixel (MicroCase *mc)
+{
+	int	i;
+
+	for (i = 0; i < 3 * MICRO_WIDTH; i++)
+		set_pixel (&mc->out[i * mc->b], mc->values[i], mc->bpc);
+	micro_sink = mc->out[0];
+	return 3 * MICRO_WIDTH;
+}
+
+/* Blue and red of one row, as fix_ca_run() does them */
+static long k_bilinear (MicroCase *mc)
+{
+	int	bytes = mc->bytes, b = mc->b, x, x0, y0, y1;
+	unsigned char	*r0, *r1;
+	double	dx, dy;
+
+	y0 = (int) floor (mc->yb[mc->y]);
+	y1 = y0 < MICRO_HEIGHT-1 ? y0+1 : y0;
+	dy = mc->yb[mc->y] - y0;
+	r0 = &mc->data[(size_t) y0 * MICRO_WIDTH * bytes + 2*b];
+	r1 = &mc->data[(size_t) y1 * MICRO_WIDTH * bytes + 2*b];
+	for (x = 0; x < MICRO_WIDTH; x++) {
+		x0 = (int) floor (mc->xb[x]);
+		dx = mc->xb[x] - x0;
+		bilinear (&mc->out[x*bytes + 2*b], r0, r1, x0, \
+			  x0 < MICRO_WIDTH-1 ? x0+1 : x0, bytes, mc->bpc, dx, dy);
+	}
+
+	y0 = (int) floor (mc->yr[mc->y]);
+	y1 = y0 < MICRO_HEIGHT-1 ? y0+1 : y0;
+	dy = mc->yr[mc->y] - y0;
+	r0 = &mc->data[(size_t) y0 * MICRO_WIDTH * bytes];
+	r1 = &mc->data[(size_t) y1 * MICRO_WIDTH * bytes];
+	for (x = 0; x < MICRO_WIDTH; x++) {
+		x0 = (int) floor (mc->xr[x]);
+		dx = mc->xr[x] - x0;
+		bilinear (&mc->out[x*bytes], r0, r1, x0, \
+			  x0 < MICRO_WIDTH-1 ? x0+1 : x0, bytes, mc->bpc, dx, dy);
+	}
+	mc->y = (mc->y + 1) % MICRO_HEIGHT;
+	return 2 * MICRO_WIDTH;
+}
+
+/* Four rows of blue around the source row, one cubicY() each */
+static long k_cubicY (MicroCase *mc)
+{
+	int	bytes = mc->bytes, x, x0, r, y0;
+	unsigned char	*row;
+	double	d = 0.0, dx;
+
+	y0 = (int) floor (mc->yb[mc->y]);
+	for (r = -1; r <= 2; r++) {
+		row = &mc->data[(size_t) fmin (fmax (y0 + r, 0), MICRO_HEIGHT-1) * \
+				MICRO_WIDTH * bytes + 2*mc->b];
+		for (x = 0; x < MICRO_WIDTH; x++) {
+			x0 = (int) floor (mc->xb[x]);
+			dx = mc->xb[x] - x0;
+			d += cubicY (row, bytes, mc->bpc, dx, x0 > 0 ? x0-1 : 0, x0, \
+				     x0 < MICRO_WIDTH-1 ? x0+1 : x0, \
+				     x0 < MICRO_WIDTH-2 ? x0+2 : MICRO_WIDTH-1);
+		}
+	}
+	micro_sink = d;
+	mc->y = (mc->y + 1) % MICRO_HEIGHT;
+	return 4 * MICRO_WIDTH;
+}
+
+static long k_cubicX (MicroCase *mc)
+{
+	double	*v = mc->values;
+	int	x;
+
+	for (x = 0; x < MICRO_WIDTH; x++)
+		cubicX (&mc->out[x * mc->bytes], mc->bytes, mc->bpc, 0.3, \
+			v[3*x], v[3*x+1], v[3*x+2], v[(3*x+3) % (3*MICRO_WIDTH)]);
+	micro_sink = mc->out[0];
+	return MICRO_WIDTH;
+}
+
+static long k_saturate (MicroCase *mc)
+{
+	memcpy (mc->out, &mc->data[(size_t) mc->y * MICRO_WIDTH * mc->bytes], \
+		(size_t) MICRO_WIDTH * mc->bytes);
+	saturate (mc->out, MICRO_WIDTH, mc->bytes, mc->bpc, 1.5);
+	micro_sink = mc->out[0];
+	mc->y = (mc->y + 1) % MICRO_HEIGHT;
+	return MICRO_WIDTH;
+}
+
+/* Rows down the preview, the center one dashed */
+static long k_centerline (MicroCase *mc)
+{
+	centerline (mc->out, MICRO_WIDTH, mc->bytes, mc->bpc, 0, mc->y, \
+		    MICRO_WIDTH/2, MICRO_HEIGHT/2);
+	micro_sink = mc->out[0];
+	mc->y = (mc->y + 1) % MICRO_HEIGHT;
+	return 1;
+}
+
+/* Every row of the image through the row cache, green then rows y, y+1
+   of blue and red, as for linear interpolation */
+static long k_load_data (MicroCase *mc)
+{
+	unsigned char	**src = mc->src;
+	int	*src_row = mc->src_row, *src_iter = mc->src_iter, n = mc->n_rows;
+	size_t	row_size = (size_t) MICRO_WIDTH * mc->bytes;
+	FixCaWindow	win;
+	long	calls = 0;
+	int	i, y, yb, yr;
+
+	memset (&win, 0, sizeof (win));
+	win.data = mc->data;
+	win.width = MICRO_WIDTH;
+	win.height = MICRO_HEIGHT;
+	for (i = 0; i < n; i++) {
+		src[i] = mc->rows + i * row_size;
+		src_row[i] = ROW_INVALID;
+		src_iter[i] = ITER_INITIAL;
+	}
+	for (y = 0; y < MICRO_HEIGHT; y++) {
+		yb = (int) floor (mc->yb[y]);
+		yr = (int) floor (mc->yr[y]);
+		micro_sink = load_data (&win, NULL, mc->bytes, src, src_row, src_iter, n, y, y)[0];
+		load_data (&win, NULL, mc->bytes, src, src_row, src_iter, n, yb, y);
+		load_data (&win, NULL, mc->bytes, src, src_row, src_iter, n, \
+			   yb < MICRO_HEIGHT-1 ? yb+1 : yb, y);
+		load_data (&win, NULL, mc->bytes, src, src_row, src_iter, n, yr, y);
+		load_data (&win, NULL, mc->bytes, src, src_row, src_iter, n, \
+			   yr < MICRO_HEIGHT-1 ? yr+1 : yr, y);
+		calls += 5;
+	}
+	return calls;
+}
+
+/* Random colors, and source tables for the pattern */
+static int micro_case_init (MicroCase *mc, int bpc, int pattern)
+{
+	FixCaParams	params;
+	size_t	i, n = (size_t) MICRO_WIDTH * MICRO_HEIGHT * 3;
+	unsigned int	seed = 12345;
+	double	d;
+
+	memset (mc, 0, sizeof (*mc));
+	mc->bpc = bpc;
+	mc->b = absolute (bpc);
+	mc->bytes = 3 * mc->b;
+	mc->data = malloc (n * mc->b);
+	mc->out = malloc ((size_t) MICRO_WIDTH * mc->bytes);
+	mc->values = malloc ((size_t) MICRO_WIDTH * 3 * sizeof (double));
+	if (mc->data == NULL || mc->out == NULL || mc->values == NULL) {
+		micro_case_clear (mc);
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		seed = seed * 1103515245 + 12345;
+		d = (seed >> 8) / 16777216.0;
+		set_pixel (&mc->data[i * mc->b], d, bpc);
+		if (i < (size_t) MICRO_WIDTH * 3)
+			mc->values[i] = d;
+	}
+
+	memset (&params, 0, sizeof (params));
+	params.lens_x = MICRO_WIDTH / 2;
+	params.lens_y = MICRO_HEIGHT / 2;
+	if (pattern == 0) {
+		params.x_blue = params.y_blue = 0.4;
+		params.x_red = params.y_red = -0.4;
+	} else if (pattern == 1) {
+		params.blue = 2.5;
+		params.red = -1.5;
+	} else {
+		params.blue = params.x_blue = params.y_blue = INPUT_MAX;
+		params.red = params.x_red = params.y_red = -INPUT_MAX;
+	}
+	remap_fill (&params, MICRO_WIDTH, MICRO_HEIGHT, 0, MICRO_WIDTH, \
+		    0, MICRO_HEIGHT, mc->xb, mc->xr, mc->yb, mc->yr);
+
+	/* As many cached rows as fix_ca_run() would keep */
+	mc->n_rows = fix_ca_source_rows (&params, MICRO_WIDTH, MICRO_HEIGHT, \
+					 0, MICRO_HEIGHT);
+	mc->rows = malloc ((size_t) mc->n_rows * MICRO_WIDTH * mc->bytes);
+	mc->src = malloc ((size_t) mc->n_rows * sizeof (unsigned char *));
+	mc->src_row = malloc ((size_t) mc->n_rows * 2 * sizeof (int));
+	if (mc->rows == NULL || mc->src == NULL || mc->src_row == NULL) {
+		micro_case_clear (mc);
+		return -1;
+	}
+	mc->src_iter = mc->src_row + mc->n_rows;
+	return 0;
+}
+
+static void micro_case_clear (MicroCase *mc)
+{
+	free (mc->data);
+	free (mc->out);
+	free (mc->values);
+	free (mc->rows);
+	free (mc->src);
+	free (mc->src_row);
+}
+
+static int double_cmp (const void *a, const void *b)
+{
+	double	d = *(const double *) a - *(const double *) b;
+	return (d > 0) - (d < 0);
+}
+
+/* Student's t, two sided 95%, for df degrees of freedom */
+static double t_95 (int df)
+{
+	static const double t[] = {
+		12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+		2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101,
+		2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052,
+		2.048, 2.045, 2.042
+	};
+	if (df < 1)
+		return 0.0;
+	return df <= 30 ? t[df-1] : 1.96;
+}
+
+/* Enough units of work to take min_time, timed reps times */
+static void micro_run (const MicroEntry *entry, int color, int pattern,
+		       int reps, double min_time)
+{
+	MicroCase	mc;
+	double	ns[256], start, t, mean = 0.0, var = 0.0, half;
+	long	units = 1, samples, u;
+	int	r;
+
+	if (micro_case_init (&mc, micro_colors[color].bpc, pattern)) {
+		printf ("%-11s %-7s not enough memory\n", entry->name, \
+			micro_colors[color].name);
+		return;
+	}
+
+	/* Warm up, and find how many units fill min_time */
+	for (;;) {
+		start = fix_ca_stats_now ();
+		for (u = 0; u < units; u++)
+			entry->kernel (&mc);
+		if (fix_ca_stats_now () - start >= min_time || units > (1L << 30))
+			break;
+		units *= 2;
+	}
+
+	for (r = 0; r < reps; r++) {
+		samples = 0;
+		start = fix_ca_stats_now ();
+		for (u = 0; u < units; u++)
+			samples += entry->kernel (&mc);
+		t = fix_ca_stats_now () - start;
+		ns[r] = t * 1e9 / samples;
+		mean += ns[r];
+	}
+	mean /= reps;
+	for (r = 0; r < reps; r++)
+		var += (ns[r] - mean) * (ns[r] - mean);
+	var = reps > 1 ? var / (reps - 1) : 0.0;
+	half = t_95 (reps - 1) * sqrt (var / reps);
+	qsort (ns, (size_t) reps, sizeof (double), double_cmp);
+
+	printf ("%-11s %-7s %-10s %10.3f %10.3f %9.3f %5.1f%% %10.3f\n", \
+		entry->name, micro_colors[color].name, \
+		entry->patterns ? micro_patterns[pattern] : "-", \
+		ns[reps / 2], mean, half, mean > 0 ? 100 * half / mean : 0.0, ns[0]);
+	fflush (stdout);
+	micro_case_clear (&mc);
+}
+
+/* Comma separated names into list, returns the count, 0 if one isn't
+   known */
+static int parse_list (const char *arg, const char *const *names, int n_names,
+		       int *list)
+{
+	char	*copy = strdup (arg), *word, *save;
+	int	i, n = 0;
+
+	for (word = strtok_r (copy, ",", &save); word != NULL && n < MICRO_LIST; \
+	     word = strtok_r (NULL, ",", &save)) {
+		for (i = 0; i < n_names; i++)
+			if (strcmp (word, names[i]) == 0)
+				break;
+		if (i == n_names) {
+			free (copy);
+			return 0;
+		}
+		list[n++] = i;
+	}
+	free (copy);
+	return n;
+}
+
+int main (int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "kernels",	required_argument, NULL, 'k' },
+		{ "bpc",	required_argument, NULL, 'b' },
+		{ "patterns",	required_argument, NULL, 'p' },
+		{ "reps",	required_argument, NULL, 'r' },
+		{ "time",	required_argument, NULL, 't' },
+		{ "help",	no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	const char	*kernel_names[MICRO_KERNELS], *color_names[MICRO_COLORS];
+	int	kernels[MICRO_LIST], colors[MICRO_LIST], patterns[MICRO_LIST];
+	int	n_kernels = MICRO_KERNELS, n_colors = MICRO_COLORS;
+	int	n_patterns = MICRO_PATTERNS, reps = 15, c, k, p, n;
+	double	min_time = 0.02;
+
+	for (k = 0; k < MICRO_KERNELS; k++)
+		kernel_names[k] = micro_kernels[k].name;
+	for (c = 0; c < MICRO_COLORS; c++)
+		color_names[c] = micro_colors[c].name;
+	for (n = 0; n < MICRO_LIST; n++)
+		kernels[n] = colors[n] = patterns[n] = n;
+
+	while ((c = getopt_long (argc, argv, "h", long_options, NULL)) != -1) {
+		n = 1;
+		switch (c) {
+			case 'k':
+				n = n_kernels = parse_list (optarg, kernel_names, \
+							    MICRO_KERNELS, kernels);
+				break;
+			case 'b':
+				n = n_colors = parse_list (optarg, color_names, \
+							   MICRO_COLORS, colors);
+				break;
+			case 'p':
+				n = n_patterns = parse_list (optarg, micro_patterns, \
+							     MICRO_PATTERNS, patterns);
+				break;
+			case 'r':
+				reps = atoi (optarg);
+				n = reps >= 2 && reps <= 256;
+				break;
+			case 't':
+				min_time = atof (optarg) / 1000;
+				n = min_time > 0;
+				break;
+			case 'h':
+				printf ("Usage: micro-fix-ca [OPTION]...\n"
+					"Time fix-ca's inner functions, ns per sample.\n\n"
+					"  --kernels=LIST   get_pixel,set_pixel,bilinear,cubicY,cubicX,\n"
+					"                   saturate,centerline,load_data, default all\n"
+					"  --bpc=LIST       8,16,32,64,float,double, default all\n"
+					"  --patterns=LIST  monotonic,lateral,worst, default all\n"
+					"  --reps=N         timed runs per case, default 15\n"
+					"  --time=MS        least time of each run, default 20\n");
+				return 0;
+			default:
+				return 2;
+		}
+		if (n == 0) {
+			fprintf (stderr, "micro-fix-ca: bad value %s\n", optarg);
+			return 2;
+		}
+	}
+
+	printf ("%-11s %-7s %-10s %10s %10s %16s %10s\n", "function", "bpc", \
+		"pattern", "median ns", "mean ns", "95% interval", "min ns");
+	for (k = 0; k < n_kernels; k++)
+		for (c = 0; c < n_colors; c++) {
+			if (!micro_kernels[kernels[k]].patterns) {
+				micro_run (&micro_kernels[kernels[k]], colors[c], 0, \
+					   reps, min_time);
+				continue;
+			}
+			for (p = 0; p < n_patterns; p++)
+				micro_run (&micro_kernels[kernels[k]], colors[c], \
+					   patterns[p], reps, min_time);
+		}
+	return 0;
+}
@@ -4,3 +4,34 @@
   (Test-Fix-CA RUN-NONINTERACTIVE image drawable bluel redl lensx lensy interpolation bluex redx bluey redy)
   (gimp-file-save RUN-NONINTERACTIVE image drawable result result)
   (gimp-image-delete image))
+
+; The same settings on a half size copy, a layer moved off its canvas, then
+; the full size image, in one batch and one at a time, saved as
+; RESULT-{small,large}{-batch,}.bmp.  The batch ones are only saved if it
+; skipped the layer off the canvas and went on.
+(define (test-batch filename result bluel redl interpolation)
+  (define large (car (gimp-file-load RUN-NONINTERACTIVE filename filename)))
+  (define small (car (gimp-image-duplicate large)))
+  (define away (car (gimp-image-duplicate large)))
+  (gimp-image-scale small (quotient (car (gimp-image-width large)) 2) (quotient (car (gimp-image-height large)) 2))
+  (gimp-layer-set-offsets (car (gimp-image-get-active-layer away)) (+ (car (gimp-image-width large)) 10) 0)
+  (let* ((small1 (car (gimp-image-duplicate small)))
+         (large1 (car (gimp-image-duplicate large)))
+         (images (list small large small1 large1))
+         (drawables (map (lambda (i) (car (gimp-image-get-active-layer i))) images))
+         (names (list "-small-batch.bmp" "-large-batch.bmp" "-small.bmp" "-large.bmp"))
+         (skipped (caddr (Test-Fix-CA-batch RUN-NONINTERACTIVE 3 (vector (car drawables) (car (gimp-image-get-active-layer away)) (cadr drawables)) 0 '() bluel redl -1 -1 interpolation 0 0 0 0 0 0 ""))))
+    (Test-Fix-CA RUN-NONINTERACTIVE small1 (caddr drawables) bluel redl -1 -1 interpolation 0 0 0 0)
+    (Test-Fix-CA RUN-NONINTERACTIVE large1 (cadddr drawables) bluel redl -1 -1 interpolation 0 0 0 0)
+    (if (not (= skipped 1))
+      (begin
+        (set! images (cddr images))
+        (set! drawables (cddr drawables))
+        (set! names (cddr names))))
+    (gimp-image-delete away)
+    (let loop ((i images) (d drawables) (n names))
+      (if (not (null? i))
+        (begin
+          (gimp-file-save RUN-NONINTERACTIVE (car i) (car d) (string-append result (car n)) (string-append result (car n)))
+          (gimp-image-delete (car i))
+          (loop (cdr i) (cdr d) (cdr n)))))))